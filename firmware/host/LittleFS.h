@@ -0,0 +1,78 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+/**
+ * @file LittleFS.h
+ * @brief Host stand-in for the RP2040 core's LittleFS, on top of stdio.
+ *
+ * Only for native builds (the unit tests and the render harness). Paths are
+ * resolved below a root directory on the host, so "/test.vsd" opens
+ * "<root>/test.vsd". Read-only, and only what the sound code uses of `File`.
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+class File {
+public:
+    File() {}
+    explicit File(FILE* file) : _file(file, fclose) {}
+
+    explicit operator bool() const { return (bool)_file; }
+
+    size_t read(uint8_t* buffer, size_t size) {
+        return _file ? fread(buffer, 1, size, _file.get()) : 0;
+    }
+
+    bool seek(uint32_t pos) {
+        return _file && fseek(_file.get(), pos, SEEK_SET) == 0;
+    }
+
+    size_t position() const {
+        return _file ? (size_t)ftell(_file.get()) : 0;
+    }
+
+    size_t size() const {
+        if (!_file) return 0;
+        long pos = ftell(_file.get());
+        fseek(_file.get(), 0, SEEK_END);
+        long size = ftell(_file.get());
+        fseek(_file.get(), pos, SEEK_SET);
+        return (size_t)size;
+    }
+
+    void close() { _file.reset(); }
+
+private:
+    // Copies share the handle, like copies of an fs::File on the device.
+    std::shared_ptr<FILE> _file;
+};
+
+class HostFS {
+public:
+    HostFS() : _root(".") {}
+
+    // Sets the host directory that "/" maps to.
+    void setRoot(const char* root) { _root = root; }
+
+    bool begin() { return true; }
+
+    File open(const char* path, const char* mode) {
+        if (mode[0] != 'r') return File();
+        FILE* file = fopen((_root + "/" + path).c_str(), "rb");
+        return file ? File(file) : File();
+    }
+
+    File open(const String& path, const char* mode) {
+        return open(path.c_str(), mode);
+    }
+
+private:
+    std::string _root;
+};
+
+inline HostFS LittleFS;
+
+#endif // HOST_LITTLEFS_H
@@ -0,0 +1,335 @@
+/**
+ * @file main.cpp
+ * @brief Offline render harness: a sound project and a command timeline in,
+ * a WAV file out.
+ *
+ * Builds the decoder's sound path (SoundController, SoftwareMixer,
+ * AudioEngine, VSD reader and config parser) on the host with a WAVFileDriver
+ * as its output, loads a VSD from the local filesystem and replays a scripted
+ * timeline of speed and function commands through the same AudioEngine entry
+ * points the decoder's DCC callbacks use. Rendering is not tied to a clock,
+ * so it runs as fast as the host allows.
+ *
+ * Usage:
+ *   render <project.vsd> <timeline.txt> <out.wav>
+ *          [--golden <reference.wav>] [--tolerance <dBFS>] [--min-speed <x>]
+ *
+ * The timeline has one command per line, `#` starts a comment:
+ *   <ms> speed <0-255>      Motor target speed, as handleDccSpeed()
+ *   <ms> load <0-255>       Motor load
+ *   <ms> fn <n> on|off      Function n, as the DCC function groups
+ *   <ms> volume <0-255>     Master volume, as CV 128
+ *   <ms> end                Stop rendering
+ * Times are absolute and must not decrease. Without `end` the render stops
+ * at the last command.
+ *
+ * With --golden the output is compared to a reference render; the RMS of the
+ * difference must be at or below --tolerance (default -80 dBFS). With
+ * --min-speed the render must run at least that many times faster than real
+ * time. Exit status: 0 on success, 1 on a usage or load error, 2 if the
+ * golden comparison fails, 3 if the render was too slow.
+ */
+#include <ArduinoFake.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace fakeit;
+
+// The sound sources are built into this one translation unit, like the unit
+// tests, so the harness does not depend on the hardware libraries the rest
+// of the decoder library needs.
+#include "SoundStats.cpp"
+#include "SoundController.cpp"
+#include "WAVFileDriver.cpp"
+#include "sound/InflateSource.cpp"
+#include "sound/ImaAdpcm.cpp"
+#include "sound/WAVStream.cpp"
+#include "sound/AssetCache.cpp"
+#include "sound/SampleCache.cpp"
+#include "sound/VSDReader.cpp"
+#include "sound/VSDConfigParser.cpp"
+#include "sound/Resampler.cpp"
+#include "sound/SoftwareMixer.cpp"
+#include "sound/PrimeMover.cpp"
+#include "sound/ChuffGenerator.cpp"
+#include "sound/AudioEngine.cpp"
+#include "cv_definitions.h"
+
+#define RENDER_DEFAULT_TOLERANCE_DBFS -80.0
+
+struct TimelineEvent {
+    enum class Type { SPEED, LOAD, FUNCTION, VOLUME, END };
+
+    uint32_t ms;
+    Type type;
+    uint8_t value;
+    bool state; // FUNCTION only
+};
+
+// Parses `path` into `events`. Prints the offending line and returns false
+// on a syntax error.
+static bool load_timeline(const char* path, std::vector<TimelineEvent>& events) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "render: cannot open timeline %s\n", path);
+        return false;
+    }
+    char line[128];
+    int line_number = 0;
+    uint32_t last_ms = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        unsigned long ms;
+        char command[16], arg[16];
+        int value = 0;
+        int fields = sscanf(line, "%lu %15s %d %15s", &ms, command, &value, arg);
+        if (fields <= 0) {
+            continue; // Blank or comment
+        }
+
+        TimelineEvent event = { (uint32_t)ms, TimelineEvent::Type::END, (uint8_t)value, false };
+        if (fields >= 2 && strcmp(command, "end") == 0) {
+            event.type = TimelineEvent::Type::END;
+        } else if (fields >= 3 && strcmp(command, "speed") == 0) {
+            event.type = TimelineEvent::Type::SPEED;
+        } else if (fields >= 3 && strcmp(command, "load") == 0) {
+            event.type = TimelineEvent::Type::LOAD;
+        } else if (fields >= 3 && strcmp(command, "volume") == 0) {
+            event.type = TimelineEvent::Type::VOLUME;
+        } else if (fields == 4 && strcmp(command, "fn") == 0 &&
+                   (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+            event.type = TimelineEvent::Type::FUNCTION;
+            event.state = strcmp(arg, "on") == 0;
+        } else {
+            ok = false;
+        }
+        if (ok && (value < 0 || value > 255 || event.ms < last_ms)) {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "render: %s:%d: cannot parse: %s\n", path, line_number, line);
+            break;
+        }
+        last_ms = event.ms;
+        events.push_back(event);
+    }
+    fclose(file);
+    if (ok && (events.empty() || events.back().type != TimelineEvent::Type::END)) {
+        events.push_back({ last_ms, TimelineEvent::Type::END, 0, false });
+    }
+    return ok;
+}
+
+// Reads a whole host file into `data`.
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return true;
+}
+
+// Decodes a WAV file to 16-bit stereo frames at its own rate, with the same
+// code the decoder plays sounds with.
+static bool decode_wav(const char* path, std::vector<int16_t>& frames) {
+    std::vector<uint8_t> data;
+    WAVStream stream;
+    if (!read_file(path, data) || !stream.begin(data.data(), data.size())) {
+        return false;
+    }
+    int16_t block[256 * 2];
+    for (;;) {
+        stream.service();
+        size_t read = stream.read_frames(block, 256);
+        if (read == 0) break;
+        frames.insert(frames.end(), block, block + read * 2);
+    }
+    return true;
+}
+
+// Compares `path` against `golden_path` and prints the result. Returns true
+// if the RMS difference is at or below `tolerance_dbfs`.
+static bool compare_golden(const char* path, const char* golden_path, double tolerance_dbfs) {
+    std::vector<int16_t> output, golden;
+    if (!decode_wav(path, output)) {
+        fprintf(stderr, "render: cannot read back %s\n", path);
+        return false;
+    }
+    if (!decode_wav(golden_path, golden)) {
+        fprintf(stderr, "render: cannot read golden file %s\n", golden_path);
+        return false;
+    }
+    if (output.size() != golden.size()) {
+        printf("golden: length differs, %zu frames vs %zu in %s\n",
+               output.size() / 2, golden.size() / 2, golden_path);
+        return false;
+    }
+    double sum = 0;
+    int max_diff = 0;
+    for (size_t i = 0; i < output.size(); i++) {
+        int diff = abs(output[i] - golden[i]);
+        if (diff > max_diff) max_diff = diff;
+        sum += (double)diff * diff;
+    }
+    double rms = output.empty() ? 0 : sqrt(sum / output.size()) / 32768.0;
+    double dbfs = rms > 0 ? 20 * log10(rms) : -INFINITY;
+    bool pass = dbfs <= tolerance_dbfs;
+    printf("golden: difference %.1f dBFS RMS, %d LSB peak (limit %.1f dBFS): %s\n",
+           dbfs, max_diff, tolerance_dbfs, pass ? "match" : "MISMATCH");
+    return pass;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: render <project.vsd> <timeline.txt> <out.wav>\n"
+            "              [--golden <reference.wav>] [--tolerance <dBFS>] [--min-speed <x>]\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+    const char* project_path = argv[1];
+    const char* timeline_path = argv[2];
+    const char* output_path = argv[3];
+    const char* golden_path = nullptr;
+    double tolerance_dbfs = RENDER_DEFAULT_TOLERANCE_DBFS;
+    double min_speed = 0;
+    for (int i = 4; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--golden") == 0) {
+            golden_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0) {
+            tolerance_dbfs = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--min-speed") == 0) {
+            min_speed = atof(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    // The mixer times its blocks with micros(). Only for the statistics: the
+    // render governor is off (see below).
+    When(Method(ArduinoFake(), micros)).AlwaysDo([]() -> unsigned long {
+        return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    });
+
+    std::vector<TimelineEvent> timeline;
+    if (!load_timeline(timeline_path, timeline)) {
+        return 1;
+    }
+
+    // The VSD's directory stands in for the LittleFS partition.
+    std::string project(project_path);
+    size_t slash = project.find_last_of('/');
+    std::string root = slash == std::string::npos ? "." : project.substr(0, slash);
+    std::string name = "/" + (slash == std::string::npos ? project : project.substr(slash + 1));
+    LittleFS.setRoot(root.c_str());
+
+    WAVFileDriver* sink = new WAVFileDriver();
+    if (!sink->open(output_path)) {
+        fprintf(stderr, "render: cannot create %s\n", output_path);
+        delete sink;
+        return 1;
+    }
+    SoundController controller(sink);
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    // No render budget: the governor would shed voices whenever the host is
+    // busy, so the output would depend on the host's load and --golden
+    // comparisons would fail at random.
+    mixer.setRenderBudget(0);
+    mixer.setMasterVolume(DECODER_DEFAULT_SOUND_MASTER_VOLUME);
+    AudioEngine engine(mixer);
+    VSDReader reader;
+    VSDConfigParser config;
+
+    // Load the project as LocoFuncDecoder::begin() does, with every CV at
+    // its default.
+    uint8_t* xml_data = nullptr;
+    size_t xml_size = 0;
+    if (!reader.begin(name.c_str()) || !reader.get_file_data("config.xml", &xml_data, &xml_size)) {
+        fprintf(stderr, "render: cannot read config.xml from %s\n", project_path);
+        return 1;
+    }
+    bool parsed = config.parse((char*)xml_data, xml_size);
+    free(xml_data);
+    if (!parsed) {
+        fprintf(stderr, "render: cannot parse config.xml of %s\n", project_path);
+        return 1;
+    }
+    config.resolve_assets(reader);
+    engine.setSoundProject(&reader, &config);
+    engine.setCacheSize(DECODER_DEFAULT_SOUND_CACHE_SIZE);
+    engine.setNotchTime(DECODER_DEFAULT_SOUND_NOTCH_TIME * 10);
+    engine.setChuffsPerRevolution(DECODER_DEFAULT_SOUND_CHUFFS_PER_REV);
+    engine.setWheelDiameter(DECODER_DEFAULT_SOUND_WHEEL_DIAMETER);
+    engine.setFullSpeed(DECODER_DEFAULT_SOUND_FULL_SPEED * 10);
+    const uint16_t fade_ms = DECODER_DEFAULT_SOUND_FADE_TIME * 10;
+
+    // Each engine loop renders one buffer. Commands are posted before the
+    // buffer they fall into, so they land within one buffer of their time,
+    // as they would on the device.
+    uint32_t dropped = 0;
+    size_t next_event = 0;
+    bool ended = false;
+    auto wall_start = std::chrono::steady_clock::now();
+    while (!ended) {
+        uint64_t now_ms = (uint64_t)sink->getFramesWritten() * 1000 / WAV_FILE_SAMPLE_RATE;
+        while (next_event < timeline.size() && timeline[next_event].ms <= now_ms) {
+            const TimelineEvent& event = timeline[next_event++];
+            bool posted = true;
+            switch (event.type) {
+                case TimelineEvent::Type::SPEED:    posted = engine.setSpeed(event.value); break;
+                case TimelineEvent::Type::LOAD:     posted = engine.setLoad(event.value); break;
+                case TimelineEvent::Type::VOLUME:   posted = engine.setVolume(event.value); break;
+                case TimelineEvent::Type::FUNCTION: posted = engine.setFunction(event.value, event.state, fade_ms); break;
+                case TimelineEvent::Type::END:      ended = true; break;
+            }
+            if (!posted) dropped++;
+        }
+        if (!ended) {
+            engine.loop();
+        }
+    }
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    uint32_t frames = sink->getFramesWritten();
+    if (!sink->close()) {
+        fprintf(stderr, "render: write to %s failed\n", output_path);
+        return 1;
+    }
+
+    double audio_s = (double)frames / WAV_FILE_SAMPLE_RATE;
+    double speed = wall_s > 0 ? audio_s / wall_s : INFINITY;
+    printf("rendered %.2f s of audio in %.3f s (%.1fx real time) to %s\n",
+           audio_s, wall_s, speed, output_path);
+    if (dropped) {
+        printf("%u timeline commands dropped, command queue full\n", (unsigned)dropped);
+    }
+    controller.dumpStats(stdout);
+
+    if (golden_path && !compare_golden(output_path, golden_path, tolerance_dbfs)) {
+        return 2;
+    }
+    if (min_speed > 0 && speed < min_speed) {
+        printf("render speed %.1fx is below the required %.1fx\n", speed, min_speed);
+        return 3;
+    }
+    return 0;
+}
@@ -1,28 +1,72 @@
 #include "DFPlayerDriver.h"
 
-DFPlayerDriver::DFPlayerDriver(uint8_t rx_pin, uint8_t tx_pin) :
-    _dfplayer_serial(rx_pin, tx_pin),
-    _dfplayer(_dfplayer_serial)
-{
+DFPlayerDriver::DFPlayerDriver(uint8_t rx_pin, uint8_t tx_pin)
+    : _rx_pin(rx_pin),
+      _tx_pin(tx_pin),
+      _serial(nullptr) {
+}
+
+DFPlayerDriver::DFPlayerDriver(Stream* serial)
+    : _rx_pin(0),
+      _tx_pin(0),
+      _serial(serial) {
+}
+
+int DFPlayerDriver::uartForPins(uint8_t tx_pin, uint8_t rx_pin) {
+    // UART TX is on GPIO 4n, RX on 4n + 1. The pin groups alternate between
+    // the UARTs every eight pins, starting half way: GP0/1 UART0, GP4/5 and
+    // GP8/9 UART1, GP12/13 and GP16/17 UART0, and so on up to GP28/29.
+    if (tx_pin > 29 || tx_pin % 4 != 0 || rx_pin != tx_pin + 1) {
+        return -1;
+    }
+    return ((tx_pin + 4) / 8) % 2;
 }
 
 bool DFPlayerDriver::begin() {
-    _dfplayer_serial.begin(9600);
-    // The library doesn't have a begin() method that takes a stream.
-    // It's initialized in the constructor.
+#if defined(ARDUINO_ARCH_RP2040)
+    if (!_serial) {
+        // setTX()/setRX() panic on a pin their UART cannot reach, so only
+        // the UART the pins belong to is touched.
+        int uart = uartForPins(_tx_pin, _rx_pin);
+        if (uart < 0) {
+            return false;
+        }
+        SerialUART* serial = uart == 0 ? &Serial1 : &Serial2;
+        serial->setTX(_tx_pin);
+        serial->setRX(_rx_pin);
+        serial->begin(9600);
+        _serial = serial;
+    }
+#endif
+    if (!_serial) {
+        return false;
+    }
+    _queue.clear();
     return true;
 }
 
 void DFPlayerDriver::loop() {
-    _dfplayer.loop();
+    if (!_serial) {
+        return;
+    }
+    // Replies and status reports from the module are not used.
+    while (_serial->available()) {
+        _serial->read();
+    }
+    // One frame per DFPLAYER_COMMAND_INTERVAL_MS: the FIFO (32 bytes) has
+    // long drained the previous one, so write() returns at once.
+    uint8_t frame[DFPLAYER_FRAME_SIZE];
+    if (_queue.next(millis(), frame)) {
+        _serial->write(frame, DFPLAYER_FRAME_SIZE);
+    }
 }
 
 void DFPlayerDriver::play(uint16_t track) {
-    _dfplayer.playGlobalTrack(track);
+    _queue.play(track);
 }
 
 void DFPlayerDriver::setVolume(uint8_t volume) {
     // The DFPlayer has a volume range of 0-30. We need to map our 0-255 range.
     uint8_t dfp_volume = map(volume, 0, 255, 0, 30);
-    _dfplayer.setVolume(dfp_volume);
+    _queue.setVolume(dfp_volume);
 }
@@ -2,21 +2,57 @@
 #define DFPLAYERDRIVER_H
 
 #include "SoundDriver.h"
-#include <SoftwareSerial.h>
-#include <DFMiniMp3.h>
+#include "DFPlayerQueue.h"
 
+/**
+ * @class DFPlayerDriver
+ * @brief Plays tracks from a DFPlayer Mini MP3 module over a serial link.
+ *
+ * The link runs on the RP2040 hardware UART the pins belong to. play() and
+ * setVolume() only queue the command (see DFPlayerQueue); loop() hands the
+ * queued frames to the UART FIFO at the pace the module accepts, so no
+ * caller waits for the 9600 baud line.
+ */
 class DFPlayerDriver : public SoundDriver {
 public:
     DFPlayerDriver(uint8_t rx_pin, uint8_t tx_pin);
 
+    /**
+     * @brief Uses a serial link that is already open at 9600 baud instead
+     *        of a UART picked by pins, e.g. a test double on the host.
+     */
+    explicit DFPlayerDriver(Stream* serial);
+
+    /**
+     * @brief Opens the UART that both pins belong to.
+     * @return False, leaving both UARTs alone, if the pins are not the TX
+     *         and RX pins of the same UART.
+     */
     bool begin() override;
     void play(uint16_t track) override;
     void setVolume(uint8_t volume) override;
     void loop() override;
 
+    // The module decodes its own audio; it takes no samples.
+    size_t availableForWrite() override { return 0; }
+    size_t write(const uint8_t* data, size_t size) override { return 0; }
+
+    /**
+     * @brief Returns the commands dropped because the queue was full.
+     */
+    uint32_t getDroppedCommands() const { return _queue.getDropped(); }
+
+    /**
+     * @brief Returns the UART (0 or 1) whose TX is GPIO `tx_pin` and whose RX
+     *        is GPIO `rx_pin`, or -1 if there is none.
+     */
+    static int uartForPins(uint8_t tx_pin, uint8_t rx_pin);
+
 private:
-    SoftwareSerial _dfplayer_serial;
-    DFMiniMp3<SoftwareSerial> _dfplayer;
+    uint8_t _rx_pin;
+    uint8_t _tx_pin;
+    Stream* _serial;
+    DFPlayerQueue _queue;
 };
 
 #endif // DFPLAYERDRIVER_H
@@ -0,0 +1,95 @@
+#include "DFPlayerQueue.h"
+
+DFPlayerQueue::DFPlayerQueue() : _dropped(0), _coalesced(0) {
+    clear();
+}
+
+void DFPlayerQueue::clear() {
+    _head = 0;
+    _count = 0;
+    _last_sent_ms = 0;
+    _sent_any = false;
+    _sent_volume = -1;
+}
+
+bool DFPlayerQueue::play(uint16_t track) {
+    // Restarting the same track twice before the module saw the first
+    // request sounds like one restart.
+    if (_count > 0) {
+        Command& last = at(_count - 1);
+        if (last.command == DFPLAYER_CMD_PLAY_TRACK && last.param == track) {
+            _coalesced++;
+            return true;
+        }
+    }
+    return push(DFPLAYER_CMD_PLAY_TRACK, track);
+}
+
+bool DFPlayerQueue::setVolume(uint8_t volume) {
+    for (uint8_t i = 0; i < _count; i++) {
+        Command& queued = at(i);
+        if (queued.command == DFPLAYER_CMD_SET_VOLUME) {
+            queued.param = volume;
+            _coalesced++;
+            return true;
+        }
+    }
+    if (_sent_volume == volume) {
+        _coalesced++;
+        return true;
+    }
+    return push(DFPLAYER_CMD_SET_VOLUME, volume);
+}
+
+bool DFPlayerQueue::push(uint8_t command, uint16_t param) {
+    if (_count == DFPLAYER_QUEUE_SIZE) {
+        _dropped++;
+        return false;
+    }
+    Command& slot = at(_count);
+    slot.command = command;
+    slot.param = param;
+    _count++;
+    return true;
+}
+
+bool DFPlayerQueue::next(uint32_t now_ms, uint8_t* frame) {
+    while (_count > 0) {
+        if (_sent_any && now_ms - _last_sent_ms < DFPLAYER_COMMAND_INTERVAL_MS) {
+            return false;
+        }
+        Command command = at(0);
+        _head = (_head + 1) % DFPLAYER_QUEUE_SIZE;
+        _count--;
+        if (command.command == DFPLAYER_CMD_SET_VOLUME) {
+            // Coalescing may have set it back to what the module has.
+            if (_sent_volume == command.param) {
+                continue;
+            }
+            _sent_volume = command.param;
+        }
+        encode(command.command, command.param, frame);
+        _last_sent_ms = now_ms;
+        _sent_any = true;
+        return true;
+    }
+    return false;
+}
+
+void DFPlayerQueue::encode(uint8_t command, uint16_t param, uint8_t* frame) {
+    frame[0] = 0x7E; // Start
+    frame[1] = 0xFF; // Version
+    frame[2] = 0x06; // Length, version to parameter
+    frame[3] = command;
+    frame[4] = 0x00; // No feedback
+    frame[5] = (uint8_t)(param >> 8);
+    frame[6] = (uint8_t)param;
+    uint16_t sum = 0;
+    for (int i = 1; i < 7; i++) {
+        sum += frame[i];
+    }
+    uint16_t checksum = (uint16_t)(0 - sum);
+    frame[7] = (uint8_t)(checksum >> 8);
+    frame[8] = (uint8_t)checksum;
+    frame[9] = 0xEF; // End
+}
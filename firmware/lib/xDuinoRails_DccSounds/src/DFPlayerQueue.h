@@ -0,0 +1,88 @@
+#ifndef DFPLAYERQUEUE_H
+#define DFPLAYERQUEUE_H
+
+#include <Arduino.h>
+
+// Commands waiting to be sent. Function presses arrive in bursts of a few;
+// anything beyond this is dropped rather than delivered late.
+#define DFPLAYER_QUEUE_SIZE 8
+
+// Minimum gap between two commands. A frame takes about 10 ms on the wire
+// at 9600 baud and the module loses commands that follow each other closer
+// than this.
+#ifndef DFPLAYER_COMMAND_INTERVAL_MS
+#define DFPLAYER_COMMAND_INTERVAL_MS 30
+#endif
+
+// Bytes in one serial frame: start, version, length, command, feedback,
+// parameter (2), checksum (2), end.
+#define DFPLAYER_FRAME_SIZE 10
+
+// Command codes of the DFPlayer Mini serial protocol.
+#define DFPLAYER_CMD_PLAY_TRACK 0x03
+#define DFPLAYER_CMD_SET_VOLUME 0x06
+
+/**
+ * @class DFPlayerQueue
+ * @brief Paces commands to a DFPlayer Mini without blocking the caller.
+ *
+ * play() and setVolume() only queue a command, so they are safe to call
+ * from the DCC callbacks. The driver loop asks for the next frame with
+ * next(), which hands one out at most every DFPLAYER_COMMAND_INTERVAL_MS.
+ * Volume changes are coalesced: a queued volume command is updated in place
+ * and one that would not change the module's volume is not sent at all.
+ */
+class DFPlayerQueue {
+public:
+    DFPlayerQueue();
+
+    // Drops everything queued and forgets the module's volume.
+    void clear();
+
+    /**
+     * @brief Queues a track to play.
+     * @return False if the queue was full and the command dropped.
+     */
+    bool play(uint16_t track);
+
+    /**
+     * @brief Queues a volume change, 0-30 in the module's steps.
+     * @return False if the queue was full and the command dropped.
+     */
+    bool setVolume(uint8_t volume);
+
+    /**
+     * @brief Takes the next command if the module is ready for it.
+     * @param now_ms The current time, e.g. millis().
+     * @param frame Receives DFPLAYER_FRAME_SIZE bytes to send.
+     * @return True if a frame was written to `frame`.
+     */
+    bool next(uint32_t now_ms, uint8_t* frame);
+
+    uint8_t getPending() const { return _count; }
+    uint32_t getDropped() const { return _dropped; }
+    uint32_t getCoalesced() const { return _coalesced; }
+
+    // Builds the serial frame for `command` with `param`, no feedback requested.
+    static void encode(uint8_t command, uint16_t param, uint8_t* frame);
+
+private:
+    struct Command {
+        uint8_t command;
+        uint16_t param;
+    };
+
+    bool push(uint8_t command, uint16_t param);
+    Command& at(uint8_t index) { return _commands[(_head + index) % DFPLAYER_QUEUE_SIZE]; }
+
+    Command _commands[DFPLAYER_QUEUE_SIZE];
+    uint8_t _head;
+    uint8_t _count;
+    uint32_t _last_sent_ms;
+    bool _sent_any;
+    int16_t _sent_volume; // -1 until a volume was sent
+    uint32_t _dropped;
+    uint32_t _coalesced;
+};
+
+#endif // DFPLAYERQUEUE_H
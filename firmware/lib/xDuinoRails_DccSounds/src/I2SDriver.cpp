@@ -1,4 +1,5 @@
 #include "I2SDriver.h"
+#include <string.h>
 #include "hardware/pio.h"
 #include "hardware/dma.h"
 #include "hardware/clocks.h"
@@ -8,8 +9,18 @@
 // --- Global State ---
 static I2SDriver* _instance;
 
-I2SDriver::I2SDriver() : _dma_write_ptr(0), _dma_read_ptr(0) {
+I2SDriver::I2SDriver()
+    : _dma_write_ptr(0),
+      _dma_read_ptr(0),
+      _volume(255),
+      _render_callback(nullptr),
+      _render_context(nullptr),
+      _playing_half(0),
+      _underrun_count(0) {
     _instance = this;
+    _half_ready[0] = true;
+    _half_ready[1] = false;
+    memset(_dma_buffer, 0, sizeof(_dma_buffer));
 }
 
 bool I2SDriver::begin() {
@@ -28,15 +39,18 @@ void I2SDriver::play(uint16_t track) {
 }
 
 void I2SDriver::setVolume(uint8_t volume) {
-    // To be implemented.
+    // Scales the sounds the driver plays by itself (playRaw()). Mixed audio
+    // arrives already scaled by the mixer's master gain.
+    _volume = volume;
 }
 
 void I2SDriver::playRaw(const int16_t* pcm_data, size_t data_len) {
     // Simple implementation: just copy the data into the buffer, overwriting whatever is there.
     // This is not ideal for mixing, but it's good enough for simple sound effects.
-    size_t samples_to_write = min(data_len / sizeof(int16_t), 256);
+    size_t samples_to_write = min(data_len / sizeof(int16_t), (size_t)I2S_DMA_BUFFER_WORDS);
     for (size_t i = 0; i < samples_to_write; i++) {
-        _dma_buffer[i] = (uint32_t)pcm_data[i] << 16 | (uint32_t)pcm_data[i];
+        int16_t sample = (int16_t)(((int32_t)pcm_data[i] * _volume) / 255);
+        _dma_buffer[i] = (uint32_t)(uint16_t)sample << 16 | (uint32_t)(uint16_t)sample;
     }
 }
 
@@ -54,15 +68,32 @@ void I2SDriver::setupPIO() {
     pio_sm_set_enabled(pio, sm, true);
 }
 
+void I2SDriver::on_half_complete(uint8_t half, int channel) {
+    // The channels are chained, so the other half is already playing. Re-arm
+    // this channel for its next turn without triggering it.
+    dma_channel_set_read_addr(channel, &_dma_buffer[half * I2S_BUFFER_FRAMES], false);
+    _playing_half = half ^ 1;
+    _dma_read_ptr = _playing_half * I2S_BUFFER_FRAMES;
+
+    if (_render_callback) {
+        if (!_half_ready[half ^ 1]) {
+            _underrun_count++;
+        }
+        // Silence the released half so a late render plays as a gap instead
+        // of repeating stale audio.
+        memset(&_dma_buffer[half * I2S_BUFFER_FRAMES], 0, I2S_BUFFER_FRAMES * sizeof(uint32_t));
+        _half_ready[half] = false;
+    }
+}
+
 void I2SDriver::dma_handler() {
     if (dma_channel_get_irq0_status(_instance->_dma_channel_a)) {
         dma_channel_acknowledge_irq0(_instance->_dma_channel_a);
-        _instance->_dma_read_ptr = 128;
-        dma_channel_start(_instance->_dma_channel_a);
-    } else if (dma_channel_get_irq0_status(_instance->_dma_channel_b)) {
+        _instance->on_half_complete(0, _instance->_dma_channel_a);
+    }
+    if (dma_channel_get_irq0_status(_instance->_dma_channel_b)) {
         dma_channel_acknowledge_irq0(_instance->_dma_channel_b);
-        _instance->_dma_read_ptr = 0;
-        dma_channel_start(_instance->_dma_channel_b);
+        _instance->on_half_complete(1, _instance->_dma_channel_b);
     }
 }
 
@@ -75,13 +106,14 @@ void I2SDriver::setupDMA() {
     channel_config_set_read_increment(&c, true);
     channel_config_set_write_increment(&c, false);
     channel_config_set_dreq(&c, pio_get_dreq(pio0, 0, true));
+    channel_config_set_chain_to(&c, _dma_channel_b);
 
     dma_channel_configure(
         _dma_channel_a,
         &c,
         &pio0->txf[0],
         _dma_buffer,
-        256 / 2,
+        I2S_BUFFER_FRAMES,
         false
     );
 
@@ -90,13 +122,14 @@ void I2SDriver::setupDMA() {
     channel_config_set_read_increment(&c, true);
     channel_config_set_write_increment(&c, false);
     channel_config_set_dreq(&c, pio_get_dreq(pio0, 0, true));
+    channel_config_set_chain_to(&c, _dma_channel_a);
 
     dma_channel_configure(
         _dma_channel_b,
         &c,
         &pio0->txf[0],
-        &_dma_buffer[256 / 2],
-        256 / 2,
+        &_dma_buffer[I2S_BUFFER_FRAMES],
+        I2S_BUFFER_FRAMES,
         false
     );
 
@@ -111,7 +144,7 @@ void I2SDriver::setupDMA() {
 size_t I2SDriver::availableForWrite() {
     int16_t diff = _dma_read_ptr - _dma_write_ptr;
     if (diff <= 0) {
-        diff += 256;
+        diff += I2S_DMA_BUFFER_WORDS;
     }
     return (diff - 1) * sizeof(uint32_t);
 }
@@ -122,8 +155,35 @@ size_t I2SDriver::write(const uint8_t* data, size_t size) {
 
     for (size_t i = 0; i < samples_to_write; i++) {
         _dma_buffer[_dma_write_ptr] = ((uint32_t*)data)[i];
-        _dma_write_ptr = (_dma_write_ptr + 1) % 256;
+        _dma_write_ptr = (_dma_write_ptr + 1) % I2S_DMA_BUFFER_WORDS;
     }
 
     return samples_to_write * sizeof(uint32_t);
 }
+
+bool I2SDriver::setRenderCallback(RenderCallback callback, void* context) {
+    _render_context = context;
+    _render_callback = callback;
+    return true;
+}
+
+size_t I2SDriver::render() {
+    if (!_render_callback) {
+        return 0;
+    }
+
+    // Only the half that plays next is ever written; the playing half stays
+    // untouched even after an underrun.
+    uint8_t half = _playing_half ^ 1;
+    if (_half_ready[half]) {
+        return 0;
+    }
+
+    _render_callback(_render_context, (int16_t*)&_dma_buffer[half * I2S_BUFFER_FRAMES], I2S_BUFFER_FRAMES);
+    _half_ready[half] = true;
+    return I2S_BUFFER_FRAMES;
+}
+
+uint32_t I2SDriver::getUnderrunCount() {
+    return _underrun_count;
+}
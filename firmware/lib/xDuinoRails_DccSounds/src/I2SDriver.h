@@ -19,6 +19,14 @@
 #define SAMPLE_RATE 44100
 #define BITS_PER_SAMPLE 16
 
+// --- DMA Buffer Configuration ---
+// Frames per DMA half-buffer. Each frame is one 32-bit stereo word, so the
+// output latency is roughly 2 * I2S_BUFFER_FRAMES / SAMPLE_RATE seconds.
+#ifndef I2S_BUFFER_FRAMES
+#define I2S_BUFFER_FRAMES 128
+#endif
+#define I2S_DMA_BUFFER_WORDS (I2S_BUFFER_FRAMES * 2)
+
 class I2SDriver : public SoundDriver {
 public:
     I2SDriver();
@@ -38,17 +46,35 @@ public:
     size_t availableForWrite() override;
     size_t write(const uint8_t* data, size_t size) override;
 
+    /**
+     * @brief Enables pull mode. The two DMA channels are chained into a
+     *        ping-pong pair and every half-buffer released by the DMA is
+     *        rendered in place by the callback on the next render() call.
+     */
+    bool setRenderCallback(RenderCallback callback, void* context) override;
+    size_t render() override;
+    uint32_t getUnderrunCount() override;
+
 private:
     void setupPIO();
     void setupDMA();
+    void on_half_complete(uint8_t half, int channel);
 
     static void dma_handler();
 
-    uint32_t _dma_buffer[256];
+    uint32_t _dma_buffer[I2S_DMA_BUFFER_WORDS];
     volatile uint16_t _dma_write_ptr;
     volatile uint16_t _dma_read_ptr;
     int _dma_channel_a;
     int _dma_channel_b;
+
+    uint8_t _volume;
+
+    RenderCallback _render_callback;
+    void* _render_context;
+    volatile uint8_t _playing_half;
+    volatile bool _half_ready[2];
+    volatile uint32_t _underrun_count;
 };
 
 #endif // I2SDRIVER_H
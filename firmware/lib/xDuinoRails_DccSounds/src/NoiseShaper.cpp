@@ -0,0 +1,49 @@
+#include "NoiseShaper.h"
+
+NoiseShaper::NoiseShaper(uint8_t bits) : _dither(22222) {
+    setBits(bits);
+}
+
+void NoiseShaper::setBits(uint8_t bits) {
+    if (bits < NOISE_SHAPER_MIN_BITS) bits = NOISE_SHAPER_MIN_BITS;
+    if (bits > NOISE_SHAPER_MAX_BITS) bits = NOISE_SHAPER_MAX_BITS;
+    _bits = bits;
+    _shift = 16 - bits;
+    reset();
+}
+
+void NoiseShaper::reset() {
+    _error = 0;
+}
+
+uint16_t NoiseShaper::next(int32_t sample) {
+    // Shaped input: subtracting e[n-1] leaves the output as the input plus
+    // (1 - z^-1) times the quantization error.
+    int32_t shaped = sample - _error;
+
+    // TPDF dither: the sum of two uniform values of one output step each.
+    const int32_t step = 1 << _shift;
+    _dither = _dither * 1664525u + 1013904223u;
+    int32_t dither = (int32_t)((_dither >> 20) & (step - 1)) + (int32_t)((_dither >> 8) & (step - 1)) - (step - 1);
+
+    // Round to the output step and move silence to mid-scale.
+    int32_t level = ((shaped + dither + 32768 + (step >> 1)) >> _shift);
+    const int32_t max_level = getMaxLevel();
+    if (level < 0) level = 0;
+    if (level > max_level) level = max_level;
+
+    // Error in input units. Clamped so a clipped peak cannot make the
+    // feedback loop run away.
+    int32_t error = ((level << _shift) - 32768) - shaped;
+    if (error > 2 * step) error = 2 * step;
+    if (error < -2 * step) error = -2 * step;
+    _error = error;
+    return (uint16_t)level;
+}
+
+void NoiseShaper::convert(uint16_t* dst, const int16_t* src, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        dst[i] = next(((int32_t)src[0] + src[1]) >> 1);
+        src += 2;
+    }
+}
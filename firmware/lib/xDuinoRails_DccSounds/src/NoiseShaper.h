@@ -0,0 +1,52 @@
+#ifndef NOISESHAPER_H
+#define NOISESHAPER_H
+
+#include <Arduino.h>
+
+// Supported output resolutions, in bits.
+#define NOISE_SHAPER_MIN_BITS 6
+#define NOISE_SHAPER_MAX_BITS 12
+
+/**
+ * @class NoiseShaper
+ * @brief Requantizes 16-bit audio to a low-resolution PWM duty cycle.
+ *
+ * Plain truncation to 8 or 10 bits leaves a quantization error that is
+ * correlated with the signal and spread evenly over the audio band. This
+ * converter adds triangular (TPDF) dither of one output step and feeds the
+ * error back through a first-order filter, (1 - z^-1). That only moves
+ * noise within the 22 kHz band of the sample rate: it drops well below
+ * plain rounding under 2 kHz, where the ear is most sensitive, and rises
+ * by up to 6 dB towards 22 kHz, about 8 dB more in total with the dither.
+ * A second-order filter would cost 12 dB at the top of the band for
+ * little gain at these resolutions. Fixed point only; one multiply-free
+ * loop per sample.
+ */
+class NoiseShaper {
+public:
+    explicit NoiseShaper(uint8_t bits = 10);
+
+    // Sets the output resolution and clears the filter state.
+    void setBits(uint8_t bits);
+    uint8_t getBits() const { return _bits; }
+
+    // Highest output level, 2^bits - 1. Silence is (getMaxLevel() + 1) / 2.
+    uint16_t getMaxLevel() const { return (uint16_t)((1u << _bits) - 1); }
+
+    // Clears the error feedback.
+    void reset();
+
+    // Converts one signed 16-bit sample to an output level.
+    uint16_t next(int32_t sample);
+
+    // Converts `frames` interleaved 16-bit stereo frames to mono levels.
+    void convert(uint16_t* dst, const int16_t* src, size_t frames);
+
+private:
+    uint8_t _bits;
+    uint8_t _shift;     // 16 - bits
+    int32_t _error;     // Last quantization error, in input units
+    uint32_t _dither;   // LCG state
+};
+
+#endif // NOISESHAPER_H
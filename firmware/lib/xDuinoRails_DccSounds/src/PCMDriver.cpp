@@ -1,13 +1,38 @@
 #include "PCMDriver.h"
+#include <string.h>
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "generated/pdm.pio.h"
 #include "generated/beep_sound.h"
-#include "pico/stdlib.h"
 
-PCMDriver::PCMDriver(uint8_t pcm_pin) : _pcm_pin(pcm_pin) {
+// pio0 is left to the I2S driver.
+#define PCM_PIO pio1
+
+// --- Global State ---
+static PCMDriver* _instance;
+
+PCMDriver::PCMDriver(uint8_t pcm_pin)
+    : _pcm_pin(pcm_pin),
+      _volume(255),
+      _pio_sm(0),
+      _dma_write_ptr(0),
+      _dma_read_ptr(0),
+      _render_callback(nullptr),
+      _render_context(nullptr),
+      _playing_half(0),
+      _underrun_count(0) {
+    _instance = this;
+    _half_ready[0] = true;
+    _half_ready[1] = false;
+    for (size_t i = 0; i < PCM_DMA_BUFFER_WORDS; i++) {
+        _dma_buffer[i] = PCM_SILENCE_WORD;
+    }
 }
 
 bool PCMDriver::begin() {
-    gpio_init(_pcm_pin);
-    gpio_set_dir(_pcm_pin, GPIO_OUT);
+    setupPIO();
+    setupDMA();
     return true;
 }
 
@@ -16,17 +41,162 @@ void PCMDriver::loop() {
 
 void PCMDriver::play(uint16_t track) {
     if (track == 1) {
-        // Simple blocking implementation for now
-        for (size_t i = 0; i < beep_sound_len / 2; i++) {
-            uint8_t sample = ((int16_t*)beep_sound)[i] >> 8;
-            for (int j = 0; j < 8; j++) {
-                gpio_put(_pcm_pin, (sample >> j) & 0x01);
-                sleep_us(11); // ~8kHz sample rate
-            }
-        }
+        playRaw((const int16_t*)beep_sound, beep_sound_len);
     }
 }
 
 void PCMDriver::setVolume(uint8_t volume) {
-    // Not applicable
+    // Scales the sounds the driver plays by itself (playRaw()). Mixed audio
+    // arrives already scaled by the mixer's master gain.
+    _volume = volume;
+}
+
+void PCMDriver::playRaw(const int16_t* pcm_data, size_t data_len) {
+    // Like I2SDriver::playRaw(): overwrites the buffer from the start, so
+    // only sounds up to the buffer length play in full.
+    size_t samples_to_write = min(data_len / sizeof(int16_t), (size_t)PCM_DMA_BUFFER_WORDS);
+    for (size_t i = 0; i < samples_to_write; i++) {
+        _dma_buffer[i] = _modulator.modulate(((int32_t)pcm_data[i] * _volume) / 255);
+    }
+}
+
+void PCMDriver::setupPIO() {
+    _pio_sm = pio_claim_unused_sm(PCM_PIO, true);
+    uint offset = pio_add_program(PCM_PIO, &pdm_program);
+
+    pdm_program_init(PCM_PIO, _pio_sm, offset, _pcm_pin);
+
+    // One bit per state machine cycle
+    float div = (float)clock_get_hz(clk_sys) / (PCM_SAMPLE_RATE * SIGMA_DELTA_OVERSAMPLING);
+    pio_sm_set_clkdiv(PCM_PIO, _pio_sm, div);
+
+    pio_sm_set_enabled(PCM_PIO, _pio_sm, true);
+}
+
+void PCMDriver::on_half_complete(uint8_t half, int channel) {
+    // The channels are chained, so the other half is already playing. Re-arm
+    // this channel for its next turn without triggering it.
+    dma_channel_set_read_addr(channel, &_dma_buffer[half * PCM_BUFFER_FRAMES], false);
+    _playing_half = half ^ 1;
+    _dma_read_ptr = _playing_half * PCM_BUFFER_FRAMES;
+
+    if (_render_callback) {
+        if (!_half_ready[half ^ 1]) {
+            _underrun_count++;
+        }
+        // Silence the released half so a late render plays as a gap instead
+        // of repeating stale audio.
+        for (size_t i = 0; i < PCM_BUFFER_FRAMES; i++) {
+            _dma_buffer[half * PCM_BUFFER_FRAMES + i] = PCM_SILENCE_WORD;
+        }
+        _half_ready[half] = false;
+    }
+}
+
+void PCMDriver::dma_handler() {
+    if (dma_channel_get_irq0_status(_instance->_dma_channel_a)) {
+        dma_channel_acknowledge_irq0(_instance->_dma_channel_a);
+        _instance->on_half_complete(0, _instance->_dma_channel_a);
+    }
+    if (dma_channel_get_irq0_status(_instance->_dma_channel_b)) {
+        dma_channel_acknowledge_irq0(_instance->_dma_channel_b);
+        _instance->on_half_complete(1, _instance->_dma_channel_b);
+    }
+}
+
+void PCMDriver::setupDMA() {
+    _dma_channel_a = dma_claim_unused_channel(true);
+    _dma_channel_b = dma_claim_unused_channel(true);
+    uint dreq = pio_get_dreq(PCM_PIO, _pio_sm, true);
+
+    dma_channel_config c = dma_channel_get_default_config(_dma_channel_a);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, dreq);
+    channel_config_set_chain_to(&c, _dma_channel_b);
+
+    dma_channel_configure(
+        _dma_channel_a,
+        &c,
+        &PCM_PIO->txf[_pio_sm],
+        _dma_buffer,
+        PCM_BUFFER_FRAMES,
+        false
+    );
+
+    c = dma_channel_get_default_config(_dma_channel_b);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, dreq);
+    channel_config_set_chain_to(&c, _dma_channel_a);
+
+    dma_channel_configure(
+        _dma_channel_b,
+        &c,
+        &PCM_PIO->txf[_pio_sm],
+        &_dma_buffer[PCM_BUFFER_FRAMES],
+        PCM_BUFFER_FRAMES,
+        false
+    );
+
+    dma_channel_set_irq0_enabled(_dma_channel_a, true);
+    dma_channel_set_irq0_enabled(_dma_channel_b, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_start(_dma_channel_a);
+}
+
+size_t PCMDriver::availableForWrite() {
+    int16_t diff = _dma_read_ptr - _dma_write_ptr;
+    if (diff <= 0) {
+        diff += PCM_DMA_BUFFER_WORDS;
+    }
+    return (diff - 1) * sizeof(uint32_t);
+}
+
+size_t PCMDriver::write(const uint8_t* data, size_t size) {
+    size_t frames_to_write = min(size, availableForWrite()) / sizeof(uint32_t);
+    const int16_t* frames = (const int16_t*)data;
+
+    // Modulated in runs up to the end of the ring.
+    size_t done = 0;
+    while (done < frames_to_write) {
+        size_t run = min(frames_to_write - done, (size_t)(PCM_DMA_BUFFER_WORDS - _dma_write_ptr));
+        _modulator.convert(&_dma_buffer[_dma_write_ptr], frames + done * 2, run);
+        _dma_write_ptr = (_dma_write_ptr + run) % PCM_DMA_BUFFER_WORDS;
+        done += run;
+    }
+
+    return frames_to_write * sizeof(uint32_t);
+}
+
+bool PCMDriver::setRenderCallback(RenderCallback callback, void* context) {
+    _render_context = context;
+    _render_callback = callback;
+    return true;
+}
+
+size_t PCMDriver::render() {
+    if (!_render_callback) {
+        return 0;
+    }
+
+    // Only the half that plays next is ever written; the playing half stays
+    // untouched even after an underrun.
+    uint8_t half = _playing_half ^ 1;
+    if (_half_ready[half]) {
+        return 0;
+    }
+
+    _render_callback(_render_context, _render_buffer, PCM_BUFFER_FRAMES);
+    _modulator.convert(&_dma_buffer[half * PCM_BUFFER_FRAMES], _render_buffer, PCM_BUFFER_FRAMES);
+    _half_ready[half] = true;
+    return PCM_BUFFER_FRAMES;
+}
+
+uint32_t PCMDriver::getUnderrunCount() {
+    return _underrun_count;
 }
@@ -2,7 +2,33 @@
 #define PCMDRIVER_H
 
 #include "SoundDriver.h"
+#include "SigmaDelta.h"
 
+// --- Audio Format Configuration ---
+#define PCM_SAMPLE_RATE 44100
+
+// --- DMA Buffer Configuration ---
+// Samples per DMA half-buffer, one 32-bit PDM word each; the output
+// latency is roughly 2 * PCM_BUFFER_FRAMES / PCM_SAMPLE_RATE seconds.
+#ifndef PCM_BUFFER_FRAMES
+#define PCM_BUFFER_FRAMES 128
+#endif
+#define PCM_DMA_BUFFER_WORDS (PCM_BUFFER_FRAMES * 2)
+
+// A PDM word of silence: equal ones and zeros.
+#define PCM_SILENCE_WORD 0xAAAAAAAA
+
+/**
+ * @class PCMDriver
+ * @brief Mono audio output as a 1-bit PDM stream on one pin.
+ *
+ * A PIO state machine shifts the bits out at 32 times the sample rate. Two
+ * chained DMA channels keep its FIFO fed from the two halves of a buffer,
+ * so nothing on the CPU waits for the output. Audio arrives as 16-bit
+ * stereo, from write() or from the mixer in pull mode, and is folded to
+ * mono and sigma-delta modulated (see SigmaDelta) on the way into the
+ * buffer. Needs an RC low-pass filter and an amplifier on the pin.
+ */
 class PCMDriver : public SoundDriver {
 public:
     PCMDriver(uint8_t pcm_pin);
@@ -12,8 +38,50 @@ public:
     void setVolume(uint8_t volume) override;
     void loop() override;
 
+    /**
+     * @brief Plays a sound from a raw PCM data buffer.
+     * @param pcm_data Pointer to the raw PCM data (16-bit signed mono).
+     * @param data_len Length of the data in bytes.
+     */
+    void playRaw(const int16_t* pcm_data, size_t data_len);
+
+    // Takes interleaved 16-bit stereo frames, 4 bytes each.
+    size_t availableForWrite() override;
+    size_t write(const uint8_t* data, size_t size) override;
+
+    /**
+     * @brief Enables pull mode. Every half-buffer released by the DMA is
+     *        rendered by the callback on the next render() call and
+     *        modulated in place.
+     */
+    bool setRenderCallback(RenderCallback callback, void* context) override;
+    size_t render() override;
+    uint32_t getUnderrunCount() override;
+
 private:
+    void setupPIO();
+    void setupDMA();
+    void on_half_complete(uint8_t half, int channel);
+
+    static void dma_handler();
+
     uint8_t _pcm_pin;
+    uint8_t _volume;
+    SigmaDelta _modulator;
+    uint8_t _pio_sm;
+
+    uint32_t _dma_buffer[PCM_DMA_BUFFER_WORDS];
+    int16_t _render_buffer[PCM_BUFFER_FRAMES * 2]; // One half as 16-bit stereo
+    volatile uint16_t _dma_write_ptr;
+    volatile uint16_t _dma_read_ptr;
+    int _dma_channel_a;
+    int _dma_channel_b;
+
+    RenderCallback _render_callback;
+    void* _render_context;
+    volatile uint8_t _playing_half;
+    volatile bool _half_ready[2];
+    volatile uint32_t _underrun_count;
 };
 
 #endif // PCMDRIVER_H
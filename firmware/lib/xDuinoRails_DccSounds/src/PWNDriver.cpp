@@ -1,65 +1,222 @@
 #include "PWNDriver.h"
-#include "generated/beep_sound.h"
+#include <string.h>
 #include "hardware/pwm.h"
 #include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "generated/beep_sound.h"
 
 // --- Global State ---
-static int pwm_dma_channel;
-static uint8_t pwm_audio_buffer[sizeof(beep_sound) / 2];
+static PWNDriver* _instance;
 
-PWNDriver::PWNDriver(uint8_t pwm_pin) : _pwm_pin(pwm_pin) {
+PWNDriver::PWNDriver(uint8_t pwm_pin)
+    : _pwm_pin(pwm_pin),
+      _volume(255),
+      _shaper(PWM_SOUND_BITS),
+      _dma_write_ptr(0),
+      _dma_read_ptr(0),
+      _render_callback(nullptr),
+      _render_context(nullptr),
+      _playing_half(0),
+      _underrun_count(0) {
+    _instance = this;
+    _silence = (_shaper.getMaxLevel() + 1) / 2;
+    _half_ready[0] = true;
+    _half_ready[1] = false;
+    for (size_t i = 0; i < PWM_DMA_BUFFER_SAMPLES; i++) {
+        _dma_buffer[i] = _silence;
+    }
 }
 
 bool PWNDriver::begin() {
-    // --- GPIO ---
+    setupPWM();
+    setupDMA();
+    return true;
+}
+
+void PWNDriver::loop() {
+}
+
+void PWNDriver::play(uint16_t track) {
+    if (track == 1) {
+        playRaw((const int16_t*)beep_sound, beep_sound_len);
+    }
+}
+
+void PWNDriver::setVolume(uint8_t volume) {
+    // Scales the sounds the driver plays by itself (playRaw()). Mixed audio
+    // arrives already scaled by the mixer's master gain.
+    _volume = volume;
+}
+
+void PWNDriver::playRaw(const int16_t* pcm_data, size_t data_len) {
+    // Like I2SDriver::playRaw(): overwrites the buffer from the start, so
+    // only sounds up to the buffer length play in full.
+    size_t samples_to_write = min(data_len / sizeof(int16_t), (size_t)PWM_DMA_BUFFER_SAMPLES);
+    for (size_t i = 0; i < samples_to_write; i++) {
+        _dma_buffer[i] = _shaper.next(((int32_t)pcm_data[i] * _volume) / 255);
+    }
+}
+
+void PWNDriver::setupPWM() {
     gpio_set_function(_pwm_pin, GPIO_FUNC_PWM);
-    int slice_num = pwm_gpio_to_slice_num(_pwm_pin);
+    uint slice_num = pwm_gpio_to_slice_num(_pwm_pin);
 
-    // --- PWM ---
     pwm_config config = pwm_get_default_config();
-    pwm_config_set_clkdiv(&config, 1.0f); // Run at full speed
-    pwm_config_set_wrap(&config, 255);
-    pwm_init(slice_num, &config, true);
-
-    // --- DMA ---
-    pwm_dma_channel = dma_claim_unused_channel(true);
-    dma_channel_config c = dma_channel_get_default_config(pwm_dma_channel);
-    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    pwm_config_set_clkdiv(&config, 1.0f); // Carrier at clk_sys / 2^bits
+    pwm_config_set_wrap(&config, _shaper.getMaxLevel());
+    pwm_init(slice_num, &config, false);
+    pwm_set_gpio_level(_pwm_pin, _silence);
+    pwm_set_enabled(slice_num, true);
+}
+
+void PWNDriver::on_half_complete(uint8_t half, int channel) {
+    // The channels are chained, so the other half is already playing. Re-arm
+    // this channel for its next turn without triggering it.
+    dma_channel_set_read_addr(channel, &_dma_buffer[half * PWM_BUFFER_FRAMES], false);
+    _playing_half = half ^ 1;
+    _dma_read_ptr = _playing_half * PWM_BUFFER_FRAMES;
+
+    if (_render_callback) {
+        if (!_half_ready[half ^ 1]) {
+            _underrun_count++;
+        }
+        // Park the released half at mid-scale so a late render plays as a
+        // gap instead of repeating stale audio, without a click.
+        for (size_t i = 0; i < PWM_BUFFER_FRAMES; i++) {
+            _dma_buffer[half * PWM_BUFFER_FRAMES + i] = _silence;
+        }
+        _half_ready[half] = false;
+    }
+}
+
+void PWNDriver::dma_handler() {
+    if (dma_channel_get_irq0_status(_instance->_dma_channel_a)) {
+        dma_channel_acknowledge_irq0(_instance->_dma_channel_a);
+        _instance->on_half_complete(0, _instance->_dma_channel_a);
+    }
+    if (dma_channel_get_irq0_status(_instance->_dma_channel_b)) {
+        dma_channel_acknowledge_irq0(_instance->_dma_channel_b);
+        _instance->on_half_complete(1, _instance->_dma_channel_b);
+    }
+}
+
+void PWNDriver::setupDMA() {
+    // The PWM wraps far faster than the sample rate, so a DMA timer paces
+    // the transfers instead: clk_sys * num / den, with the closest fraction
+    // that fits its 16-bit fields.
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    uint16_t best_num = 1;
+    uint16_t best_den = 0xFFFF;
+    uint32_t best_error = 0xFFFFFFFF;
+    for (uint32_t num = 1; num <= 0xFFFF; num++) {
+        uint64_t den = ((uint64_t)sys_hz * num + PWM_SAMPLE_RATE / 2) / PWM_SAMPLE_RATE;
+        if (den > 0xFFFF) break;
+        uint64_t rate = (uint64_t)sys_hz * num / den;
+        uint32_t error = rate > PWM_SAMPLE_RATE ? rate - PWM_SAMPLE_RATE : PWM_SAMPLE_RATE - rate;
+        if (error < best_error) {
+            best_error = error;
+            best_num = num;
+            best_den = (uint16_t)den;
+        }
+    }
+    _dma_timer = dma_claim_unused_timer(true);
+    dma_timer_set_fraction(_dma_timer, best_num, best_den);
+    uint dreq = dma_get_timer_dreq(_dma_timer);
+
+    // 16-bit writes to the compare register are replicated to both halves,
+    // so the level reaches the pin whichever PWM channel it is on.
+    uint slice_num = pwm_gpio_to_slice_num(_pwm_pin);
+    _dma_channel_a = dma_claim_unused_channel(true);
+    _dma_channel_b = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(_dma_channel_a);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
     channel_config_set_read_increment(&c, true);
     channel_config_set_write_increment(&c, false);
-    channel_config_set_dreq(&c, pwm_get_dreq(slice_num));
+    channel_config_set_dreq(&c, dreq);
+    channel_config_set_chain_to(&c, _dma_channel_b);
 
     dma_channel_configure(
-        pwm_dma_channel,
+        _dma_channel_a,
         &c,
-        &pwm_hw->slice[slice_num].cc, // Write to PWM slice compare value
-        nullptr,      // Read from a buffer set later
-        0,            // Transfer count set later
-        false         // Don't start immediately
+        &pwm_hw->slice[slice_num].cc,
+        _dma_buffer,
+        PWM_BUFFER_FRAMES,
+        false
     );
 
-    return true;
+    c = dma_channel_get_default_config(_dma_channel_b);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, dreq);
+    channel_config_set_chain_to(&c, _dma_channel_a);
+
+    dma_channel_configure(
+        _dma_channel_b,
+        &c,
+        &pwm_hw->slice[slice_num].cc,
+        &_dma_buffer[PWM_BUFFER_FRAMES],
+        PWM_BUFFER_FRAMES,
+        false
+    );
+
+    dma_channel_set_irq0_enabled(_dma_channel_a, true);
+    dma_channel_set_irq0_enabled(_dma_channel_b, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_start(_dma_channel_a);
 }
 
-void PWNDriver::loop() {
+size_t PWNDriver::availableForWrite() {
+    int16_t diff = _dma_read_ptr - _dma_write_ptr;
+    if (diff <= 0) {
+        diff += PWM_DMA_BUFFER_SAMPLES;
+    }
+    return (diff - 1) * sizeof(uint32_t);
 }
 
-void PWNDriver::play(uint16_t track) {
-    if (track == 1) {
-        if (dma_channel_is_busy(pwm_dma_channel)) {
-            return;
-        }
+size_t PWNDriver::write(const uint8_t* data, size_t size) {
+    size_t frames_to_write = min(size, availableForWrite()) / sizeof(uint32_t);
+    const int16_t* frames = (const int16_t*)data;
 
-        // Convert 16-bit to 8-bit
-        for (size_t i = 0; i < beep_sound_len / 2; i++) {
-            pwm_audio_buffer[i] = ((int16_t*)beep_sound)[i] >> 8;
-        }
+    // Converted in runs up to the end of the ring.
+    size_t done = 0;
+    while (done < frames_to_write) {
+        size_t run = min(frames_to_write - done, (size_t)(PWM_DMA_BUFFER_SAMPLES - _dma_write_ptr));
+        _shaper.convert(&_dma_buffer[_dma_write_ptr], frames + done * 2, run);
+        _dma_write_ptr = (_dma_write_ptr + run) % PWM_DMA_BUFFER_SAMPLES;
+        done += run;
+    }
+
+    return frames_to_write * sizeof(uint32_t);
+}
 
-        dma_channel_set_read_addr(pwm_dma_channel, pwm_audio_buffer, false);
-        dma_channel_set_trans_count(pwm_dma_channel, beep_sound_len / 2, true);
+bool PWNDriver::setRenderCallback(RenderCallback callback, void* context) {
+    _render_context = context;
+    _render_callback = callback;
+    return true;
+}
+
+size_t PWNDriver::render() {
+    if (!_render_callback) {
+        return 0;
     }
+
+    // Only the half that plays next is ever written; the playing half stays
+    // untouched even after an underrun.
+    uint8_t half = _playing_half ^ 1;
+    if (_half_ready[half]) {
+        return 0;
+    }
+
+    _render_callback(_render_context, _render_buffer, PWM_BUFFER_FRAMES);
+    _shaper.convert(&_dma_buffer[half * PWM_BUFFER_FRAMES], _render_buffer, PWM_BUFFER_FRAMES);
+    _half_ready[half] = true;
+    return PWM_BUFFER_FRAMES;
 }
 
-void PWNDriver::setVolume(uint8_t volume) {
-    // To be implemented.
+uint32_t PWNDriver::getUnderrunCount() {
+    return _underrun_count;
 }
@@ -2,7 +2,36 @@
 #define PWMDRIVER_H
 
 #include "SoundDriver.h"
+#include "NoiseShaper.h"
 
+// --- Audio Format Configuration ---
+#define PWM_SAMPLE_RATE 44100
+
+// PWM resolution in bits. 10 bits keep the carrier above 120 kHz at
+// 125 MHz; 8 bits move it to 488 kHz at the cost of more noise.
+#ifndef PWM_SOUND_BITS
+#define PWM_SOUND_BITS 10
+#endif
+
+// --- DMA Buffer Configuration ---
+// Samples per DMA half-buffer; the output latency is roughly
+// 2 * PWM_BUFFER_FRAMES / PWM_SAMPLE_RATE seconds.
+#ifndef PWM_BUFFER_FRAMES
+#define PWM_BUFFER_FRAMES 128
+#endif
+#define PWM_DMA_BUFFER_SAMPLES (PWM_BUFFER_FRAMES * 2)
+
+/**
+ * @class PWNDriver
+ * @brief Mono audio output as the duty cycle of one PWM pin.
+ *
+ * Two chained DMA channels play the two halves of a buffer of PWM levels in
+ * turn, paced at the sample rate by a DMA timer, so output never stops
+ * between buffers. Audio arrives as 16-bit stereo, from write() or from the
+ * mixer in pull mode, and is folded to mono and noise shaped down to
+ * PWM_SOUND_BITS on the way into the buffer. Needs an RC low-pass filter
+ * and an amplifier on the pin.
+ */
 class PWNDriver : public SoundDriver {
 public:
     PWNDriver(uint8_t pwm_pin);
@@ -12,8 +41,51 @@ public:
     void setVolume(uint8_t volume) override;
     void loop() override;
 
+    /**
+     * @brief Plays a sound from a raw PCM data buffer.
+     * @param pcm_data Pointer to the raw PCM data (16-bit signed mono).
+     * @param data_len Length of the data in bytes.
+     */
+    void playRaw(const int16_t* pcm_data, size_t data_len);
+
+    // Takes interleaved 16-bit stereo frames, 4 bytes each.
+    size_t availableForWrite() override;
+    size_t write(const uint8_t* data, size_t size) override;
+
+    /**
+     * @brief Enables pull mode. Every half-buffer released by the DMA is
+     *        rendered by the callback on the next render() call and
+     *        converted to PWM levels in place.
+     */
+    bool setRenderCallback(RenderCallback callback, void* context) override;
+    size_t render() override;
+    uint32_t getUnderrunCount() override;
+
 private:
+    void setupPWM();
+    void setupDMA();
+    void on_half_complete(uint8_t half, int channel);
+
+    static void dma_handler();
+
     uint8_t _pwm_pin;
+    uint8_t _volume;
+    NoiseShaper _shaper;
+    uint16_t _silence; // Mid-scale level
+
+    uint16_t _dma_buffer[PWM_DMA_BUFFER_SAMPLES];
+    int16_t _render_buffer[PWM_BUFFER_FRAMES * 2]; // One half as 16-bit stereo
+    volatile uint16_t _dma_write_ptr;
+    volatile uint16_t _dma_read_ptr;
+    int _dma_channel_a;
+    int _dma_channel_b;
+    int _dma_timer;
+
+    RenderCallback _render_callback;
+    void* _render_context;
+    volatile uint8_t _playing_half;
+    volatile bool _half_ready[2];
+    volatile uint32_t _underrun_count;
 };
 
 #endif // PWMDRIVER_H
@@ -0,0 +1,43 @@
+#include "SigmaDelta.h"
+
+// Feedback level of a 1 bit. Inputs are halved on the way in, since a
+// second-order loop with a 1-bit quantizer overloads beyond about half of
+// the feedback level.
+#define SIGMA_DELTA_FULL_SCALE 32768
+
+SigmaDelta::SigmaDelta() {
+    reset();
+}
+
+void SigmaDelta::reset() {
+    _error[0] = 0;
+    _error[1] = 0;
+}
+
+uint32_t SigmaDelta::modulate(int32_t sample) {
+    const int32_t input = sample >> 1;
+    int32_t e1 = _error[0];
+    int32_t e2 = _error[1];
+    uint32_t bits = 0;
+    for (int i = 0; i < SIGMA_DELTA_OVERSAMPLING; i++) {
+        int32_t shaped = input - 2 * e1 + e2;
+        int32_t out = shaped >= 0 ? SIGMA_DELTA_FULL_SCALE : -SIGMA_DELTA_FULL_SCALE;
+        bits |= (uint32_t)(shaped >= 0) << i;
+        int32_t error = out - shaped;
+        // Bounded, so an overload recovers instead of latching up.
+        if (error > 2 * SIGMA_DELTA_FULL_SCALE) error = 2 * SIGMA_DELTA_FULL_SCALE;
+        if (error < -2 * SIGMA_DELTA_FULL_SCALE) error = -2 * SIGMA_DELTA_FULL_SCALE;
+        e2 = e1;
+        e1 = error;
+    }
+    _error[0] = e1;
+    _error[1] = e2;
+    return bits;
+}
+
+void SigmaDelta::convert(uint32_t* dst, const int16_t* src, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        dst[i] = modulate(((int32_t)src[0] + src[1]) >> 1);
+        src += 2;
+    }
+}
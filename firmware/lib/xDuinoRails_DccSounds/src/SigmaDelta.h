@@ -0,0 +1,41 @@
+#ifndef SIGMADELTA_H
+#define SIGMADELTA_H
+
+#include <Arduino.h>
+
+// Output bits per input sample. One 32-bit FIFO word per sample, so the
+// bit clock is 32 times the sample rate (1.4112 MHz at 44.1 kHz).
+#define SIGMA_DELTA_OVERSAMPLING 32
+
+/**
+ * @class SigmaDelta
+ * @brief Second-order sigma-delta modulator producing a 1-bit PDM stream.
+ *
+ * Each 16-bit sample is held for SIGMA_DELTA_OVERSAMPLING bit periods and
+ * quantized to one bit with the error fed back through (1 - z^-1)^2, which
+ * pushes the quantization noise far above the audio band. An RC low-pass
+ * filter on the pin turns the bit density back into the audio signal.
+ *
+ * The modulator is plain fixed-point C++, so the code that fills the DMA
+ * buffers on the RP2040 doubles as the host reference model. Bits are
+ * packed least significant first, the order the PIO shifts them out.
+ */
+class SigmaDelta {
+public:
+    SigmaDelta();
+
+    // Clears the error feedback.
+    void reset();
+
+    // Modulates one signed 16-bit sample into SIGMA_DELTA_OVERSAMPLING bits.
+    uint32_t modulate(int32_t sample);
+
+    // Modulates `frames` interleaved 16-bit stereo frames, folded to mono,
+    // into one word each.
+    void convert(uint32_t* dst, const int16_t* src, size_t frames);
+
+private:
+    int32_t _error[2]; // Last two quantization errors
+};
+
+#endif // SIGMADELTA_H
@@ -12,7 +12,7 @@
 #include "PCMDriver.h"
 #endif
 
-SoundController::SoundController() {
+SoundController::SoundController() : _volume(255) {
 #if defined(SOUND_DRIVER_DFPLAYER)
     _driver = new DFPlayerDriver(DFPLAYER_RX_PIN, DFPLAYER_TX_PIN);
 #elif defined(SOUND_DRIVER_I2S)
@@ -26,6 +26,9 @@ SoundController::SoundController() {
 #endif
 }
 
+SoundController::SoundController(SoundDriver* driver) : _driver(driver), _volume(255) {
+}
+
 SoundController::~SoundController() {
     if (_driver) {
         delete _driver;
@@ -46,6 +49,7 @@ void SoundController::play(uint16_t track) {
 }
 
 void SoundController::setVolume(uint8_t volume) {
+    _volume = volume;
     if (_driver) {
         _driver->setVolume(volume);
     }
@@ -70,3 +74,30 @@ size_t SoundController::write(const uint8_t* data, size_t size) {
     }
     return 0;
 }
+
+bool SoundController::setRenderCallback(SoundDriver::RenderCallback callback, void* context) {
+    if (_driver) {
+        return _driver->setRenderCallback(callback, context);
+    }
+    return false;
+}
+
+size_t SoundController::render() {
+    if (_driver) {
+        return _driver->render();
+    }
+    return 0;
+}
+
+uint32_t SoundController::getUnderrunCount() {
+    if (_driver) {
+        return _driver->getUnderrunCount();
+    }
+    return 0;
+}
+
+#if !defined(ARDUINO_ARCH_RP2040)
+void SoundController::dumpStats(FILE* out) {
+    _stats.dump(out, getUnderrunCount());
+}
+#endif
@@ -2,6 +2,7 @@
 #define SOUNDCONTROLLER_H
 
 #include "SoundDriver.h"
+#include "SoundStats.h"
 
 // --- Sound Driver Selection ---
 // The user must define one of these in their `config.h` or build flags.
@@ -13,17 +14,41 @@
 class SoundController {
 public:
     SoundController();
+
+    // Uses `driver` instead of the one selected at build time and takes
+    // ownership of it, e.g. for a host-side sink.
+    explicit SoundController(SoundDriver* driver);
     ~SoundController();
 
     bool begin();
     void play(uint16_t track);
     void setVolume(uint8_t volume);
+    uint8_t getVolume() const { return _volume; }
     void loop();
     size_t availableForWrite();
     size_t write(const uint8_t* data, size_t size);
 
+    // Pull mode, see SoundDriver::setRenderCallback().
+    bool setRenderCallback(SoundDriver::RenderCallback callback, void* context);
+    size_t render();
+    uint32_t getUnderrunCount();
+
+    // Instrumentation of the sound path. The mixer and the audio engine
+    // record into it; readers may call this from any core.
+    SoundStats& getStats() { return _stats; }
+
+    // Clears the counters in getStats().
+    void resetStats() { _stats.reset(); }
+
+#if !defined(ARDUINO_ARCH_RP2040)
+    // Prints getStats() and the driver's underrun count, e.g. after a host render.
+    void dumpStats(FILE* out = stdout);
+#endif
+
 private:
     SoundDriver* _driver;
+    SoundStats _stats;
+    uint8_t _volume;
 };
 
 #endif // SOUNDCONTROLLER_H
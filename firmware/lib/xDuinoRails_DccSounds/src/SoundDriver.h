@@ -13,6 +13,14 @@
  */
 class SoundDriver {
 public:
+    /**
+     * @brief Callback that renders audio straight into a driver buffer.
+     * @param context The context pointer given to setRenderCallback().
+     * @param out Destination for interleaved 16-bit stereo frames.
+     * @param frames Number of frames to render.
+     */
+    typedef void (*RenderCallback)(void* context, int16_t* out, size_t frames);
+
     virtual ~SoundDriver() {}
 
     /**
@@ -54,6 +62,28 @@ public:
      * @return The number of bytes written.
      */
     virtual size_t write(const uint8_t* data, size_t size) = 0;
+
+    /**
+     * @brief Switches the driver to pull mode, where it asks for audio
+     *        instead of being pushed to with write().
+     * @param callback Called to fill each output buffer the hardware releases.
+     * @param context Passed back to the callback.
+     * @return True if the driver supports pull mode.
+     */
+    virtual bool setRenderCallback(RenderCallback callback, void* context) { return false; }
+
+    /**
+     * @brief In pull mode, renders into every output buffer released by the
+     *        hardware since the last call. Call it from the audio loop.
+     * @return The number of frames rendered.
+     */
+    virtual size_t render() { return 0; }
+
+    /**
+     * @brief Returns how often the hardware had to play a buffer that was
+     *        not refilled in time.
+     */
+    virtual uint32_t getUnderrunCount() { return 0; }
 };
 
 #endif // SOUNDDRIVER_H
@@ -0,0 +1,96 @@
+#include "SoundStats.h"
+
+SoundStats::SoundStats() {
+    reset();
+}
+
+void SoundStats::reset() {
+    _blocks_rendered = 0;
+    _render_us_max = 0;
+    for (int i = 0; i < SOUND_STATS_HISTOGRAM_BUCKETS; i++) {
+        _render_histogram[i] = 0;
+    }
+    _service_us_max = 0;
+    _service_us_max_voice = SOUND_STATS_NO_VOICE;
+    _active_voices = 0;
+    _active_voices_high_water = 0;
+    _dropped_plays = 0;
+    _dropped_commands = 0;
+    _refill_misses = 0;
+    _voices_stolen = 0;
+    _voices_shed = 0;
+    _sample_cache_hits = 0;
+    _sample_cache_misses = 0;
+}
+
+void SoundStats::recordRenderTime(uint32_t us) {
+    _blocks_rendered++;
+    if (us > _render_us_max) {
+        _render_us_max = us;
+    }
+
+    uint8_t bucket = 0;
+    uint32_t limit = SOUND_STATS_BUCKET_BASE_US;
+    while (bucket < SOUND_STATS_HISTOGRAM_BUCKETS - 1 && us >= limit) {
+        bucket++;
+        limit <<= 1;
+    }
+    _render_histogram[bucket]++;
+}
+
+void SoundStats::recordServiceTime(uint8_t voice, uint32_t us) {
+    if (us > _service_us_max) {
+        _service_us_max = us;
+        _service_us_max_voice = voice;
+    }
+}
+
+void SoundStats::recordActiveVoices(uint8_t count) {
+    _active_voices = count;
+    if (count > _active_voices_high_water) {
+        _active_voices_high_water = count;
+    }
+}
+
+uint32_t SoundStats::getRenderHistogram(uint8_t bucket) const {
+    if (bucket >= SOUND_STATS_HISTOGRAM_BUCKETS) {
+        return 0;
+    }
+    return _render_histogram[bucket];
+}
+
+uint32_t SoundStats::bucketLimitUs(uint8_t bucket) {
+    if (bucket >= SOUND_STATS_HISTOGRAM_BUCKETS - 1) {
+        return 0;
+    }
+    return (uint32_t)SOUND_STATS_BUCKET_BASE_US << bucket;
+}
+
+#if !defined(ARDUINO_ARCH_RP2040)
+void SoundStats::dump(FILE* out, uint32_t underruns) const {
+    fprintf(out, "sound stats:\n");
+    fprintf(out, "  underruns          %u\n", (unsigned)underruns);
+    fprintf(out, "  blocks rendered    %u\n", (unsigned)_blocks_rendered);
+    fprintf(out, "  render max         %u us\n", (unsigned)_render_us_max);
+    for (uint8_t i = 0; i < SOUND_STATS_HISTOGRAM_BUCKETS; i++) {
+        uint32_t limit = bucketLimitUs(i);
+        if (limit) {
+            fprintf(out, "    < %5u us       %u\n", (unsigned)limit, (unsigned)_render_histogram[i]);
+        } else {
+            fprintf(out, "    >= %4u us       %u\n", (unsigned)bucketLimitUs(i - 1), (unsigned)_render_histogram[i]);
+        }
+    }
+    if (_service_us_max_voice == SOUND_STATS_NO_VOICE) {
+        fprintf(out, "  service max        %u us\n", (unsigned)_service_us_max);
+    } else {
+        fprintf(out, "  service max        %u us (voice %u)\n", (unsigned)_service_us_max, (unsigned)_service_us_max_voice);
+    }
+    fprintf(out, "  active voices      %u (high water %u)\n", (unsigned)_active_voices, (unsigned)_active_voices_high_water);
+    fprintf(out, "  dropped plays      %u\n", (unsigned)_dropped_plays);
+    fprintf(out, "  dropped commands   %u\n", (unsigned)_dropped_commands);
+    fprintf(out, "  refill misses      %u\n", (unsigned)_refill_misses);
+    fprintf(out, "  voices stolen      %u\n", (unsigned)_voices_stolen);
+    fprintf(out, "  voices shed        %u\n", (unsigned)_voices_shed);
+    fprintf(out, "  sample cache       %u hits, %u misses\n", (unsigned)_sample_cache_hits, (unsigned)_sample_cache_misses);
+}
+#endif
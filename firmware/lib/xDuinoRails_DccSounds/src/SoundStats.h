@@ -0,0 +1,109 @@
+#ifndef SOUNDSTATS_H
+#define SOUNDSTATS_H
+
+#include <Arduino.h>
+
+#if !defined(ARDUINO_ARCH_RP2040)
+#include <stdio.h>
+#endif
+
+// Render time histogram buckets. Bucket 0 counts blocks rendered in under
+// SOUND_STATS_BUCKET_BASE_US, each further bucket doubles the limit and the
+// last one collects everything slower.
+#define SOUND_STATS_HISTOGRAM_BUCKETS 8
+#define SOUND_STATS_BUCKET_BASE_US 64
+
+// Voice tag recorded before any voice has been serviced.
+#define SOUND_STATS_NO_VOICE 0xFF
+
+/**
+ * @class SoundStats
+ * @brief Counters and histograms of the sound path.
+ *
+ * The audio core records into these as it renders, the control core reads
+ * them. Every field is at most one aligned word, so a reader sees each value
+ * whole, though not necessarily a consistent snapshot across fields.
+ */
+class SoundStats {
+public:
+    SoundStats();
+
+    // Clears every counter. Underruns are kept by the driver and not affected.
+    void reset();
+
+    // Records the time the mixer took for one block.
+    void recordRenderTime(uint32_t us);
+
+    // Records the time one voice spent refilling its buffer. `voice` is the
+    // tag the voice was started with.
+    void recordServiceTime(uint8_t voice, uint32_t us);
+
+    // Records the number of voices mixed into the current block.
+    void recordActiveVoices(uint8_t count);
+
+    // Records a play request the audio core could not honour because no
+    // voice was free or its source failed to open.
+    void recordDroppedPlay() { _dropped_plays++; }
+
+    // Records a command the control core dropped because the command queue
+    // was full. Kept apart from recordDroppedPlay() so each counter has a
+    // single writing core.
+    void recordDroppedCommand() { _dropped_commands++; }
+
+    // Records a voice the mixer had to refill while mixing because the
+    // refill scheduler had left it short of the block.
+    void recordRefillMiss() { _refill_misses++; }
+
+    // Records a voice taken over for a new sound because all were busy.
+    void recordVoiceStolen() { _voices_stolen++; }
+
+    // Records a voice faded out because blocks took too long to render.
+    void recordVoiceShed() { _voices_shed++; }
+
+    // Records a trigger of a short sound that was, or was not, resident in
+    // the RAM sample cache.
+    void recordSampleCacheHit() { _sample_cache_hits++; }
+    void recordSampleCacheMiss() { _sample_cache_misses++; }
+
+    uint32_t getBlocksRendered() const { return _blocks_rendered; }
+    uint32_t getRenderUsMax() const { return _render_us_max; }
+    uint32_t getRenderHistogram(uint8_t bucket) const;
+    uint32_t getServiceUsMax() const { return _service_us_max; }
+    uint8_t getServiceUsMaxVoice() const { return _service_us_max_voice; }
+    uint8_t getActiveVoices() const { return _active_voices; }
+    uint8_t getActiveVoicesHighWater() const { return _active_voices_high_water; }
+    uint32_t getDroppedPlays() const { return _dropped_plays; }
+    uint32_t getDroppedCommands() const { return _dropped_commands; }
+    uint32_t getRefillMisses() const { return _refill_misses; }
+    uint32_t getVoicesStolen() const { return _voices_stolen; }
+    uint32_t getVoicesShed() const { return _voices_shed; }
+    uint32_t getSampleCacheHits() const { return _sample_cache_hits; }
+    uint32_t getSampleCacheMisses() const { return _sample_cache_misses; }
+
+    // Upper limit of histogram `bucket` in microseconds; 0 for the last one.
+    static uint32_t bucketLimitUs(uint8_t bucket);
+
+#if !defined(ARDUINO_ARCH_RP2040)
+    // Prints all counters in a human readable form. `underruns` comes from
+    // the driver, see SoundController::getUnderrunCount().
+    void dump(FILE* out, uint32_t underruns) const;
+#endif
+
+private:
+    volatile uint32_t _blocks_rendered;
+    volatile uint32_t _render_us_max;
+    volatile uint32_t _render_histogram[SOUND_STATS_HISTOGRAM_BUCKETS];
+    volatile uint32_t _service_us_max;
+    volatile uint8_t _service_us_max_voice;
+    volatile uint8_t _active_voices;
+    volatile uint8_t _active_voices_high_water;
+    volatile uint32_t _dropped_plays;
+    volatile uint32_t _dropped_commands;
+    volatile uint32_t _refill_misses;
+    volatile uint32_t _voices_stolen;
+    volatile uint32_t _voices_shed;
+    volatile uint32_t _sample_cache_hits;
+    volatile uint32_t _sample_cache_misses;
+};
+
+#endif // SOUNDSTATS_H
@@ -0,0 +1,115 @@
+#include "WAVFileDriver.h"
+#include <string.h>
+
+#if !defined(ARDUINO_ARCH_RP2040)
+
+// Appends `value` to `header` little endian, `bytes` long.
+static uint8_t* put_le(uint8_t* header, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *header++ = (uint8_t)(value >> (8 * i));
+    }
+    return header;
+}
+
+WAVFileDriver::WAVFileDriver()
+    : _file(nullptr),
+      _failed(false),
+      _frames_written(0),
+      _render_callback(nullptr),
+      _render_context(nullptr) {
+}
+
+WAVFileDriver::~WAVFileDriver() {
+    close();
+}
+
+bool WAVFileDriver::open(const char* path) {
+    close();
+    _file = fopen(path, "wb");
+    if (!_file) {
+        return false;
+    }
+    _failed = false;
+    _frames_written = 0;
+    return writeHeader();
+}
+
+bool WAVFileDriver::close() {
+    if (!_file) {
+        return !_failed;
+    }
+    // Rewrite the header now that the data size is known.
+    if (fseek(_file, 0, SEEK_SET) != 0 || !writeHeader()) {
+        _failed = true;
+    }
+    if (fclose(_file) != 0) {
+        _failed = true;
+    }
+    _file = nullptr;
+    return !_failed;
+}
+
+bool WAVFileDriver::writeHeader() {
+    const uint32_t data_bytes = _frames_written * 4;
+    uint8_t header[44];
+    uint8_t* p = header;
+    memcpy(p, "RIFF", 4); p += 4;
+    p = put_le(p, 36 + data_bytes, 4);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    p = put_le(p, 16, 4);                       // fmt chunk size
+    p = put_le(p, 1, 2);                        // PCM
+    p = put_le(p, 2, 2);                        // Channels
+    p = put_le(p, WAV_FILE_SAMPLE_RATE, 4);
+    p = put_le(p, WAV_FILE_SAMPLE_RATE * 4, 4); // Byte rate
+    p = put_le(p, 4, 2);                        // Block align
+    p = put_le(p, 16, 2);                       // Bits per sample
+    memcpy(p, "data", 4); p += 4;
+    put_le(p, data_bytes, 4);
+    if (fwrite(header, 1, sizeof(header), _file) != sizeof(header)) {
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool WAVFileDriver::begin() {
+    return _file != nullptr;
+}
+
+size_t WAVFileDriver::availableForWrite() {
+    return _file ? WAV_FILE_BUFFER_FRAMES * 4 : 0;
+}
+
+size_t WAVFileDriver::write(const uint8_t* data, size_t size) {
+    if (!_file) {
+        return 0;
+    }
+    if (size > availableForWrite()) {
+        size = availableForWrite();
+    }
+    size_t frames = size / 4;
+    // The file holds little endian samples, as the host does.
+    if (fwrite(data, 4, frames, _file) != frames) {
+        _failed = true;
+        return 0;
+    }
+    _frames_written += frames;
+    return frames * 4;
+}
+
+bool WAVFileDriver::setRenderCallback(RenderCallback callback, void* context) {
+    _render_callback = callback;
+    _render_context = context;
+    return true;
+}
+
+size_t WAVFileDriver::render() {
+    if (!_render_callback || !_file) {
+        return 0;
+    }
+    _render_callback(_render_context, _render_buffer, WAV_FILE_BUFFER_FRAMES);
+    write((const uint8_t*)_render_buffer, sizeof(_render_buffer));
+    return WAV_FILE_BUFFER_FRAMES;
+}
+
+#endif // !ARDUINO_ARCH_RP2040
@@ -0,0 +1,78 @@
+#ifndef WAVFILEDRIVER_H
+#define WAVFILEDRIVER_H
+
+#include "SoundDriver.h"
+
+#if !defined(ARDUINO_ARCH_RP2040)
+#include <stdio.h>
+
+// --- Audio Format Configuration ---
+#define WAV_FILE_SAMPLE_RATE 44100
+
+// Frames rendered per render() call, the size of one hardware buffer.
+#ifndef WAV_FILE_BUFFER_FRAMES
+#define WAV_FILE_BUFFER_FRAMES 128
+#endif
+
+/**
+ * @class WAVFileDriver
+ * @brief Host-side sound output into a 16-bit stereo WAV file.
+ *
+ * Stands in for the hardware drivers when the sound engine runs on the host,
+ * e.g. in the offline render harness. There is no clock: every render() call
+ * is a buffer released by the "hardware", so the mix runs as fast as the host
+ * can render it. Pass it to SoundController(SoundDriver*).
+ */
+class WAVFileDriver : public SoundDriver {
+public:
+    WAVFileDriver();
+    ~WAVFileDriver();
+
+    /**
+     * @brief Creates `path` and writes a WAV header to it.
+     * @return False if the file could not be created.
+     */
+    bool open(const char* path);
+
+    /**
+     * @brief Completes the header with the final length and closes the file.
+     * @return False if a write failed at any point.
+     */
+    bool close();
+
+    bool begin() override;
+    void play(uint16_t track) override {}
+    void setVolume(uint8_t volume) override {}
+    void loop() override {}
+
+    // Takes interleaved 16-bit stereo frames, 4 bytes each, up to one
+    // buffer of WAV_FILE_BUFFER_FRAMES per call, as the hardware drivers do.
+    size_t availableForWrite() override;
+    size_t write(const uint8_t* data, size_t size) override;
+
+    /**
+     * @brief Enables pull mode: each render() call asks the callback for
+     *        WAV_FILE_BUFFER_FRAMES frames and appends them to the file.
+     */
+    bool setRenderCallback(RenderCallback callback, void* context) override;
+    size_t render() override;
+
+    /**
+     * @brief Returns the frames written to the file so far.
+     */
+    uint32_t getFramesWritten() const { return _frames_written; }
+
+private:
+    bool writeHeader();
+
+    FILE* _file;
+    bool _failed;
+    uint32_t _frames_written;
+    RenderCallback _render_callback;
+    void* _render_context;
+    int16_t _render_buffer[WAV_FILE_BUFFER_FRAMES * 2];
+};
+
+#endif // !ARDUINO_ARCH_RP2040
+
+#endif // WAVFILEDRIVER_H
@@ -0,0 +1,59 @@
+// -------------------------------------------------- //
+// This file is autogenerated by pioasm; do not edit! //
+// -------------------------------------------------- //
+
+#pragma once
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// --- //
+// pdm //
+// --- //
+
+#define pdm_wrap_target 0
+#define pdm_wrap 0
+#define pdm_pio_version 0
+
+static const uint16_t pdm_program_instructions[] = {
+            //     .wrap_target
+    0x6001, //  0: out    pins, 1
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program pdm_program = {
+    .instructions = pdm_program_instructions,
+    .length = 1,
+    .origin = -1,
+    .pio_version = 0,
+#if PICO_PIO_VERSION > 0
+    .used_gpio_ranges = 0x0
+#endif
+};
+
+static inline pio_sm_config pdm_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + pdm_wrap_target, offset + pdm_wrap);
+    return c;
+}
+
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+static inline void pdm_program_init(PIO pio, uint sm, uint offset, uint pin) {
+    // --- Pin Configuration ---
+    pio_gpio_init(pio, pin);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, true);
+    // --- State Machine Configuration ---
+    pio_sm_config c = pdm_program_get_default_config(offset);
+    sm_config_set_out_pins(&c, pin, 1);
+    // Set autopull and shift right
+    sm_config_set_out_shift(&c, true, true, 32);
+    // FIFO joins
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+    // Load the config
+    pio_sm_init(pio, sm, offset, &c);
+}
+
+#endif
@@ -28,6 +28,7 @@ void setup() {
     LocoFuncDecoderConfig config;
     config.enableMotor = true;
     config.enableSound = true;
+    config.soundOnCore1 = true; // Mixer runs in loop1()
     config.enableLights = true;
 
     // Use default pins
@@ -51,3 +52,8 @@ void setup() {
 void loop() {
     decoder.update();
 }
+
+// Core 1: audio engine (mixer and sound streaming)
+void loop1() {
+    decoder.updateAudio();
+}
@@ -28,6 +28,7 @@ void setup() {
     LocoFuncDecoderConfig config;
     config.enableMotor = false; // Disabled
     config.enableSound = true;
+    config.soundOnCore1 = true; // Mixer runs in loop1()
     config.enableLights = true;
 
     // config.useDefaultPinout = true;
@@ -53,3 +54,8 @@ void setup() {
 void loop() {
     decoder.update();
 }
+
+// Core 1: audio engine (mixer and sound streaming)
+void loop1() {
+    decoder.updateAudio();
+}
@@ -77,6 +77,18 @@ void CVManager::setDefaultCVs() {
     _cv_values[CV_PID_KP] = DECODER_DEFAULT_PID_KP;
     _cv_values[CV_PID_KI] = DECODER_DEFAULT_PID_KI;
 
+    // --- Sound ---
+    _cv_values[CV_SOUND_MASTER_VOLUME] = DECODER_DEFAULT_SOUND_MASTER_VOLUME;
+    for (uint16_t cv = CV_SOUND_VOLUME_START; cv <= CV_SOUND_VOLUME_END; cv++) {
+        _cv_values[cv] = DECODER_DEFAULT_SOUND_VOLUME;
+    }
+    _cv_values[CV_SOUND_FADE_TIME] = DECODER_DEFAULT_SOUND_FADE_TIME;
+    _cv_values[CV_SOUND_NOTCH_TIME] = DECODER_DEFAULT_SOUND_NOTCH_TIME;
+    _cv_values[CV_SOUND_CHUFFS_PER_REV] = DECODER_DEFAULT_SOUND_CHUFFS_PER_REV;
+    _cv_values[CV_SOUND_WHEEL_DIAMETER] = DECODER_DEFAULT_SOUND_WHEEL_DIAMETER;
+    _cv_values[CV_SOUND_FULL_SPEED] = DECODER_DEFAULT_SOUND_FULL_SPEED;
+    _cv_values[CV_SOUND_CACHE_SIZE] = DECODER_DEFAULT_SOUND_CACHE_SIZE;
+
     // --- RCN-225 Function Mapping (CVs 33-46) ---
     _cv_values[CV_OUTPUT_LOCATION_CONFIG_START + 0] = DECODER_DEFAULT_F0_FWD_MAPPING; // CV 33
     _cv_values[CV_OUTPUT_LOCATION_CONFIG_START + 1] = DECODER_DEFAULT_F0_REV_MAPPING; // CV 34
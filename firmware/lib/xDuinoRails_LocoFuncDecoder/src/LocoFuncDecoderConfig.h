@@ -20,6 +20,11 @@ struct LocoFuncDecoderConfig {
     int i2sLrclkPin = 3;
     int i2sDinPin = 4;
 
+    // --- Sound Engine ---
+    // Run the mixer, stream servicing and the sound driver on core 1. The
+    // sketch must then call decoder.updateAudio() from loop1().
+    bool soundOnCore1 = false;
+
     // --- Sound Driver Pins (Other - if needed later) ---
     // ...
 
@@ -53,6 +53,17 @@
 #define CV_USER_ID_1 105
 #define CV_USER_ID_2 106
 
+// Sound (manufacturer-specific range, see SOUND_CONCEPT 7.1)
+#define CV_SOUND_MASTER_VOLUME 128
+#define CV_SOUND_VOLUME_START 129 // CVs 129-144, one per VSD sound ID
+#define CV_SOUND_VOLUME_END 144
+#define CV_SOUND_FADE_TIME 145 // Fade-out of looped sounds when their function turns off, in 10 ms units
+#define CV_SOUND_NOTCH_TIME 146 // Prime mover crossfade from one notch to the next, in 10 ms units
+#define CV_SOUND_CHUFFS_PER_REV 147 // Steam chuffs per driving wheel revolution
+#define CV_SOUND_WHEEL_DIAMETER 148 // Driving wheel diameter, in mm
+#define CV_SOUND_FULL_SPEED 149 // Model speed at full speed step, in cm/s
+#define CV_SOUND_CACHE_SIZE 150 // RAM kept for short one-shot sounds, in KB
+
 
 // CV 29 Configuration Bits (from NmraDcc.h)
 #define CV29_DIRECTION_BIT 0b00000001        // Bit 0: Locomotive Direction
@@ -79,6 +90,14 @@
 #define DECODER_DEFAULT_MOTOR_CONFIGURATION 1 // Enable BEMF by default
 #define DECODER_DEFAULT_PID_KP 10           // Kp = 0.10
 #define DECODER_DEFAULT_PID_KI 10           // Ki = 0.10
+#define DECODER_DEFAULT_SOUND_MASTER_VOLUME 128 // Half of full scale
+#define DECODER_DEFAULT_SOUND_VOLUME 255    // Every sound at its recorded level
+#define DECODER_DEFAULT_SOUND_FADE_TIME 30  // 300 ms
+#define DECODER_DEFAULT_SOUND_NOTCH_TIME 50 // 500 ms
+#define DECODER_DEFAULT_SOUND_CHUFFS_PER_REV 4 // Two cylinders, double acting
+#define DECODER_DEFAULT_SOUND_WHEEL_DIAMETER 20 // H0 scale driver
+#define DECODER_DEFAULT_SOUND_FULL_SPEED 50 // 0.5 m/s
+#define DECODER_DEFAULT_SOUND_CACHE_SIZE 32 // KB
 
 // RCN-225 Default Function Mappings (CVs 33-46)
 #define DECODER_DEFAULT_F0_FWD_MAPPING 1   // Map F0 Fwd to Output 1
@@ -0,0 +1,152 @@
+#include "AssetCache.h"
+#include <string.h>
+
+#define ASSET_CACHE_NO_BLOCK 0xFFFFFFFF
+
+SharedSource::SharedSource()
+    : _mem_data(nullptr), _offset(0), _length(0), _is_open(false), _refs(0),
+      _blocks(nullptr), _use_clock(0), _block_reads(0) {
+    for (int i = 0; i < ASSET_CACHE_BLOCKS; i++) {
+        _block_index[i] = ASSET_CACHE_NO_BLOCK;
+        _block_used[i] = 0;
+    }
+}
+
+bool SharedSource::open(File file, uint32_t offset, uint32_t length) {
+    close();
+    if (!file) return false;
+    _file = file;
+    _offset = offset;
+    _length = length;
+    _is_open = true;
+    return true;
+}
+
+bool SharedSource::open(const uint8_t* data, uint32_t length) {
+    close();
+    if (!data) return false;
+    _mem_data = data;
+    _length = length;
+    _is_open = true;
+    return true;
+}
+
+void SharedSource::close() {
+    if (_file) {
+        _file.close();
+    }
+    _mem_data = nullptr;
+    _is_open = false;
+    _refs = 0;
+    _block_reads = 0;
+    for (int i = 0; i < ASSET_CACHE_BLOCKS; i++) {
+        _block_index[i] = ASSET_CACHE_NO_BLOCK;
+    }
+}
+
+const uint8_t* SharedSource::block(uint32_t index) {
+    int victim = 0;
+    for (int i = 0; i < ASSET_CACHE_BLOCKS; i++) {
+        if (_block_index[i] == index) {
+            _block_used[i] = ++_use_clock;
+            return _blocks + i * ASSET_CACHE_BLOCK_SIZE;
+        }
+        if (_block_index[i] == ASSET_CACHE_NO_BLOCK ||
+            (_block_index[victim] != ASSET_CACHE_NO_BLOCK && _block_used[i] < _block_used[victim])) {
+            victim = i;
+        }
+    }
+
+    // One seek and one full-block read; the file position is shared, so
+    // every miss seeks.
+    uint32_t pos = index * ASSET_CACHE_BLOCK_SIZE;
+    size_t len = _length - pos < ASSET_CACHE_BLOCK_SIZE ? _length - pos : ASSET_CACHE_BLOCK_SIZE;
+    uint8_t* data = _blocks + victim * ASSET_CACHE_BLOCK_SIZE;
+    if (!_file.seek(_offset + pos) || _file.read(data, len) != len) {
+        _block_index[victim] = ASSET_CACHE_NO_BLOCK;
+        return nullptr;
+    }
+    _block_index[victim] = index;
+    _block_used[victim] = ++_use_clock;
+    _block_reads++;
+    return data;
+}
+
+size_t SharedSource::read_at(size_t pos, uint8_t* dst, size_t len) {
+    if (!_is_open || pos >= _length) return 0;
+    if (len > _length - pos) len = _length - pos;
+    if (_mem_data) {
+        memcpy(dst, _mem_data + pos, len);
+        return len;
+    }
+    if (!_blocks) {
+        if (!_file.seek(_offset + pos)) return 0;
+        return _file.read(dst, len);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        const uint8_t* data = block((uint32_t)(pos / ASSET_CACHE_BLOCK_SIZE));
+        if (!data) break;
+        size_t in_block = pos % ASSET_CACHE_BLOCK_SIZE;
+        size_t n = ASSET_CACHE_BLOCK_SIZE - in_block;
+        if (n > len - done) n = len - done;
+        memcpy(dst + done, data + in_block, n);
+        done += n;
+        pos += n;
+    }
+    return done;
+}
+
+AssetCache::AssetCache() : _use_clock(0), _open_count(0), _shared_count(0) {
+    for (int i = 0; i < ASSET_CACHE_MAX_SOURCES; i++) {
+        _sources[i].set_read_ahead(_read_ahead[i]);
+        _sound_ids[i] = 0xFF;
+        _last_used[i] = 0;
+    }
+}
+
+SharedSource* AssetCache::find(uint8_t sound_id, bool* is_open) {
+    int slot = -1;
+    for (int i = 0; i < ASSET_CACHE_MAX_SOURCES; i++) {
+        if (_sources[i].is_open() && _sound_ids[i] == sound_id) {
+            _last_used[i] = ++_use_clock;
+            *is_open = true;
+            return &_sources[i];
+        }
+        // Prefer a closed slot, then the idle source used longest ago.
+        if (_sources[i].get_refs() > 0) continue;
+        if (slot < 0 || (_sources[slot].is_open() &&
+                         (!_sources[i].is_open() || _last_used[i] < _last_used[slot]))) {
+            slot = i;
+        }
+    }
+    *is_open = false;
+    if (slot < 0) return nullptr;
+    _sources[slot].close();
+    _sound_ids[slot] = sound_id;
+    _last_used[slot] = ++_use_clock;
+    return &_sources[slot];
+}
+
+SharedSource* AssetCache::acquire(VSDReader& reader, uint8_t sound_id, const VSDAssetLocation& location) {
+    if (!location.is_stored) return nullptr;
+    bool is_open;
+    SharedSource* source = find(sound_id, &is_open);
+    if (!source) return nullptr;
+    if (is_open) {
+        _shared_count++;
+    } else if (source->open(reader.open_archive(), location.offset, location.length)) {
+        _open_count++;
+    } else {
+        return nullptr;
+    }
+    source->retain();
+    return source;
+}
+
+void AssetCache::clear() {
+    for (int i = 0; i < ASSET_CACHE_MAX_SOURCES; i++) {
+        _sources[i].close();
+    }
+}
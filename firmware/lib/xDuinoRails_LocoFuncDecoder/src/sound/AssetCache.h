@@ -0,0 +1,119 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "VSDReader.h"
+
+// Assets that can have a shared source at the same time.
+#define ASSET_CACHE_MAX_SOURCES 4
+
+// Read-ahead of a shared source: blocks of the asset kept in RAM. Voices
+// playing the same asset a little apart are served from the same blocks.
+#define ASSET_CACHE_BLOCK_SIZE 512
+#define ASSET_CACHE_BLOCKS 4
+
+/**
+ * @class SharedSource
+ * @brief One open asset that several voices read from at their own positions.
+ *
+ * The source holds the only file handle of the asset and a small read-ahead
+ * of recently read blocks. A WAVStream playing the asset is just a cursor:
+ * it keeps its own position and reads through read_at(), so voices playing
+ * the same sound share the open and most of the reads.
+ *
+ * Sources are reference counted and handed out by AssetCache (and by
+ * SampleCache for assets held in RAM); a WAVStream drops its reference when
+ * it is closed.
+ */
+class SharedSource {
+public:
+    SharedSource();
+
+    // Gives the source ASSET_CACHE_BLOCKS * ASSET_CACHE_BLOCK_SIZE bytes of
+    // read-ahead storage. Without it, file reads go straight to the file.
+    void set_read_ahead(uint8_t* storage) { _blocks = storage; }
+
+    // Opens `length` bytes at `offset` of `file`, e.g. a STORED VSD entry.
+    bool open(File file, uint32_t offset, uint32_t length);
+
+    // Opens an asset held in memory. The data is not copied.
+    bool open(const uint8_t* data, uint32_t length);
+
+    // Closes the file handle and drops the read-ahead.
+    void close();
+
+    bool is_open() const { return _is_open; }
+
+    // Reads up to `len` bytes at `pos`. Returns fewer at the end of the asset.
+    size_t read_at(size_t pos, uint8_t* dst, size_t len);
+
+    size_t size() const { return _length; }
+
+    // Reference counting. A source with no references stays open until
+    // its slot is needed for another asset.
+    void retain() { _refs++; }
+    void release() { if (_refs > 0) _refs--; }
+    uint8_t get_refs() const { return _refs; }
+
+    // Blocks read from the file since open().
+    uint32_t get_block_reads() const { return _block_reads; }
+
+private:
+    const uint8_t* block(uint32_t index);
+
+    File _file;
+    const uint8_t* _mem_data;
+    uint32_t _offset;
+    uint32_t _length;
+    bool _is_open;
+    uint8_t _refs;
+
+    // Read-ahead blocks, replaced least recently used first.
+    uint8_t* _blocks;
+    uint32_t _block_index[ASSET_CACHE_BLOCKS]; // Block number held, or UINT32_MAX
+    uint32_t _block_used[ASSET_CACHE_BLOCKS];  // Last use, as _use_clock
+    uint32_t _use_clock;
+    uint32_t _block_reads;
+};
+
+/**
+ * @class AssetCache
+ * @brief Hands out shared sources of the assets that are playing.
+ *
+ * A voice starting a sound gets the sound's SharedSource, opening it only if
+ * no voice has it open already. Sources left without references stay open,
+ * so a sound triggered again soon after is not reopened either; the least
+ * recently used of them gives up its slot when another asset needs one.
+ * Audio core only.
+ */
+class AssetCache {
+public:
+    AssetCache();
+
+    // Returns the shared source of sound `sound_id`, a STORED entry at
+    // `location` in the archive of `reader`, with a reference taken.
+    // Returns nullptr if every slot is in use by playing voices.
+    SharedSource* acquire(VSDReader& reader, uint8_t sound_id, const VSDAssetLocation& location);
+
+    // Closes all sources. Sources still referenced must not be used after.
+    void clear();
+
+    // Sources opened, and acquires served by a source that was open already.
+    uint32_t get_open_count() const { return _open_count; }
+    uint32_t get_shared_count() const { return _shared_count; }
+
+private:
+    // Finds the open source of `sound_id`, or the slot to open it in.
+    SharedSource* find(uint8_t sound_id, bool* is_open);
+
+    SharedSource _sources[ASSET_CACHE_MAX_SOURCES];
+    uint8_t _read_ahead[ASSET_CACHE_MAX_SOURCES][ASSET_CACHE_BLOCKS * ASSET_CACHE_BLOCK_SIZE];
+    uint8_t _sound_ids[ASSET_CACHE_MAX_SOURCES];
+    uint32_t _last_used[ASSET_CACHE_MAX_SOURCES];
+    uint32_t _use_clock;
+    uint32_t _open_count;
+    uint32_t _shared_count;
+};
+
+#endif // ASSET_CACHE_H
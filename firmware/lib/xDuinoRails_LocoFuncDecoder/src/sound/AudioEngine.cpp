@@ -0,0 +1,446 @@
+#include "AudioEngine.h"
+
+AudioEngine::AudioEngine(SoftwareMixer& mixer)
+    : _mixer(mixer), _reader(nullptr), _config(nullptr),
+      _cache_missed(0), _cache_warmup(0), _load_sound(VSD_INVALID_SOUND_ID),
+      _load_evict(false), _load_data(nullptr), _load_size(0), _load_pos(0),
+      _load_inflate(nullptr), _prime_mover(mixer),
+      _chuffs(mixer), _chuff_sounds(0), _command_count(0), _dropped_count(0)
+#if defined(AUDIO_ENGINE_HOST_THREAD)
+    , _running(false)
+#endif
+{
+    for (int i = 0; i < VSD_MAX_SOUNDS; i++) {
+        _sound_gain[i] = MIXER_GAIN_UNITY;
+    }
+    for (int i = 0; i < CHUFF_MAX_SAMPLES; i++) {
+        _chuff_data[i] = nullptr;
+    }
+    _prime_mover.setOpener(&AudioEngine::open_notch_sound, this);
+}
+
+AudioEngine::~AudioEngine() {
+#if defined(AUDIO_ENGINE_HOST_THREAD)
+    stopThread();
+#endif
+    // Voices hold references into _assets and the chuff samples.
+    _mixer.stopAll();
+    endCacheLoad();
+    freeChuffSamples();
+}
+
+void AudioEngine::setSoundProject(VSDReader* reader, VSDConfigParser* config) {
+    endCacheLoad();
+    _assets.clear();
+    _samples.clear();
+    _reader = reader;
+    _config = config;
+
+    _cache_missed = 0;
+    _cache_warmup = 0;
+    for (int i = 0; config && i < config->get_sound_count(); ++i) {
+        if (isCacheable((uint8_t)i)) _cache_warmup |= 1u << i;
+    }
+
+    uint8_t notches[PRIME_MOVER_MAX_NOTCHES];
+    uint8_t count = config ? config->get_notch_sounds(notches, PRIME_MOVER_MAX_NOTCHES) : 0;
+    _prime_mover.setNotches(notches, count);
+    loadChuffSamples();
+}
+
+void AudioEngine::loadChuffSamples() {
+    freeChuffSamples();
+    if (!_reader || !_config) return;
+
+    uint8_t loaded = 0;
+    for (int i = 0; i < _config->get_sound_count() && loaded < CHUFF_MAX_SAMPLES; ++i) {
+        const SoundHandle& sound = _config->get_sound((uint8_t)i);
+        if (sound.type != SoundType::STEAM_CHUFF) continue;
+        _chuff_sounds |= 1u << i;
+        if (!sound.is_resolved || sound.location.uncompressed_length > CHUFF_MAX_SAMPLE_BYTES) continue;
+
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        if (!_reader->get_file_data(_config->get_sound_name((uint8_t)i), &data, &size)) continue;
+        _chuff_data[loaded] = data;
+        _chuffs.addSample(data, size);
+        loaded++;
+    }
+}
+
+bool AudioEngine::isCacheable(uint8_t sound_id) const {
+    if (!_config || sound_id >= _config->get_sound_count()) return false;
+    const SoundHandle& sound = _config->get_sound(sound_id);
+    return sound.type == SoundType::ONE_SHOT && sound.is_resolved &&
+           _samples.accepts(sound.location.uncompressed_length);
+}
+
+void AudioEngine::fillSampleCache() {
+    if (!_reader || !_config) return;
+    if (_load_sound == VSD_INVALID_SOUND_ID) {
+        // Sounds that missed first, then the warm-up.
+        uint16_t pending = _cache_missed ? _cache_missed : _cache_warmup;
+        if (!pending) return;
+        uint8_t sound_id = 0;
+        while (!(pending & (1u << sound_id))) sound_id++;
+        bool evict = _cache_missed != 0;
+        if (_samples.contains(sound_id) || !isCacheable(sound_id)) {
+            _cache_missed &= ~(1u << sound_id);
+            _cache_warmup &= ~(1u << sound_id);
+            return;
+        }
+        // A DEFLATE sound waits while every inflater is playing.
+        if (!beginCacheLoad(sound_id)) return;
+        _cache_missed &= ~(1u << sound_id);
+        _cache_warmup &= ~(1u << sound_id);
+        _load_evict = evict;
+    }
+
+    size_t len = _load_size - _load_pos;
+    if (len > AUDIO_ENGINE_CACHE_LOAD_BYTES) len = AUDIO_ENGINE_CACHE_LOAD_BYTES;
+    size_t read = _load_inflate ? _load_inflate->read(_load_data + _load_pos, len)
+                                : _load_file.read(_load_data + _load_pos, len);
+    _load_pos += read;
+    if (read < len) {
+        endCacheLoad(); // Short entry or read error; the sound keeps streaming
+        return;
+    }
+    if (_load_pos == _load_size) {
+        // insert() owns the image from here, resident or freed.
+        _samples.insert(_load_sound, _load_data, _load_size, _load_evict);
+        _load_data = nullptr;
+        endCacheLoad();
+    }
+}
+
+bool AudioEngine::beginCacheLoad(uint8_t sound_id) {
+    const VSDAssetLocation& location = _config->get_sound(sound_id).location;
+    if (location.is_deflated) {
+        _load_inflate = _reader->open_inflate_source(location);
+        if (!_load_inflate) return false;
+    } else if (location.is_stored) {
+        _load_file = _reader->open_archive();
+        if (!_load_file || !_load_file.seek(location.offset)) {
+            _load_file.close();
+            return false;
+        }
+    } else {
+        return false;
+    }
+    _load_data = (uint8_t*)malloc(location.uncompressed_length);
+    if (!_load_data) {
+        endCacheLoad();
+        return false;
+    }
+    _load_sound = sound_id;
+    _load_size = location.uncompressed_length;
+    _load_pos = 0;
+    return true;
+}
+
+void AudioEngine::endCacheLoad() {
+    if (_load_inflate) {
+        _load_inflate->close();
+        _load_inflate = nullptr;
+    }
+    _load_file.close();
+    free(_load_data);
+    _load_data = nullptr;
+    _load_sound = VSD_INVALID_SOUND_ID;
+}
+
+void AudioEngine::freeChuffSamples() {
+    _chuffs.clearSamples();
+    for (int i = 0; i < CHUFF_MAX_SAMPLES; i++) {
+        free(_chuff_data[i]);
+        _chuff_data[i] = nullptr;
+    }
+    _chuff_sounds = 0;
+}
+
+bool AudioEngine::isChuffSound(uint8_t sound_id) const {
+    return sound_id < VSD_MAX_SOUNDS && (_chuff_sounds & (1u << sound_id));
+}
+
+bool AudioEngine::post(const AudioCommand& command) {
+    if (!_commands.push(command)) {
+        _dropped_count++;
+        _mixer.getSoundController().getStats().recordDroppedCommand();
+        return false;
+    }
+    return true;
+}
+
+bool AudioEngine::play(uint8_t sound_id) {
+    return post({ AudioCommand::Type::PLAY, sound_id, 0 });
+}
+
+bool AudioEngine::stop(uint8_t sound_id) {
+    return post({ AudioCommand::Type::STOP, sound_id, 0 });
+}
+
+bool AudioEngine::stopAll() {
+    return post({ AudioCommand::Type::STOP_ALL, VSD_INVALID_SOUND_ID, 0 });
+}
+
+bool AudioEngine::setVolume(uint8_t volume) {
+    return post({ AudioCommand::Type::SET_VOLUME, VSD_INVALID_SOUND_ID, volume });
+}
+
+bool AudioEngine::setPitch(uint8_t sound_id, uint16_t pitch) {
+    return post({ AudioCommand::Type::SET_PITCH, sound_id, pitch });
+}
+
+bool AudioEngine::setSoundVolume(uint8_t sound_id, uint8_t volume) {
+    return post({ AudioCommand::Type::SET_SOUND_VOLUME, sound_id, volume });
+}
+
+bool AudioEngine::fadeOut(uint8_t sound_id, uint16_t ms) {
+    return post({ AudioCommand::Type::FADE_OUT, sound_id, ms });
+}
+
+bool AudioEngine::setSpeed(uint8_t speed) {
+    return post({ AudioCommand::Type::SET_SPEED, VSD_INVALID_SOUND_ID, speed });
+}
+
+bool AudioEngine::setLoad(uint8_t load) {
+    return post({ AudioCommand::Type::SET_LOAD, VSD_INVALID_SOUND_ID, load });
+}
+
+bool AudioEngine::setNotchTime(uint16_t ms) {
+    return post({ AudioCommand::Type::SET_NOTCH_TIME, VSD_INVALID_SOUND_ID, ms });
+}
+
+bool AudioEngine::setChuffsPerRevolution(uint8_t chuffs) {
+    return post({ AudioCommand::Type::SET_CHUFFS_PER_REV, VSD_INVALID_SOUND_ID, chuffs });
+}
+
+bool AudioEngine::setWheelDiameter(uint8_t mm) {
+    return post({ AudioCommand::Type::SET_WHEEL_DIAMETER, VSD_INVALID_SOUND_ID, mm });
+}
+
+bool AudioEngine::setFullSpeed(uint16_t mm_per_s) {
+    return post({ AudioCommand::Type::SET_FULL_SPEED, VSD_INVALID_SOUND_ID, mm_per_s });
+}
+
+bool AudioEngine::setCacheSize(uint16_t kb) {
+    return post({ AudioCommand::Type::SET_CACHE_SIZE, VSD_INVALID_SOUND_ID, kb });
+}
+
+bool AudioEngine::playTrack(uint16_t track) {
+    return post({ AudioCommand::Type::PLAY_TRACK, VSD_INVALID_SOUND_ID, track });
+}
+
+bool AudioEngine::setFunction(uint8_t function, bool state, uint16_t fade_ms) {
+    if (!_config) return true;
+    // The trigger index is compiled at load time and not changed after, so
+    // the control core may read it.
+    bool posted = true;
+    int count = 0;
+    const uint8_t* sound_ids = _config->get_function_sounds(function, &count);
+    for (int i = 0; i < count; i++) {
+        SoundType type = _config->get_sound(sound_ids[i]).type;
+        if (state) {
+            posted &= play(sound_ids[i]);
+        } else if (type == SoundType::CONTINUOUS_LOOP ||
+                   type == SoundType::PRIME_MOVER ||
+                   type == SoundType::STEAM_CHUFF) {
+            // Looped sounds and the engine end with a fade when their function turns off.
+            posted &= fadeOut(sound_ids[i], fade_ms);
+        }
+    }
+    return posted;
+}
+
+void AudioEngine::loop() {
+    AudioCommand command;
+    while (_commands.pop(command)) {
+        execute(command);
+        _command_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    _prime_mover.update();
+    _chuffs.update();
+    _mixer.update();
+    // After the mix, and only a chunk of it per call: reading a whole sound
+    // (up to SAMPLE_CACHE_MAX_SAMPLE_BYTES, maybe inflated) at once would
+    // make the next block late.
+    fillSampleCache();
+}
+
+void AudioEngine::execute(const AudioCommand& command) {
+    switch (command.type) {
+        case AudioCommand::Type::PLAY:
+            if (_prime_mover.hasSound(command.sound_id)) {
+                _prime_mover.start();
+            } else if (isChuffSound(command.sound_id)) {
+                _chuffs.start();
+            } else {
+                startSound(command.sound_id);
+            }
+            break;
+        case AudioCommand::Type::STOP:
+            if (_prime_mover.hasSound(command.sound_id)) {
+                _prime_mover.stop(0);
+            } else if (isChuffSound(command.sound_id)) {
+                _chuffs.stop();
+            } else {
+                _mixer.stop(command.sound_id);
+            }
+            break;
+        case AudioCommand::Type::STOP_ALL:
+            _prime_mover.stop(0);
+            _chuffs.stop();
+            _mixer.stopAll();
+            break;
+        case AudioCommand::Type::SET_VOLUME:
+            _mixer.setMasterVolume((uint8_t)command.value);
+            break;
+        case AudioCommand::Type::SET_SOUND_VOLUME:
+            if (command.sound_id < VSD_MAX_SOUNDS) {
+                uint8_t volume = command.value > 255 ? 255 : (uint8_t)command.value;
+                _sound_gain[command.sound_id] = (uint16_t)(((uint32_t)volume * MIXER_GAIN_UNITY + 127) / 255);
+                _mixer.setGain(command.sound_id, _sound_gain[command.sound_id]);
+                // The notches share one volume, the one set last.
+                if (_prime_mover.hasSound(command.sound_id)) {
+                    _prime_mover.setGain(_sound_gain[command.sound_id]);
+                }
+                if (isChuffSound(command.sound_id)) {
+                    _chuffs.setGain(_sound_gain[command.sound_id]);
+                }
+            }
+            break;
+        case AudioCommand::Type::FADE_OUT:
+            if (_prime_mover.hasSound(command.sound_id)) {
+                _prime_mover.stop(command.value);
+            } else if (isChuffSound(command.sound_id)) {
+                _chuffs.stop(); // Chuffs are too short to fade
+            } else {
+                _mixer.fadeOut(command.sound_id, command.value);
+            }
+            break;
+        case AudioCommand::Type::SET_SPEED:
+            _prime_mover.setSpeed((uint8_t)command.value);
+            _chuffs.setSpeed((uint8_t)command.value);
+            break;
+        case AudioCommand::Type::SET_LOAD:
+            _prime_mover.setLoad((uint8_t)command.value);
+            break;
+        case AudioCommand::Type::SET_NOTCH_TIME:
+            _prime_mover.setCrossfadeTime(command.value);
+            break;
+        case AudioCommand::Type::SET_CHUFFS_PER_REV:
+            _chuffs.setChuffsPerRevolution((uint8_t)command.value);
+            break;
+        case AudioCommand::Type::SET_WHEEL_DIAMETER:
+            _chuffs.setWheelDiameter((uint8_t)command.value);
+            break;
+        case AudioCommand::Type::SET_FULL_SPEED:
+            _chuffs.setFullSpeed(command.value);
+            break;
+        case AudioCommand::Type::SET_CACHE_SIZE:
+            _samples.set_capacity_kb(command.value);
+            break;
+        case AudioCommand::Type::PLAY_TRACK:
+            _mixer.getSoundController().play(command.value);
+            break;
+        case AudioCommand::Type::SET_PITCH:
+            _mixer.setPitch(command.sound_id, command.value);
+            break;
+    }
+}
+
+VoicePriority AudioEngine::voice_priority(SoundType type) {
+    switch (type) {
+        case SoundType::PRIME_MOVER:
+            return VoicePriority::PRIME_MOVER;
+        case SoundType::STEAM_CHUFF:
+            return VoicePriority::CHUFF;
+        case SoundType::CONTINUOUS_LOOP:
+            // Held function sounds: horn, bell, whistle
+            return VoicePriority::HORN_BELL;
+        case SoundType::RANDOM_AMBIENT:
+            return VoicePriority::AMBIENT;
+        case SoundType::ONE_SHOT:
+        default:
+            return VoicePriority::ONE_SHOT;
+    }
+}
+
+void AudioEngine::startSound(uint8_t sound_id) {
+    if (!_config || sound_id >= _config->get_sound_count()) return;
+    const SoundHandle& sound = _config->get_sound(sound_id);
+    WAVStream* stream = openSound(sound_id, voice_priority(sound.type));
+    if (stream) {
+        stream->setLooping(sound.type == SoundType::CONTINUOUS_LOOP);
+        _mixer.play(stream, sound_id, _sound_gain[sound_id]);
+    }
+}
+
+WAVStream* AudioEngine::openSound(uint8_t sound_id, VoicePriority priority) {
+    if (!_reader || !_config || sound_id >= _config->get_sound_count()) return nullptr;
+    const SoundHandle& sound = _config->get_sound(sound_id);
+    if (!sound.is_resolved) return nullptr;
+
+    SoundStats& stats = _mixer.getSoundController().getStats();
+    WAVStream* stream = _mixer.acquire(priority);
+    if (!stream) {
+        stats.recordDroppedPlay(); // All voices busy with more important sounds
+        return nullptr;
+    }
+
+    // Resident sounds play from RAM. STORED entries play in place from the
+    // archive, through the sound's shared source if a slot is free, so
+    // voices of the same sound share one file handle. DEFLATE entries are
+    // inflated on the fly while playing.
+    bool started = false;
+    SharedSource* resident = nullptr;
+    if (isCacheable(sound_id)) {
+        resident = _samples.acquire(sound_id);
+        if (resident) {
+            stats.recordSampleCacheHit();
+        } else {
+            stats.recordSampleCacheMiss();
+            _cache_missed |= 1u << sound_id; // Loaded after this block
+        }
+    }
+    if (resident) {
+        started = stream->begin(resident);
+    } else if (sound.location.is_stored) {
+        SharedSource* shared = _assets.acquire(*_reader, sound_id, sound.location);
+        if (shared) {
+            started = stream->begin(shared);
+        } else {
+            started = stream->begin(_reader->open_archive(), sound.location.offset, sound.location.length);
+        }
+    } else if (sound.location.is_deflated) {
+        started = stream->begin(_reader->open_inflate_source(sound.location));
+    }
+
+    if (!started) {
+        _mixer.release(stream); // Closes the file, if any
+        stats.recordDroppedPlay();
+        return nullptr;
+    }
+    return stream;
+}
+
+WAVStream* AudioEngine::open_notch_sound(void* context, uint8_t sound_id) {
+    return static_cast<AudioEngine*>(context)->openSound(sound_id, VoicePriority::PRIME_MOVER);
+}
+
+#if defined(AUDIO_ENGINE_HOST_THREAD)
+void AudioEngine::startThread() {
+    if (_running.exchange(true)) return;
+    _thread = std::thread([this]() {
+        while (_running.load(std::memory_order_relaxed)) {
+            loop();
+            std::this_thread::yield();
+        }
+    });
+}
+
+void AudioEngine::stopThread() {
+    if (!_running.exchange(false)) return;
+    if (_thread.joinable()) _thread.join();
+}
+#endif
@@ -0,0 +1,190 @@
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include <Arduino.h>
+#include "SoftwareMixer.h"
+#include "PrimeMover.h"
+#include "ChuffGenerator.h"
+#include "AssetCache.h"
+#include "SampleCache.h"
+#include "SpscQueue.h"
+#include "VSDReader.h"
+#include "VSDConfigParser.h"
+
+#if !defined(ARDUINO_ARCH_RP2040)
+// On the host the second core is stood in for by a thread.
+#define AUDIO_ENGINE_HOST_THREAD
+#include <thread>
+#endif
+
+// Commands that can be in flight between the control and the audio core.
+#define AUDIO_COMMAND_QUEUE_SIZE 32
+
+// Bytes of a sound read into the sample cache per loop(), on top of the
+// mixer's refill budget. Keeps a load from delaying the next block.
+#define AUDIO_ENGINE_CACHE_LOAD_BYTES 1024
+
+struct AudioCommand {
+    enum class Type : uint8_t {
+        PLAY,       // Start sound `sound_id`
+        STOP,       // Stop all voices playing sound `sound_id`
+        STOP_ALL,   // Stop every voice
+        SET_VOLUME,       // Set the master volume to `value` (0-255)
+        SET_PITCH,        // Set the pitch of sound `sound_id` to `value` (Q8.8)
+        SET_SOUND_VOLUME, // Set the volume of sound `sound_id` to `value` (0-255)
+        FADE_OUT,         // Fade sound `sound_id` out over `value` milliseconds
+        SET_SPEED,        // Set the motor target speed to `value` (0-255)
+        SET_LOAD,         // Set the motor load to `value` (0-255)
+        SET_NOTCH_TIME,   // Set the prime mover's notch change time to `value` milliseconds
+        SET_CHUFFS_PER_REV, // Set the chuffs per driving wheel revolution to `value`
+        SET_WHEEL_DIAMETER, // Set the driving wheel diameter to `value` millimetres
+        SET_FULL_SPEED,     // Set the model speed at speed 255 to `value` mm/s
+        SET_CACHE_SIZE,     // Set the RAM sample cache size to `value` KB
+        PLAY_TRACK          // Have the sound driver play its track `value`
+    };
+
+    Type type;
+    uint8_t sound_id;
+    uint16_t value;
+};
+
+/**
+ * @class AudioEngine
+ * @brief Runs the mixer and all stream servicing on its own core.
+ *
+ * The control core (DCC decoding, motor and aux effects) only posts small
+ * commands into a lock-free single-producer/single-consumer queue. The audio
+ * core drains the queue, opens the sound sources and renders the mix.
+ *
+ * On the RP2040 the sketch runs the audio side from `loop1()` (see the
+ * SoundDecoder example), which keeps core 1 under the Arduino core's control
+ * so flash writes can still pause it. On the host a `std::thread` stands in.
+ */
+class AudioEngine {
+public:
+    AudioEngine(SoftwareMixer& mixer);
+    ~AudioEngine();
+
+    // Sets the VSD whose sounds PLAY commands refer to. Its PRIME_MOVER
+    // sounds become the notches of the prime mover, which PLAY, STOP and
+    // FADE_OUT of any of them start and stop. Its STEAM_CHUFF sounds are
+    // read into RAM as the chuffs of the chuff generator, which PLAY and
+    // STOP of any of them start and stop. Short ONE_SHOT sounds are loaded
+    // into the RAM sample cache while it has room, a chunk per loop().
+    // Call before the audio core runs.
+    void setSoundProject(VSDReader* reader, VSDConfigParser* config);
+
+    // --- Control core (producer) ---
+    // All of these return false if the queue is full and the command was dropped.
+    bool post(const AudioCommand& command);
+    bool play(uint8_t sound_id);
+    bool stop(uint8_t sound_id);
+    bool stopAll();
+    bool setVolume(uint8_t volume);
+    bool setPitch(uint8_t sound_id, uint16_t pitch);
+    bool setSoundVolume(uint8_t sound_id, uint8_t volume);
+    bool fadeOut(uint8_t sound_id, uint16_t ms);
+    bool setSpeed(uint8_t speed);
+    bool setLoad(uint8_t load);
+    bool setNotchTime(uint16_t ms);
+    bool setChuffsPerRevolution(uint8_t chuffs);
+    bool setWheelDiameter(uint8_t mm);
+    bool setFullSpeed(uint16_t mm_per_s);
+    bool setCacheSize(uint16_t kb);
+    // Plays a track of the sound driver itself (e.g. a DFPlayer file)
+    // rather than a VSD sound, so the driver is only used on the audio core.
+    bool playTrack(uint16_t track);
+
+    // Plays the sounds mapped to function `function` when it turns on. When
+    // it turns off, looped sounds, the prime mover and the chuffs fade out
+    // over `fade_ms`. Returns false if a command was dropped.
+    bool setFunction(uint8_t function, bool state, uint16_t fade_ms);
+
+    // --- Audio core (consumer) ---
+    // Executes all queued commands and renders the next mix block.
+    void loop();
+
+    // Number of commands executed so far.
+    uint32_t getCommandCount() const { return _command_count.load(std::memory_order_relaxed); }
+
+    // Number of commands dropped because the queue was full.
+    uint32_t getDroppedCommandCount() const { return _dropped_count; }
+
+    // The diesel engine sound (audio core only).
+    PrimeMover& getPrimeMover() { return _prime_mover; }
+
+    // The steam chuff sound (audio core only).
+    ChuffGenerator& getChuffGenerator() { return _chuffs; }
+
+    // Shared sources of the STORED sounds (audio core only).
+    AssetCache& getAssetCache() { return _assets; }
+
+    // Short one-shot sounds held in RAM (audio core only).
+    SampleCache& getSampleCache() { return _samples; }
+
+#if defined(AUDIO_ENGINE_HOST_THREAD)
+    // Runs loop() on a host thread until stopThread() is called.
+    void startThread();
+    void stopThread();
+#endif
+
+private:
+    void execute(const AudioCommand& command);
+    void startSound(uint8_t sound_id);
+
+    // Reads the STEAM_CHUFF sounds into RAM and hands them to _chuffs.
+    void loadChuffSamples();
+    void freeChuffSamples();
+    bool isChuffSound(uint8_t sound_id) const;
+
+    // True if sound `sound_id` is short enough for the sample cache.
+    bool isCacheable(uint8_t sound_id) const;
+
+    // Reads the next AUDIO_ENGINE_CACHE_LOAD_BYTES of the sound being
+    // loaded into the sample cache, starting the next waiting one if none
+    // is. A sound becomes resident once all of it is read.
+    void fillSampleCache();
+    bool beginCacheLoad(uint8_t sound_id);
+    void endCacheLoad();
+
+    // Acquires a voice of `priority` and starts sound `sound_id` on it.
+    // Returns nullptr, counting a dropped play, if that is not possible.
+    WAVStream* openSound(uint8_t sound_id, VoicePriority priority);
+
+    // SoundOpener of the prime mover.
+    static WAVStream* open_notch_sound(void* context, uint8_t sound_id);
+
+    // Mixer priority of the voices of a sound type.
+    static VoicePriority voice_priority(SoundType type);
+
+    SoftwareMixer& _mixer;
+    VSDReader* _reader;
+    VSDConfigParser* _config;
+    uint16_t _sound_gain[VSD_MAX_SOUNDS]; // Per-sound gain, Q15 (audio core only)
+    AssetCache _assets;
+    SampleCache _samples;
+    uint16_t _cache_missed; // Bit per sound to load, evicting others if needed
+    uint16_t _cache_warmup; // Bit per sound to load while there is room
+    uint8_t _load_sound;    // Sound being read, VSD_INVALID_SOUND_ID if none
+    bool _load_evict;       // Whether it may evict others once read
+    uint8_t* _load_data;    // Its WAV image as read so far (owned)
+    size_t _load_size;
+    size_t _load_pos;
+    File _load_file;        // Archive handle of a STORED sound...
+    InflateSource* _load_inflate; // ...or the inflater of a DEFLATE one
+    PrimeMover _prime_mover;
+    ChuffGenerator _chuffs;
+    uint8_t* _chuff_data[CHUFF_MAX_SAMPLES]; // Owned, see loadChuffSamples()
+    uint16_t _chuff_sounds; // Bit per STEAM_CHUFF sound ID
+
+    SpscQueue<AudioCommand, AUDIO_COMMAND_QUEUE_SIZE> _commands;
+    std::atomic<uint32_t> _command_count;
+    uint32_t _dropped_count; // Producer side only
+
+#if defined(AUDIO_ENGINE_HOST_THREAD)
+    std::thread _thread;
+    std::atomic<bool> _running;
+#endif
+};
+
+#endif // AUDIO_ENGINE_H
@@ -0,0 +1,106 @@
+#include "ChuffGenerator.h"
+
+ChuffGenerator::ChuffGenerator(SoftwareMixer& mixer)
+    : _mixer(mixer), _sample_count(0), _next_sample(0),
+      _chuffs_per_rev(4), _wheel_diameter(20), _full_speed(500), _speed(0),
+      _gain(MIXER_GAIN_UNITY), _running(false), _phase(0), _phase_time(0),
+      _chuff_count(0) {
+}
+
+bool ChuffGenerator::addSample(const uint8_t* wav, size_t size) {
+    if (_sample_count == CHUFF_MAX_SAMPLES || !wav) return false;
+    _samples[_sample_count] = wav;
+    _sample_sizes[_sample_count] = size;
+    _sample_count++;
+    return true;
+}
+
+void ChuffGenerator::clearSamples() {
+    stop();
+    _sample_count = 0;
+    _next_sample = 0;
+}
+
+void ChuffGenerator::setChuffsPerRevolution(uint8_t chuffs) {
+    _chuffs_per_rev = chuffs;
+}
+
+void ChuffGenerator::setWheelDiameter(uint8_t mm) {
+    _wheel_diameter = mm ? mm : 1;
+}
+
+void ChuffGenerator::setFullSpeed(uint16_t mm_per_s) {
+    _full_speed = mm_per_s;
+}
+
+void ChuffGenerator::setGain(uint16_t gain) {
+    _gain = gain > MIXER_GAIN_UNITY ? MIXER_GAIN_UNITY : gain;
+    _mixer.setGain(CHUFF_TAG, _gain);
+}
+
+uint32_t ChuffGenerator::getChuffRate() const {
+    // Revolutions per second are speed / (pi * diameter); pi is 355/113.
+    uint64_t speed = (uint64_t)_speed * _full_speed; // mm/s times 255
+    uint64_t rate = speed * _chuffs_per_rev * 1000 * 113 / ((uint64_t)255 * _wheel_diameter * 355);
+    return rate > CHUFF_MAX_RATE * 1000UL ? CHUFF_MAX_RATE * 1000UL : (uint32_t)rate;
+}
+
+void ChuffGenerator::start() {
+    if (_running) return;
+    _running = true;
+    // The first chuff comes one interval after the wheels start turning.
+    _phase = 0;
+    _phase_time = _mixer.getFrameTime();
+    _chuff_count = 0;
+}
+
+void ChuffGenerator::stop() {
+    if (!_running) return;
+    _running = false;
+    // Drops the scheduled chuffs along with the one sounding.
+    _mixer.stop(CHUFF_TAG);
+}
+
+void ChuffGenerator::fire(uint32_t frame) {
+    if (_sample_count == 0) return;
+    WAVStream* stream = _mixer.acquire(VoicePriority::CHUFF);
+    if (!stream) return;
+    const uint8_t sample = _next_sample;
+    _next_sample = (_next_sample + 1) % _sample_count;
+    if (!stream->begin(_samples[sample], _sample_sizes[sample]) ||
+        !_mixer.playAt(frame, stream, CHUFF_TAG, _gain)) {
+        _mixer.release(stream);
+        return;
+    }
+    _chuff_count++;
+}
+
+void ChuffGenerator::update() {
+    if (!_running) return;
+    const uint32_t now = _mixer.getFrameTime();
+    uint32_t horizon = now + CHUFF_SCHEDULE_AHEAD;
+    // After a stall, carry on from now rather than bunching up late chuffs.
+    if ((int32_t)(now - _phase_time) > 0) _phase_time = now;
+
+    // Chuffs per frame, Q32. The rate is read once, so a speed change takes
+    // effect from the end of what is already scheduled.
+    uint64_t step = ((uint64_t)getChuffRate() << 32) / (1000ULL * MIXER_OUTPUT_RATE);
+    while ((int32_t)(horizon - _phase_time) > 0) {
+        uint32_t frames = horizon - _phase_time;
+        if (step == 0) {
+            _phase_time = horizon; // Standing still
+            break;
+        }
+        // Frames until the phase wraps, rounded up to land on the chuff.
+        uint64_t remaining = (1ULL << 32) - _phase;
+        uint64_t to_chuff = (remaining + step - 1) / step;
+        if (to_chuff > frames) {
+            _phase += (uint32_t)(step * frames);
+            _phase_time = horizon;
+            break;
+        }
+        _phase_time += (uint32_t)to_chuff;
+        _phase = (uint32_t)(_phase + step * to_chuff); // Wraps past one chuff
+        fire(_phase_time);
+    }
+}
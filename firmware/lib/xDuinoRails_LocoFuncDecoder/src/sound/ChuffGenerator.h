@@ -0,0 +1,93 @@
+#ifndef CHUFF_GENERATOR_H
+#define CHUFF_GENERATOR_H
+
+#include <Arduino.h>
+#include "SoftwareMixer.h"
+
+// Chuff samples cycled through for variety.
+#define CHUFF_MAX_SAMPLES 4
+
+// Largest chuff sample kept in RAM, as a complete WAV image.
+#define CHUFF_MAX_SAMPLE_BYTES 16384
+
+// Mixer tag of the chuff voices.
+#define CHUFF_TAG 0xF2
+
+// How far ahead of the mix chuffs are scheduled, in output frames.
+#define CHUFF_SCHEDULE_AHEAD (2 * MIXER_BLOCK_FRAMES)
+
+// Highest chuff rate, in chuffs per second.
+#define CHUFF_MAX_RATE 40
+
+/**
+ * @class ChuffGenerator
+ * @brief Steam exhaust chuffs in step with the driving wheels.
+ *
+ * The chuff rate follows the wheel speed: the model speed over the wheel
+ * circumference, times the chuffs per revolution (4 for a two-cylinder
+ * engine). A phase accumulator advances at that rate in output frames and
+ * every chuff is handed to the mixer with playAt() for the exact frame the
+ * phase wraps on, so chuffs stay evenly spaced whatever the loop timing.
+ *
+ * Chuffs play from WAV images in RAM, so a fast train does not open a file
+ * for every chuff. Runs on the audio core, like the PrimeMover.
+ */
+class ChuffGenerator {
+public:
+    explicit ChuffGenerator(SoftwareMixer& mixer);
+
+    // Adds a chuff sample: a complete WAV image in RAM that must outlive
+    // the generator. Returns false once CHUFF_MAX_SAMPLES are set.
+    bool addSample(const uint8_t* wav, size_t size);
+    void clearSamples();
+    uint8_t getSampleCount() const { return _sample_count; }
+
+    // Wheel geometry: chuffs per driving wheel revolution, and the model
+    // driving wheel diameter in millimetres.
+    void setChuffsPerRevolution(uint8_t chuffs);
+    void setWheelDiameter(uint8_t mm);
+
+    // Model speed at speed 255, in millimetres per second.
+    void setFullSpeed(uint16_t mm_per_s);
+
+    // Sets the wheel speed (0-255, measured or commanded).
+    void setSpeed(uint8_t speed) { _speed = speed; }
+
+    // Sets the chuff volume (Q15, see MIXER_GAIN_UNITY).
+    void setGain(uint16_t gain);
+
+    void start();
+    void stop();
+    bool isRunning() const { return _running; }
+
+    // Current chuff rate in chuffs per 1000 seconds.
+    uint32_t getChuffRate() const;
+
+    // Chuffs scheduled since start().
+    uint32_t getChuffCount() const { return _chuff_count; }
+
+    // Schedules the chuffs due in the next CHUFF_SCHEDULE_AHEAD frames.
+    void update();
+
+private:
+    void fire(uint32_t frame);
+
+    SoftwareMixer& _mixer;
+    const uint8_t* _samples[CHUFF_MAX_SAMPLES];
+    size_t _sample_sizes[CHUFF_MAX_SAMPLES];
+    uint8_t _sample_count;
+    uint8_t _next_sample;
+
+    uint8_t _chuffs_per_rev;
+    uint8_t _wheel_diameter;
+    uint16_t _full_speed;
+    uint8_t _speed;
+    uint16_t _gain;
+
+    bool _running;
+    uint32_t _phase;      // Fraction of the current chuff interval, Q32
+    uint32_t _phase_time; // Mixer frame time _phase refers to
+    uint32_t _chuff_count;
+};
+
+#endif // CHUFF_GENERATOR_H
@@ -0,0 +1,91 @@
+#include "ImaAdpcm.h"
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// Decodes one nibble. The predictor is kept in an int to avoid re-widening
+// on every sample; the caller stores it back once per group.
+static inline int16_t decode_nibble(int& predictor, int& index, uint8_t nibble) {
+    int step = step_table[index];
+    int diff = step >> 3;
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 4) diff += step;
+    if (nibble & 8) {
+        predictor -= diff;
+        if (predictor < -32768) predictor = -32768;
+    } else {
+        predictor += diff;
+        if (predictor > 32767) predictor = 32767;
+    }
+    index += index_table[nibble];
+    if (index < 0) index = 0;
+    if (index > 88) index = 88;
+    return (int16_t)predictor;
+}
+
+// Decodes the 8 samples of one channel's 4 bytes to every second slot of `dst`.
+static inline void decode_unit(ImaAdpcmChannel* state, const uint8_t* src, int16_t* dst) {
+    int predictor = state->predictor;
+    int index = state->step_index;
+    for (int i = 0; i < IMA_ADPCM_UNIT_BYTES; i++) {
+        uint8_t byte = src[i];
+        dst[0] = decode_nibble(predictor, index, byte & 0x0F);
+        dst[2] = decode_nibble(predictor, index, byte >> 4);
+        dst += 4;
+    }
+    state->predictor = (int16_t)predictor;
+    state->step_index = (uint8_t)index;
+}
+
+size_t ima_adpcm_frames_per_block(uint16_t block_align, uint16_t channels) {
+    size_t unit = IMA_ADPCM_UNIT_BYTES * channels;
+    if (channels == 0 || block_align < unit) return 0;
+    return (block_align / unit - 1) * IMA_ADPCM_FRAMES_PER_GROUP + 1;
+}
+
+void ima_adpcm_decode_header(ImaAdpcmChannel* state, uint16_t channels,
+                             const uint8_t* src, int16_t* dst) {
+    for (uint16_t ch = 0; ch < channels; ch++) {
+        const uint8_t* header = src + ch * IMA_ADPCM_UNIT_BYTES;
+        state[ch].predictor = (int16_t)(header[0] | (header[1] << 8));
+        state[ch].step_index = header[2] > 88 ? 88 : header[2];
+    }
+    dst[0] = state[0].predictor;
+    dst[1] = state[channels > 1 ? 1 : 0].predictor;
+}
+
+void ima_adpcm_decode_groups(ImaAdpcmChannel* state, uint16_t channels,
+                             const uint8_t* src, size_t groups, int16_t* dst) {
+    if (channels == 1) {
+        for (size_t g = 0; g < groups; g++) {
+            decode_unit(&state[0], src, dst);
+            for (int i = 0; i < IMA_ADPCM_FRAMES_PER_GROUP; i++) {
+                dst[i * 2 + 1] = dst[i * 2];
+            }
+            src += IMA_ADPCM_UNIT_BYTES;
+            dst += IMA_ADPCM_FRAMES_PER_GROUP * 2;
+        }
+    } else {
+        for (size_t g = 0; g < groups; g++) {
+            decode_unit(&state[0], src, dst);
+            decode_unit(&state[1], src + IMA_ADPCM_UNIT_BYTES, dst + 1);
+            src += IMA_ADPCM_UNIT_BYTES * 2;
+            dst += IMA_ADPCM_FRAMES_PER_GROUP * 2;
+        }
+    }
+}
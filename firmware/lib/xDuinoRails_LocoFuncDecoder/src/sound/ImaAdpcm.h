@@ -0,0 +1,37 @@
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include <Arduino.h>
+
+// WAV format tag of IMA (DVI) ADPCM.
+#define IMA_ADPCM_FORMAT_TAG 0x11
+
+// Every channel codes 8 samples in 4 bytes. Channel headers are 4 bytes as
+// well, so a block is a sequence of units of 4 bytes per channel: one header
+// unit followed by group units.
+#define IMA_ADPCM_UNIT_BYTES 4
+#define IMA_ADPCM_FRAMES_PER_GROUP 8
+
+// Decoder state of one channel.
+struct ImaAdpcmChannel {
+    int16_t predictor;
+    uint8_t step_index;
+};
+
+// Number of frames coded in a block of `block_align` bytes, including the
+// header sample.
+size_t ima_adpcm_frames_per_block(uint16_t block_align, uint16_t channels);
+
+// Loads the channel states from a block header unit and writes its header
+// sample as one interleaved 16-bit stereo frame to `dst`.
+// Mono streams are written to both channels.
+void ima_adpcm_decode_header(ImaAdpcmChannel* state, uint16_t channels,
+                             const uint8_t* src, int16_t* dst);
+
+// Decodes `groups` group units into 8 * `groups` interleaved 16-bit stereo
+// frames. Integer only; one call per contiguous run keeps the per-sample
+// work to the nibble update itself.
+void ima_adpcm_decode_groups(ImaAdpcmChannel* state, uint16_t channels,
+                             const uint8_t* src, size_t groups, int16_t* dst);
+
+#endif // IMA_ADPCM_H
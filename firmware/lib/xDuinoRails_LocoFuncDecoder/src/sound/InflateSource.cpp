@@ -0,0 +1,133 @@
+#include "InflateSource.h"
+#include <string.h>
+
+InflateSource::InflateSource()
+    : _status(TINFL_STATUS_DONE), _window_ofs(0), _pending_ofs(0), _pending(0),
+      _input_pos(0), _input_len(0),
+      _mem_data(nullptr), _offset(0), _compressed_length(0), _compressed_read(0),
+      _uncompressed_length(0), _position(0), _is_open(false),
+      _inflate_us(0), _inflated_bytes(0) {
+}
+
+InflateSource::~InflateSource() {
+    close();
+}
+
+bool InflateSource::open(File file, uint32_t offset, uint32_t compressed_length, uint32_t uncompressed_length) {
+    close();
+    if (!file) return false;
+    _file = file;
+    _offset = offset;
+    _compressed_length = compressed_length;
+    _uncompressed_length = uncompressed_length;
+    _inflate_us = 0;
+    _inflated_bytes = 0;
+    _is_open = restart();
+    return _is_open;
+}
+
+bool InflateSource::open(const uint8_t* data, uint32_t compressed_length, uint32_t uncompressed_length) {
+    close();
+    if (!data) return false;
+    _mem_data = data;
+    _offset = 0;
+    _compressed_length = compressed_length;
+    _uncompressed_length = uncompressed_length;
+    _inflate_us = 0;
+    _inflated_bytes = 0;
+    _is_open = restart();
+    return _is_open;
+}
+
+void InflateSource::close() {
+    if (_file) {
+        _file.close();
+    }
+    _mem_data = nullptr;
+    _is_open = false;
+}
+
+bool InflateSource::restart() {
+    tinfl_init(&_inflator);
+    _status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    _window_ofs = 0;
+    _pending_ofs = 0;
+    _pending = 0;
+    _input_pos = 0;
+    _input_len = 0;
+    _compressed_read = 0;
+    _position = 0;
+    if (_mem_data) return true;
+    return _file.seek(_offset);
+}
+
+bool InflateSource::inflate_more() {
+    if (_status == TINFL_STATUS_DONE || _status < 0) return false;
+
+    // Refill the input buffer once the decompressor has consumed it.
+    if (_input_pos == _input_len && _compressed_read < _compressed_length) {
+        size_t want = _compressed_length - _compressed_read;
+        if (want > sizeof(_input)) want = sizeof(_input);
+        if (_mem_data) {
+            memcpy(_input, _mem_data + _compressed_read, want);
+            _input_len = want;
+        } else {
+            _input_len = _file.read(_input, want);
+        }
+        _input_pos = 0;
+        _compressed_read += _input_len;
+        if (_input_len == 0) {
+            _status = TINFL_STATUS_FAILED;
+            return false;
+        }
+    }
+
+    size_t in_bytes = _input_len - _input_pos;
+    size_t out_bytes = TINFL_LZ_DICT_SIZE - _window_ofs;
+    mz_uint32 flags = (_compressed_read < _compressed_length) ? TINFL_FLAG_HAS_MORE_INPUT : 0;
+
+    uint32_t start = micros();
+    _status = tinfl_decompress(&_inflator, _input + _input_pos, &in_bytes,
+                               _window, _window + _window_ofs, &out_bytes, flags);
+    _inflate_us += micros() - start;
+
+    _input_pos += in_bytes;
+    _pending_ofs = _window_ofs;
+    _pending = out_bytes;
+    _window_ofs = (_window_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+    _inflated_bytes += out_bytes;
+
+    if (_status < 0) return false;
+    // No progress at all means truncated input; avoid spinning on it.
+    return out_bytes > 0 || in_bytes > 0;
+}
+
+size_t InflateSource::read(uint8_t* dst, size_t len) {
+    if (!_is_open) return 0;
+
+    size_t done = 0;
+    while (done < len && _position < _uncompressed_length) {
+        // The window is only written once its pending bytes are used up, so
+        // the decompressor never overwrites data that has not been read.
+        if (_pending == 0) {
+            if (!inflate_more()) break;
+            continue;
+        }
+        size_t n = len - done;
+        if (n > _pending) n = _pending;
+        if (dst) memcpy(dst + done, _window + _pending_ofs, n);
+        _pending_ofs += n;
+        _pending -= n;
+        _position += n;
+        done += n;
+    }
+    return done;
+}
+
+bool InflateSource::seek(size_t pos) {
+    if (!_is_open || pos > _uncompressed_length) return false;
+    if (pos < _position && !restart()) return false;
+    // DEFLATE has no random access: decode and discard up to the target.
+    size_t skip = pos - _position;
+    return read(nullptr, skip) == skip;
+}
@@ -0,0 +1,81 @@
+#ifndef INFLATE_SOURCE_H
+#define INFLATE_SOURCE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "miniz.h"
+
+// Compressed bytes fetched from the archive per file read.
+#define INFLATE_SOURCE_INPUT_SIZE 512
+
+/**
+ * @class InflateSource
+ * @brief Decompresses a raw DEFLATE stream (a compressed VSD zip entry) on the fly.
+ *
+ * Uses miniz's streaming `tinfl` decompressor with a wrapping 32 KB dictionary
+ * window, so the RAM cost per voice is fixed (about 41 KB) no matter how large
+ * the entry is. Decoded bytes are served straight out of the window.
+ *
+ * Sources are allocated once and handed out by VSDReader; a WAVStream returns
+ * its source by calling close().
+ */
+class InflateSource {
+public:
+    InflateSource();
+    ~InflateSource();
+
+    // Opens a compressed entry inside `file`. `offset` and `compressed_length`
+    // locate the DEFLATE data, `uncompressed_length` is the decoded size.
+    bool open(File file, uint32_t offset, uint32_t compressed_length, uint32_t uncompressed_length);
+
+    // Opens a compressed entry held in memory. The data is not copied.
+    bool open(const uint8_t* data, uint32_t compressed_length, uint32_t uncompressed_length);
+
+    // Releases the file handle and marks the source as free.
+    void close();
+
+    bool is_open() const { return _is_open; }
+
+    // Reads up to `len` decoded bytes. Returns fewer at the end of the entry.
+    size_t read(uint8_t* dst, size_t len);
+
+    // Moves to decoded position `pos`. Seeking backwards restarts the
+    // decompressor from the beginning of the entry.
+    bool seek(size_t pos);
+
+    size_t size() const { return _uncompressed_length; }
+
+    // --- Instrumentation ---
+    // Time spent inside tinfl_decompress() and bytes it produced since open().
+    uint32_t get_inflate_us() const { return _inflate_us; }
+    uint32_t get_inflated_bytes() const { return _inflated_bytes; }
+
+private:
+    bool restart();
+    bool inflate_more();
+
+    tinfl_decompressor _inflator;
+    tinfl_status _status;
+    uint8_t _window[TINFL_LZ_DICT_SIZE];
+    size_t _window_ofs;   // Next write position of the decompressor
+    size_t _pending_ofs;  // Decoded bytes not yet handed out start here...
+    size_t _pending;      // ...and this many of them are available
+
+    uint8_t _input[INFLATE_SOURCE_INPUT_SIZE];
+    size_t _input_pos;
+    size_t _input_len;
+
+    File _file;
+    const uint8_t* _mem_data;
+    uint32_t _offset;
+    uint32_t _compressed_length;
+    uint32_t _compressed_read;
+    uint32_t _uncompressed_length;
+    size_t _position; // Decoded bytes handed out so far
+    bool _is_open;
+
+    uint32_t _inflate_us;
+    uint32_t _inflated_bytes;
+};
+
+#endif // INFLATE_SOURCE_H
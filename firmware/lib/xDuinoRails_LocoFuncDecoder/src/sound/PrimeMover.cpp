@@ -0,0 +1,184 @@
+#include "PrimeMover.h"
+
+// sin(pi/2 * k / 32) in Q15. A voice fading in at entry k and one fading out
+// at entry 32 - k always sum to the same power, so the engine keeps its
+// loudness through a notch change however unrelated the two loops are.
+static const uint16_t crossfade_table[PRIME_MOVER_CROSSFADE_STEPS] = {
+    0, 1608, 3212, 4808, 6393, 7962, 9512, 11039, 12540, 14010, 15447,
+    16846, 18205, 19520, 20788, 22006, 23170, 24279, 25330, 26320, 27246,
+    28106, 28899, 29622, 30274, 30853, 31357, 31786, 32138, 32413, 32610,
+    32729, 32768
+};
+
+// Crossfade gain at `pos` (Q8 table entries), interpolated between entries.
+static inline uint32_t crossfade_at(uint32_t pos) {
+    uint32_t index = pos >> 8;
+    if (index >= PRIME_MOVER_CROSSFADE_STEPS - 1) return crossfade_table[PRIME_MOVER_CROSSFADE_STEPS - 1];
+    uint32_t a = crossfade_table[index];
+    uint32_t b = crossfade_table[index + 1];
+    return a + (((b - a) * (pos & 0xFF)) >> 8);
+}
+
+PrimeMover::PrimeMover(SoftwareMixer& mixer)
+    : _mixer(mixer), _opener(nullptr), _opener_context(nullptr),
+      _notch_count(0), _gain(MIXER_GAIN_UNITY), _crossfade_frames(0),
+      _target_speed(0), _external_load(0), _train_speed(0), _last_update(0),
+      _running(false), _notch(0), _tag(PRIME_MOVER_TAG_A), _stream(nullptr),
+      _crossfading(false), _next_notch(0), _next_stream(nullptr), _fade_start(0) {
+    setCrossfadeTime(PRIME_MOVER_CROSSFADE_MS);
+}
+
+void PrimeMover::setOpener(SoundOpener opener, void* context) {
+    _opener = opener;
+    _opener_context = context;
+}
+
+void PrimeMover::setNotches(const uint8_t* sound_ids, uint8_t count) {
+    stop(0);
+    if (count > PRIME_MOVER_MAX_NOTCHES) count = PRIME_MOVER_MAX_NOTCHES;
+    memcpy(_notches, sound_ids, count);
+    _notch_count = count;
+}
+
+bool PrimeMover::hasSound(uint8_t sound_id) const {
+    for (uint8_t i = 0; i < _notch_count; i++) {
+        if (_notches[i] == sound_id) return true;
+    }
+    return false;
+}
+
+void PrimeMover::setCrossfadeTime(uint16_t ms) {
+    _crossfade_frames = (uint32_t)ms * MIXER_OUTPUT_RATE / 1000;
+    if (_crossfade_frames < MIXER_BLOCK_FRAMES) _crossfade_frames = MIXER_BLOCK_FRAMES;
+}
+
+void PrimeMover::setGain(uint16_t gain) {
+    _gain = gain > MIXER_GAIN_UNITY ? MIXER_GAIN_UNITY : gain;
+    if (_running && !_crossfading) {
+        _mixer.setGain(_tag, _gain);
+    }
+}
+
+uint8_t PrimeMover::getLoad() const {
+    uint32_t target = (uint32_t)_target_speed << 8;
+    uint32_t load = 0;
+    if (target > _train_speed) {
+        load = ((target - _train_speed) >> 8) * PRIME_MOVER_LOAD_GAIN;
+        if (load > 255) load = 255;
+    }
+    return load > _external_load ? (uint8_t)load : _external_load;
+}
+
+uint8_t PrimeMover::getTargetNotch() const {
+    if (_notch_count == 0) return 0;
+    // Load pushes the demand from the target speed towards full power.
+    uint32_t speed = _target_speed;
+    uint32_t demand = speed + (((255 - speed) * getLoad()) >> 8);
+    return (uint8_t)((demand * (_notch_count - 1) + 127) / 255);
+}
+
+uint16_t PrimeMover::crossfadeGain(uint8_t step) {
+    if (step >= PRIME_MOVER_CROSSFADE_STEPS) step = PRIME_MOVER_CROSSFADE_STEPS - 1;
+    return crossfade_table[step];
+}
+
+WAVStream* PrimeMover::open_notch(uint8_t notch) {
+    if (!_opener || notch >= _notch_count) return nullptr;
+    WAVStream* stream = _opener(_opener_context, _notches[notch]);
+    if (stream) stream->setLooping(true);
+    return stream;
+}
+
+void PrimeMover::start() {
+    if (_running || _notch_count == 0) return;
+    WAVStream* stream = open_notch(0);
+    if (!stream) return;
+    _notch = 0;
+    _tag = PRIME_MOVER_TAG_A;
+    _stream = stream;
+    _crossfading = false;
+    _mixer.play(stream, _tag, _gain);
+    _running = true;
+}
+
+void PrimeMover::stop(uint16_t fade_ms) {
+    if (!_running) return;
+    if (fade_ms) {
+        _mixer.fadeOut(PRIME_MOVER_TAG_A, fade_ms);
+        _mixer.fadeOut(PRIME_MOVER_TAG_B, fade_ms);
+    } else {
+        _mixer.stop(PRIME_MOVER_TAG_A);
+        _mixer.stop(PRIME_MOVER_TAG_B);
+    }
+    _running = false;
+    _crossfading = false;
+    _stream = nullptr;
+    _next_stream = nullptr;
+}
+
+bool PrimeMover::can_overlap(const WAVStream* a, const WAVStream* b) const {
+    uint32_t bytes = (a->get_byte_rate() + b->get_byte_rate()) * (uint64_t)MIXER_BLOCK_FRAMES / MIXER_OUTPUT_RATE;
+    return bytes <= _mixer.getRefillBudget();
+}
+
+void PrimeMover::follow_speed(uint32_t frames) {
+    uint32_t target = (uint32_t)_target_speed << 8;
+    uint32_t step = (uint32_t)(((uint64_t)PRIME_MOVER_MOMENTUM * frames << 8) / MIXER_OUTPUT_RATE);
+    if (_train_speed < target) {
+        _train_speed = (target - _train_speed > step) ? _train_speed + step : target;
+    } else {
+        _train_speed = (_train_speed - target > step) ? _train_speed - step : target;
+    }
+}
+
+void PrimeMover::step_crossfade(uint32_t now) {
+    uint32_t elapsed = now - _fade_start;
+    if (elapsed >= _crossfade_frames) {
+        // Done: the old notch goes, the new one plays on at full gain.
+        _mixer.stop(_tag);
+        _tag = other_tag();
+        _stream = _next_stream;
+        _next_stream = nullptr;
+        _notch = _next_notch;
+        _crossfading = false;
+        _mixer.setGain(_tag, _gain);
+        return;
+    }
+    uint32_t pos = (uint32_t)(((uint64_t)elapsed * (PRIME_MOVER_CROSSFADE_STEPS - 1) << 8) / _crossfade_frames);
+    uint32_t mirrored = ((PRIME_MOVER_CROSSFADE_STEPS - 1) << 8) - pos;
+    _mixer.setGain(_tag, scaled(crossfade_at(mirrored)));
+    _mixer.setGain(other_tag(), scaled(crossfade_at(pos)));
+}
+
+void PrimeMover::update() {
+    uint32_t now = _mixer.getFrameTime();
+    follow_speed(now - _last_update);
+    _last_update = now;
+    if (!_running) return;
+
+    if (_crossfading) {
+        step_crossfade(now);
+        return;
+    }
+
+    uint8_t target = getTargetNotch();
+    if (target == _notch) return;
+    uint8_t next = target > _notch ? _notch + 1 : _notch - 1;
+    WAVStream* stream = open_notch(next);
+    if (!stream) return; // Try again on the next update
+
+    if (!_stream || !can_overlap(_stream, stream)) {
+        // Two loops would not keep up: switch over directly.
+        _mixer.stop(_tag);
+        _mixer.play(stream, _tag, _gain);
+        _stream = stream;
+        _notch = next;
+        return;
+    }
+
+    _mixer.play(stream, other_tag(), 0);
+    _next_stream = stream;
+    _next_notch = next;
+    _fade_start = now;
+    _crossfading = true;
+}
@@ -0,0 +1,130 @@
+#ifndef PRIME_MOVER_H
+#define PRIME_MOVER_H
+
+#include <Arduino.h>
+#include "SoftwareMixer.h"
+
+#define PRIME_MOVER_MAX_NOTCHES 8
+
+// Mixer tags of the two notch voices. Sound IDs, which tag all other
+// voices, stay below VSD_MAX_SOUNDS.
+#define PRIME_MOVER_TAG_A 0xF0
+#define PRIME_MOVER_TAG_B 0xF1
+
+// Entries of the equal-power crossfade table, from silent to full gain.
+#define PRIME_MOVER_CROSSFADE_STEPS 33
+
+// Default time for one notch change.
+#define PRIME_MOVER_CROSSFADE_MS 500
+
+// Speed steps per second the simulated train speed follows the target
+// speed with. While it lags behind, the engine works against a load.
+#define PRIME_MOVER_MOMENTUM 64
+
+// Load per speed step the simulated train speed lags behind the target.
+#define PRIME_MOVER_LOAD_GAIN 4
+
+// Acquires a voice of priority PRIME_MOVER and starts sound `sound_id` on
+// it, returning nullptr if that is not possible.
+typedef WAVStream* (*SoundOpener)(void* context, uint8_t sound_id);
+
+/**
+ * @class PrimeMover
+ * @brief Diesel engine sound made of looped notch samples.
+ *
+ * The engine plays one notch loop at a time. When the notch demanded by the
+ * target speed and load changes, the next notch up or down is started
+ * silently and crossfaded in along an equal-power curve while the current
+ * one fades out, one notch per crossfade. Only during a crossfade do two
+ * notch loops stream at once, and only if the mixer's refill budget covers
+ * both; otherwise the notches are switched over directly.
+ *
+ * Runs on the audio core: update() is called once per audio loop, before
+ * the mixer renders, and times itself by the mixer's frame clock.
+ */
+class PrimeMover {
+public:
+    explicit PrimeMover(SoftwareMixer& mixer);
+
+    // Sets how notch sounds are opened (see AudioEngine).
+    void setOpener(SoundOpener opener, void* context);
+
+    // Sets the notch loops by sound ID, idle first. Stops the engine.
+    void setNotches(const uint8_t* sound_ids, uint8_t count);
+    uint8_t getNotchCount() const { return _notch_count; }
+
+    // True if `sound_id` is one of the notch loops.
+    bool hasSound(uint8_t sound_id) const;
+
+    // Sets the time one notch change takes.
+    void setCrossfadeTime(uint16_t ms);
+
+    // Sets the engine volume (Q15, see MIXER_GAIN_UNITY).
+    void setGain(uint16_t gain);
+
+    // Sets the motor target speed (0-255) and an external load (0-255),
+    // e.g. from motor current. The larger of the external load and the
+    // simulated acceleration load is used.
+    void setSpeed(uint8_t speed) { _target_speed = speed; }
+    void setLoad(uint8_t load) { _external_load = load; }
+
+    // Starts the engine at idle, or fades it out over `fade_ms`.
+    void start();
+    void stop(uint16_t fade_ms);
+
+    bool isRunning() const { return _running; }
+    bool isCrossfading() const { return _crossfading; }
+
+    // The notch playing, or being crossfaded to.
+    uint8_t getNotch() const { return _crossfading ? _next_notch : _notch; }
+
+    // The notch the current speed and load call for.
+    uint8_t getTargetNotch() const;
+
+    // Current load, simulated or external (0-255).
+    uint8_t getLoad() const;
+
+    // Advances the simulated train speed and any crossfade, and starts the
+    // next notch change when one is due.
+    void update();
+
+    // Gain (Q15) of the fading-in voice at `step` of the crossfade table;
+    // the fading-out voice uses the mirrored entry.
+    static uint16_t crossfadeGain(uint8_t step);
+
+private:
+    WAVStream* open_notch(uint8_t notch);
+    uint8_t other_tag() const { return _tag == PRIME_MOVER_TAG_A ? PRIME_MOVER_TAG_B : PRIME_MOVER_TAG_A; }
+    uint16_t scaled(uint32_t gain) const { return (uint16_t)((gain * _gain) >> 15); }
+
+    // True if the refill budget covers two notch loops streaming at once.
+    bool can_overlap(const WAVStream* a, const WAVStream* b) const;
+
+    void follow_speed(uint32_t frames);
+    void step_crossfade(uint32_t now);
+
+    SoftwareMixer& _mixer;
+    SoundOpener _opener;
+    void* _opener_context;
+
+    uint8_t _notches[PRIME_MOVER_MAX_NOTCHES];
+    uint8_t _notch_count;
+    uint16_t _gain;
+    uint32_t _crossfade_frames;
+
+    uint8_t _target_speed;
+    uint8_t _external_load;
+    uint32_t _train_speed; // Simulated train speed, Q8
+    uint32_t _last_update; // Mixer frame time of the last update()
+
+    bool _running;
+    uint8_t _notch;
+    uint8_t _tag;          // Tag of the notch playing
+    WAVStream* _stream;    // Its voice
+    bool _crossfading;
+    uint8_t _next_notch;
+    WAVStream* _next_stream;
+    uint32_t _fade_start;  // Mixer frame time the crossfade started
+};
+
+#endif // PRIME_MOVER_H
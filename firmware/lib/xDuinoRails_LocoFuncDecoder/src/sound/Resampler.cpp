@@ -0,0 +1,94 @@
+#include "Resampler.h"
+#include <string.h>
+
+// Windowed sinc (Blackman, cut off at 0.45 of the source rate), one row of
+// Q15 coefficients per phase. Every row sums to exactly 32768, so DC passes
+// at unity gain.
+static const int16_t polyphase_table[RESAMPLER_PHASES][RESAMPLER_TAPS] = {
+    {    187,  -1042,   2493,  29492,   2493,  -1042,    187,      0 },
+    {    160,   -865,   1723,  29446,   3315,  -1226,    215,      0 },
+    {    135,   -697,   1006,  29310,   4187,  -1416,    244,     -1 },
+    {    112,   -538,    344,  29082,   5105,  -1610,    274,     -1 },
+    {     91,   -390,   -263,  28767,   6067,  -1806,    304,     -2 },
+    {     72,   -252,   -813,  28364,   7069,  -2003,    335,     -4 },
+    {     55,   -126,  -1307,  27876,   8107,  -2197,    365,     -5 },
+    {     39,    -12,  -1746,  27312,   9176,  -2388,    394,     -7 },
+    {     26,     90,  -2130,  26668,  10272,  -2571,    422,     -9 },
+    {     15,    181,  -2461,  25951,  11390,  -2744,    447,    -11 },
+    {      5,    260,  -2739,  25166,  12524,  -2905,    470,    -13 },
+    {     -2,    327,  -2967,  24318,  13668,  -3051,    490,    -15 },
+    {     -9,    383,  -3147,  23414,  14817,  -3178,    505,    -17 },
+    {    -13,    429,  -3281,  22455,  15964,  -3283,    515,    -18 },
+    {    -17,    464,  -3372,  21454,  17103,  -3363,    519,    -20 },
+    {    -19,    490,  -3423,  20410,  18228,  -3415,    517,    -20 },
+    {    -20,    508,  -3436,  19331,  19333,  -3436,    508,    -20 },
+    {    -20,    517,  -3415,  18228,  20410,  -3423,    490,    -19 },
+    {    -20,    519,  -3363,  17103,  21454,  -3372,    464,    -17 },
+    {    -18,    515,  -3283,  15964,  22455,  -3281,    429,    -13 },
+    {    -17,    505,  -3178,  14817,  23414,  -3147,    383,     -9 },
+    {    -15,    490,  -3051,  13668,  24318,  -2967,    327,     -2 },
+    {    -13,    470,  -2905,  12524,  25166,  -2739,    260,      5 },
+    {    -11,    447,  -2744,  11390,  25951,  -2461,    181,     15 },
+    {     -9,    422,  -2571,  10272,  26668,  -2130,     90,     26 },
+    {     -7,    394,  -2388,   9176,  27312,  -1746,    -12,     39 },
+    {     -5,    365,  -2197,   8107,  27876,  -1307,   -126,     55 },
+    {     -4,    335,  -2003,   7069,  28364,   -813,   -252,     72 },
+    {     -2,    304,  -1806,   6067,  28767,   -263,   -390,     91 },
+    {     -1,    274,  -1610,   5105,  29082,    344,   -538,    112 },
+    {     -1,    244,  -1416,   4187,  29310,   1006,   -697,    135 },
+    {      0,    215,  -1226,   3315,  29446,   1723,   -865,    160 },
+};
+
+static inline int16_t saturate_tap_sum(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)v;
+}
+
+void ResamplerState::reset() {
+    phase = (RESAMPLER_TAPS - RESAMPLER_CENTER) << 16;
+    memset(history, 0, sizeof(history));
+}
+
+void ResamplerState::resume(const int16_t* last, size_t frames) {
+    phase = (RESAMPLER_TAPS - RESAMPLER_CENTER) << 16;
+    if (frames >= RESAMPLER_TAPS) {
+        memcpy(history, last + (frames - RESAMPLER_TAPS) * 2, sizeof(history));
+        return;
+    }
+    // A short segment, e.g. up to an event frame: shift in its frames.
+    size_t kept = RESAMPLER_TAPS - frames;
+    memmove(history, history + frames * 2, kept * 2 * sizeof(int16_t));
+    memcpy(history + kept * 2, last, frames * 2 * sizeof(int16_t));
+}
+
+uint32_t resample_linear(const int16_t* src, uint32_t phase, uint32_t step, int16_t* dst, size_t frames) {
+    src += RESAMPLER_CENTER * 2;
+    for (size_t n = 0; n < frames; n++) {
+        const int16_t* s = src + (phase >> 16) * 2;
+        int32_t frac = (phase & 0xFFFF) >> 1; // Q15
+        dst[0] = (int16_t)(s[0] + (((s[2] - s[0]) * frac) >> 15));
+        dst[1] = (int16_t)(s[1] + (((s[3] - s[1]) * frac) >> 15));
+        dst += 2;
+        phase += step;
+    }
+    return phase;
+}
+
+uint32_t resample_polyphase(const int16_t* src, uint32_t phase, uint32_t step, int16_t* dst, size_t frames) {
+    for (size_t n = 0; n < frames; n++) {
+        const int16_t* s = src + (phase >> 16) * 2;
+        const int16_t* c = polyphase_table[(phase >> 11) & (RESAMPLER_PHASES - 1)];
+        int32_t left = 1 << 14;
+        int32_t right = 1 << 14;
+        for (int t = 0; t < RESAMPLER_TAPS; t++) {
+            left += c[t] * s[t * 2];
+            right += c[t] * s[t * 2 + 1];
+        }
+        dst[0] = saturate_tap_sum(left >> 15);
+        dst[1] = saturate_tap_sum(right >> 15);
+        dst += 2;
+        phase += step;
+    }
+    return phase;
+}
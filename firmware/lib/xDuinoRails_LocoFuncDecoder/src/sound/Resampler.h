@@ -0,0 +1,53 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <Arduino.h>
+
+// Source frames kept between blocks. The kernels read around position
+// `i = RESAMPLER_CENTER + (phase >> 16)`: linear uses frames i and i + 1,
+// the polyphase filter frames i - 3 to i + 4.
+#define RESAMPLER_TAPS 8
+#define RESAMPLER_CENTER 3
+#define RESAMPLER_PHASES 32
+
+// Positions and steps are in source frames, Q16.16.
+#define RESAMPLER_UNITY_STEP 0x10000UL
+#define RESAMPLER_MAX_STEP (4 * RESAMPLER_UNITY_STEP)
+
+enum class ResampleQuality : uint8_t {
+    LINEAR,   // 2-point linear interpolation
+    POLYPHASE // 8-tap windowed sinc, 32 phases, cut off at 0.45 of the source rate
+};
+
+/**
+ * @struct ResamplerState
+ * @brief Per-voice resampler state: the fractional read position and the
+ *        last RESAMPLER_TAPS source frames, so blocks join seamlessly.
+ */
+struct ResamplerState {
+    uint32_t phase;
+    int16_t history[RESAMPLER_TAPS * 2];
+
+    // Starts with silent history, positioned so the first output frame is
+    // the first source frame.
+    void reset();
+
+    // Continues from a voice that played without resampling until now;
+    // `last` holds the `frames` output frames it played since the previous
+    // call. Fewer than RESAMPLER_TAPS are appended to the history.
+    void resume(const int16_t* last, size_t frames);
+};
+
+// Number of new source frames a block of `frames` output frames consumes.
+// The caller places them after the history, i.e. the kernels read from a
+// buffer of RESAMPLER_TAPS + this many frames.
+inline size_t resampler_source_frames(uint32_t phase, uint32_t step, size_t frames) {
+    return (phase + frames * step) >> 16;
+}
+
+// Renders `frames` interleaved stereo frames from `src` (history followed by
+// the new source frames) and returns the read position after the block.
+uint32_t resample_linear(const int16_t* src, uint32_t phase, uint32_t step, int16_t* dst, size_t frames);
+uint32_t resample_polyphase(const int16_t* src, uint32_t phase, uint32_t step, int16_t* dst, size_t frames);
+
+#endif // RESAMPLER_H
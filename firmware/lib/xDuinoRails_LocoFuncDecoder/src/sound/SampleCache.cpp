@@ -0,0 +1,118 @@
+#include "SampleCache.h"
+
+SampleCache::SampleCache()
+    : _capacity((size_t)SAMPLE_CACHE_DEFAULT_KB * 1024), _used(0),
+      _policy(SampleCachePolicy::LRU), _use_clock(0), _evictions(0) {
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES; i++) {
+        _entries[i].data = nullptr;
+    }
+}
+
+SampleCache::~SampleCache() {
+    clear();
+}
+
+void SampleCache::set_capacity_kb(uint16_t kb) {
+    _capacity = (size_t)kb * 1024;
+    while (_used > _capacity) {
+        int index = victim();
+        if (index < 0) break; // The rest goes as its voices end
+        remove(index);
+        _evictions++;
+    }
+}
+
+bool SampleCache::accepts(size_t size) const {
+    return size <= SAMPLE_CACHE_MAX_SAMPLE_BYTES && size <= _capacity;
+}
+
+int SampleCache::find(uint8_t sound_id) const {
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES; i++) {
+        if (_entries[i].data && _entries[i].sound_id == sound_id) return i;
+    }
+    return -1;
+}
+
+SharedSource* SampleCache::acquire(uint8_t sound_id) {
+    int index = find(sound_id);
+    if (index < 0) return nullptr;
+    Entry& entry = _entries[index];
+    entry.last_used = ++_use_clock;
+    entry.uses++;
+    entry.source.retain();
+    return &entry.source;
+}
+
+int SampleCache::victim() const {
+    int best = -1;
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES; i++) {
+        const Entry& entry = _entries[i];
+        if (!entry.data || entry.source.get_refs() > 0) continue;
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        const Entry& other = _entries[best];
+        if (_policy == SampleCachePolicy::LFU && entry.uses != other.uses) {
+            if (entry.uses < other.uses) best = i;
+        } else if (entry.last_used < other.last_used) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+void SampleCache::remove(int index) {
+    Entry& entry = _entries[index];
+    entry.source.close();
+    free(entry.data);
+    entry.data = nullptr;
+    _used -= entry.size;
+}
+
+bool SampleCache::insert(uint8_t sound_id, uint8_t* data, size_t size, bool evict) {
+    if (!data || !accepts(size) || find(sound_id) >= 0) {
+        free(data);
+        return false;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES && slot < 0; i++) {
+        if (!_entries[i].data) slot = i;
+    }
+    while (evict && (slot < 0 || _used + size > _capacity)) {
+        int index = victim();
+        if (index < 0) break;
+        remove(index);
+        _evictions++;
+        if (slot < 0) slot = index;
+    }
+    if (slot < 0 || _used + size > _capacity) {
+        free(data);
+        return false;
+    }
+
+    Entry& entry = _entries[slot];
+    entry.sound_id = sound_id;
+    entry.data = data;
+    entry.size = size;
+    entry.last_used = ++_use_clock;
+    entry.uses = 0;
+    entry.source.open(data, (uint32_t)size);
+    _used += size;
+    return true;
+}
+
+void SampleCache::clear() {
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES; i++) {
+        if (_entries[i].data) remove(i);
+    }
+}
+
+uint8_t SampleCache::get_entry_count() const {
+    uint8_t count = 0;
+    for (int i = 0; i < SAMPLE_CACHE_MAX_ENTRIES; i++) {
+        if (_entries[i].data) count++;
+    }
+    return count;
+}
@@ -0,0 +1,88 @@
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include <Arduino.h>
+#include "AssetCache.h"
+
+// Sounds that can be resident at the same time.
+#define SAMPLE_CACHE_MAX_ENTRIES 16
+
+// Largest sound kept resident, as a complete WAV image.
+#define SAMPLE_CACHE_MAX_SAMPLE_BYTES 16384
+
+// RAM given to the cache unless configured otherwise, in KB.
+#define SAMPLE_CACHE_DEFAULT_KB 32
+
+// Which resident sound makes room for a new one.
+enum class SampleCachePolicy : uint8_t {
+    LRU, // The one triggered longest ago
+    LFU  // The one triggered least often, then longest ago
+};
+
+/**
+ * @class SampleCache
+ * @brief Keeps short one-shot sounds fully in RAM within a byte budget.
+ *
+ * A resident sound is a complete WAV image on the heap behind a memory
+ * SharedSource, so playing it never touches the filesystem. Voices hold a
+ * reference on the source while they play; a sound only gives up its RAM
+ * once no voice plays it any more. Audio core only.
+ */
+class SampleCache {
+public:
+    SampleCache();
+    ~SampleCache();
+
+    // Sets the RAM budget in KB, evicting idle sounds down to it.
+    void set_capacity_kb(uint16_t kb);
+    size_t get_capacity() const { return _capacity; }
+
+    void set_policy(SampleCachePolicy policy) { _policy = policy; }
+
+    // True if a sound of `size` bytes is short enough to be cached.
+    bool accepts(size_t size) const;
+
+    // Returns the resident source of `sound_id` with a reference taken,
+    // or nullptr if the sound is not resident.
+    SharedSource* acquire(uint8_t sound_id);
+
+    // True if `sound_id` is resident.
+    bool contains(uint8_t sound_id) const { return find(sound_id) >= 0; }
+
+    // Makes `data`, a malloc()ed WAV image of sound `sound_id`, resident and
+    // takes ownership of it. Evicts idle sounds to make room if `evict`,
+    // otherwise only uses free space. Returns false, freeing `data`, if the
+    // sound does not fit.
+    bool insert(uint8_t sound_id, uint8_t* data, size_t size, bool evict = true);
+
+    // Frees every sound. Sources still referenced must not be used after.
+    void clear();
+
+    size_t get_used_bytes() const { return _used; }
+    uint8_t get_entry_count() const;
+    uint32_t get_evictions() const { return _evictions; }
+
+private:
+    int find(uint8_t sound_id) const;
+    // Picks the idle entry to evict under the policy, or -1.
+    int victim() const;
+    void remove(int index);
+
+    struct Entry {
+        uint8_t sound_id;
+        uint8_t* data; // nullptr if the entry is free
+        size_t size;
+        uint32_t last_used;
+        uint32_t uses;
+        SharedSource source;
+    };
+
+    Entry _entries[SAMPLE_CACHE_MAX_ENTRIES];
+    size_t _capacity;
+    size_t _used;
+    SampleCachePolicy _policy;
+    uint32_t _use_clock;
+    uint32_t _evictions;
+};
+
+#endif // SAMPLE_CACHE_H
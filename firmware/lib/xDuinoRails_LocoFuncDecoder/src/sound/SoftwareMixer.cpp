@@ -1,74 +1,612 @@
 #include "SoftwareMixer.h"
 
-SoftwareMixer::SoftwareMixer(SoundController& soundController) : _soundController(soundController) {
+// --- Mixing Kernels ---
+// These run once per channel per block, so they are kept branch-free and
+// unrolled by four to keep the Cortex-M0+ pipeline busy.
+
+static inline void load_block(int32_t* acc, const int16_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc[i] = src[i];
+        acc[i + 1] = src[i + 1];
+        acc[i + 2] = src[i + 2];
+        acc[i + 3] = src[i + 3];
+    }
+    for (; i < count; ++i) acc[i] = src[i];
+}
+
+static inline void accumulate_block(int32_t* acc, const int16_t* src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc[i] += src[i];
+        acc[i + 1] += src[i + 1];
+        acc[i + 2] += src[i + 2];
+        acc[i + 3] += src[i + 3];
+    }
+    for (; i < count; ++i) acc[i] += src[i];
+}
+
+// Gain variants: `gain` moves linearly to `target` across the block, both
+// Q15. The ramp is kept with 8 extra fraction bits so it ends within a
+// fraction of a step of the target, where the next block picks up.
+static inline void load_block_gain(int32_t* acc, const int16_t* src, size_t frames,
+                                   int32_t gain, int32_t target) {
+    int32_t g = gain << 8;
+    int32_t step = ((target - gain) << 8) / (int32_t)frames;
+    for (size_t i = 0; i < frames; ++i) {
+        g += step;
+        int32_t q = g >> 8;
+        acc[i * 2] = (src[i * 2] * q) >> 15;
+        acc[i * 2 + 1] = (src[i * 2 + 1] * q) >> 15;
+    }
+}
+
+static inline void accumulate_block_gain(int32_t* acc, const int16_t* src, size_t frames,
+                                         int32_t gain, int32_t target) {
+    int32_t g = gain << 8;
+    int32_t step = ((target - gain) << 8) / (int32_t)frames;
+    for (size_t i = 0; i < frames; ++i) {
+        g += step;
+        int32_t q = g >> 8;
+        acc[i * 2] += (src[i * 2] * q) >> 15;
+        acc[i * 2 + 1] += (src[i * 2 + 1] * q) >> 15;
+    }
+}
+
+static inline int16_t saturate16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)v;
+}
+
+// Passes levels up to the knee unchanged and bends everything above it
+// towards full scale, which it only approaches asymptotically.
+static inline int16_t soft_limit16(int32_t v) {
+    const int32_t range = 32767 - MIXER_LIMITER_KNEE;
+    if (v > MIXER_LIMITER_KNEE) {
+        int32_t excess = v - MIXER_LIMITER_KNEE;
+        return (int16_t)(MIXER_LIMITER_KNEE + excess * range / (excess + range));
+    }
+    if (v < -MIXER_LIMITER_KNEE) {
+        int32_t excess = -MIXER_LIMITER_KNEE - v;
+        return (int16_t)(-MIXER_LIMITER_KNEE - excess * range / (excess + range));
+    }
+    return (int16_t)v;
+}
+
+// Mixes `src` into `dst`, ramping from `gain` (Q15) down to silence across
+// the block. Used for the fade-out of a stolen voice.
+static inline void fade_out_block(int16_t* dst, const int16_t* src, size_t frames, int32_t gain) {
+    for (size_t i = 0; i < frames; ++i) {
+        int32_t q = gain * (int32_t)(frames - 1 - i) / (int32_t)frames;
+        dst[i * 2] = saturate16(dst[i * 2] + ((src[i * 2] * q) >> 15));
+        dst[i * 2 + 1] = saturate16(dst[i * 2 + 1] + ((src[i * 2 + 1] * q) >> 15));
+    }
+}
+
+static inline uint16_t block_peak(const int16_t* src, size_t count) {
+    int32_t peak = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int32_t v = src[i] < 0 ? -src[i] : src[i];
+        if (v > peak) peak = v;
+    }
+    return (uint16_t)peak;
+}
+
+static inline void saturate_block(int16_t* dst, const int32_t* acc, size_t count) {
+    for (size_t i = 0; i < count; ++i) dst[i] = saturate16(acc[i]);
+}
+
+static inline void limit_block(int16_t* dst, const int32_t* acc, size_t count) {
+    for (size_t i = 0; i < count; ++i) dst[i] = soft_limit16(acc[i]);
+}
+
+SoftwareMixer::SoftwareMixer(SoundController& soundController)
+    : _soundController(soundController), _pull_mode(false),
+      _resample_quality(ResampleQuality::LINEAR),
+      _master_gain(MIXER_GAIN_UNITY), _limiter(true),
+      _refill_budget(MIXER_REFILL_BUDGET_BYTES),
+      _steal_policy(StealPolicy::LOWEST_PRIORITY), _play_serial(0),
+      _steal_tail_frames(0), _render_budget_us(MIXER_RENDER_BUDGET_US), _shed_holdoff(0),
+      _frame_clock(0), _event_count(0) {
     for (int i = 0; i < MAX_CHANNELS; ++i) {
-        _channels[i].stream = nullptr;
-        _channels[i].is_active = false;
+        _channels[i].state = ChannelState::FREE;
+        _channels[i].tag = MIXER_NO_TAG;
+        _channels[i].resampling = false;
+        _channels[i].base_step = RESAMPLER_UNITY_STEP;
+        _channels[i].step = RESAMPLER_UNITY_STEP;
+        _channels[i].gain = MIXER_GAIN_UNITY;
+        _channels[i].applied_gain = MIXER_GAIN_UNITY;
+        _channels[i].fade_step = 0;
+        _channels[i].priority = VoicePriority::ONE_SHOT;
+        _channels[i].serial = 0;
+        _channels[i].level = 0;
     }
 }
 
 SoftwareMixer::~SoftwareMixer() {
+    // The voices are members and close their sources when destroyed.
+}
+
+void SoftwareMixer::begin() {
+    _event_count = 0;
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        free_channel(i);
+    }
+    _pull_mode = _soundController.setRenderCallback(&SoftwareMixer::render_callback, this);
+}
+
+void SoftwareMixer::render_callback(void* context, int16_t* out, size_t frames) {
+    SoftwareMixer* mixer = static_cast<SoftwareMixer*>(context);
+    while (frames > 0) {
+        size_t rendered = mixer->render(out, frames);
+        out += rendered * 2;
+        frames -= rendered;
+    }
+}
+
+WAVStream* SoftwareMixer::acquire(VoicePriority priority) {
+    int index = -1;
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        if (_channels[i].state == ChannelState::FREE) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0 && _steal_policy != StealPolicy::NONE) {
+        for (int i = 0; i < MAX_CHANNELS; ++i) {
+            const Channel& channel = _channels[i];
+            if (channel.state != ChannelState::ACTIVE || channel.priority > priority) continue;
+            if (index < 0 || steal_before(channel, _channels[index], _steal_policy)) {
+                index = i;
+            }
+        }
+        if (index >= 0) steal_channel(index);
+    }
+
+    // All voices are busy with more important sounds; the caller drops the sound.
+    if (index < 0) return nullptr;
+    _channels[index].state = ChannelState::ACQUIRED;
+    _channels[index].priority = priority;
+    return &_channels[index].stream;
+}
+
+bool SoftwareMixer::steal_before(const Channel& a, const Channel& b, StealPolicy policy) const {
+    bool a_fading = a.fade_step != 0;
+    bool b_fading = b.fade_step != 0;
+    if (a_fading != b_fading) return a_fading;
+    if (policy == StealPolicy::QUIETEST && a.level != b.level) {
+        return a.level < b.level;
+    }
+    if (policy == StealPolicy::LOWEST_PRIORITY && a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+    return (int32_t)(a.serial - b.serial) < 0; // Older first
+}
+
+void SoftwareMixer::steal_channel(int index) {
+    Channel& channel = _channels[index];
+    // render() moves what is left of an earlier tail to the front and leaves
+    // the rest of the buffer stale; clear it before mixing into it.
+    memset(_steal_tail + _steal_tail_frames * 2, 0,
+           (MIXER_BLOCK_FRAMES - _steal_tail_frames) * 2 * sizeof(int16_t));
+    // The tail always spans a whole block, whatever is still left of an
+    // earlier steal is mixed with it.
+    fill_channel_block(channel, _channel_block, MIXER_BLOCK_FRAMES);
+    fade_out_block(_steal_tail, _channel_block, MIXER_BLOCK_FRAMES, channel.applied_gain);
+    _steal_tail_frames = MIXER_BLOCK_FRAMES;
+    free_channel(index);
+    _soundController.getStats().recordVoiceStolen();
+}
+
+void SoftwareMixer::shed_voice() {
+    int index = -1;
     for (int i = 0; i < MAX_CHANNELS; ++i) {
-        if (_channels[i].stream) {
-            delete _channels[i].stream;
+        const Channel& channel = _channels[i];
+        if (channel.state != ChannelState::ACTIVE || channel.fade_step != 0 ||
+            channel.priority == VoicePriority::PRIME_MOVER) continue;
+        if (index < 0 || steal_before(channel, _channels[index], StealPolicy::LOWEST_PRIORITY)) {
+            index = i;
         }
     }
+    if (index < 0) return;
+
+    Channel& channel = _channels[index];
+    uint32_t step = (channel.gain + MIXER_SHED_FADE_BLOCKS - 1) / MIXER_SHED_FADE_BLOCKS;
+    channel.fade_step = step ? (uint16_t)step : 1;
+    _shed_holdoff = MIXER_SHED_FADE_BLOCKS + 1;
+    _soundController.getStats().recordVoiceShed();
 }
 
-void SoftwareMixer::begin() {
-    // Nothing to do here yet
+void SoftwareMixer::release(WAVStream* stream) {
+    int index = channel_index(stream);
+    if (index >= 0 && _channels[index].state == ChannelState::ACQUIRED) {
+        // A voice handed to playAt() is the mixer's until it plays.
+        if (is_scheduled(stream)) return;
+        free_channel(index);
+    }
+}
+
+void SoftwareMixer::play(WAVStream* stream, uint8_t tag, uint16_t gain) {
+    int index = channel_index(stream);
+    if (index >= 0 && _channels[index].state == ChannelState::ACQUIRED) {
+        Channel& channel = _channels[index];
+        uint32_t rate = stream->get_sample_rate();
+        channel.base_step = rate ? (uint32_t)(((uint64_t)rate << 16) / MIXER_OUTPUT_RATE) : RESAMPLER_UNITY_STEP;
+        if (channel.base_step > RESAMPLER_MAX_STEP) channel.base_step = RESAMPLER_MAX_STEP;
+        channel.step = channel.base_step;
+        channel.resampling = channel.step != RESAMPLER_UNITY_STEP;
+        channel.resampler.reset();
+        // The first block starts at full level; only later changes ramp.
+        channel.gain = gain;
+        channel.applied_gain = (uint16_t)(((uint32_t)gain * _master_gain) >> 15);
+        channel.fade_step = 0;
+        channel.tag = tag;
+        channel.serial = _play_serial++;
+        channel.level = 0;
+        channel.state = ChannelState::ACTIVE;
+    }
+}
+
+void SoftwareMixer::setPitch(uint8_t tag, uint16_t pitch) {
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        Channel& channel = _channels[i];
+        if (channel.state != ChannelState::ACTIVE || channel.tag != tag) continue;
+
+        uint32_t step = (uint32_t)(((uint64_t)channel.base_step * pitch) >> 8);
+        if (step > RESAMPLER_MAX_STEP) step = RESAMPLER_MAX_STEP;
+        if (step == 0) step = 1;
+        channel.step = step;
+        // A voice keeps resampling once it has started, so its read position
+        // never jumps. The history was kept up to date by the direct path.
+        channel.resampling = channel.resampling || step != RESAMPLER_UNITY_STEP;
+    }
+}
+
+void SoftwareMixer::stop(uint8_t tag) {
+    cancel_events(tag, false);
+    stop_active(tag);
+}
+
+void SoftwareMixer::stop_active(uint8_t tag) {
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        if (_channels[i].state == ChannelState::ACTIVE && _channels[i].tag == tag) {
+            free_channel(i);
+        }
+    }
+}
+
+void SoftwareMixer::stopAll() {
+    cancel_events(0, true);
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        if (_channels[i].state == ChannelState::ACTIVE) {
+            free_channel(i);
+        }
+    }
+}
+
+bool SoftwareMixer::playAt(uint32_t frame, WAVStream* stream, uint8_t tag, uint16_t gain) {
+    int index = channel_index(stream);
+    if (index < 0 || _channels[index].state != ChannelState::ACQUIRED || is_scheduled(stream)) return false;
+    Event event = { frame, Event::Type::PLAY, tag, gain, stream };
+    return schedule(event);
+}
+
+bool SoftwareMixer::stopAt(uint32_t frame, uint8_t tag) {
+    Event event = { frame, Event::Type::STOP, tag, 0, nullptr };
+    return schedule(event);
 }
 
-void SoftwareMixer::play(WAVStream* stream) {
+bool SoftwareMixer::setGainAt(uint32_t frame, uint8_t tag, uint16_t gain) {
+    Event event = { frame, Event::Type::SET_GAIN, tag, gain, nullptr };
+    return schedule(event);
+}
+
+bool SoftwareMixer::is_scheduled(const WAVStream* stream) const {
+    for (uint8_t e = 0; e < _event_count; ++e) {
+        if (_events[e].type == Event::Type::PLAY && _events[e].stream == stream) return true;
+    }
+    return false;
+}
+
+bool SoftwareMixer::schedule(const Event& event) {
+    if (_event_count == MIXER_EVENT_QUEUE_SIZE) return false;
+    // Frames are compared relative to each other, so the clock may wrap.
+    uint8_t pos = _event_count;
+    while (pos > 0 && (int32_t)(_events[pos - 1].frame - event.frame) > 0) {
+        _events[pos] = _events[pos - 1];
+        pos--;
+    }
+    _events[pos] = event;
+    _event_count++;
+    return true;
+}
+
+void SoftwareMixer::cancel_events(uint8_t tag, bool all) {
+    uint8_t kept = 0;
+    for (uint8_t e = 0; e < _event_count; ++e) {
+        const Event& event = _events[e];
+        if (!all && event.tag != tag) {
+            _events[kept++] = event;
+            continue;
+        }
+        if (event.type == Event::Type::PLAY) {
+            int index = channel_index(event.stream);
+            if (index >= 0) free_channel(index);
+        }
+    }
+    _event_count = kept;
+}
+
+void SoftwareMixer::run_due_events() {
+    while (_event_count > 0 && (int32_t)(_events[0].frame - _frame_clock) <= 0) {
+        Event event = _events[0];
+        _event_count--;
+        memmove(_events, _events + 1, _event_count * sizeof(Event));
+        switch (event.type) {
+            case Event::Type::PLAY:
+                play(event.stream, event.tag, event.gain);
+                break;
+            case Event::Type::STOP:
+                stop_active(event.tag);
+                break;
+            case Event::Type::SET_GAIN:
+                setGain(event.tag, event.gain);
+                break;
+        }
+    }
+}
+
+void SoftwareMixer::setGain(uint8_t tag, uint16_t gain) {
+    if (gain > MIXER_GAIN_UNITY) gain = MIXER_GAIN_UNITY;
     for (int i = 0; i < MAX_CHANNELS; ++i) {
-        if (!_channels[i].is_active) {
-            _channels[i].stream = stream;
-            _channels[i].is_active = true;
-            return;
+        Channel& channel = _channels[i];
+        if (channel.state == ChannelState::ACTIVE && channel.tag == tag && channel.fade_step == 0) {
+            channel.gain = gain;
+        }
+    }
+}
+
+void SoftwareMixer::fadeOut(uint8_t tag, uint16_t ms) {
+    uint32_t blocks = ((uint32_t)ms * MIXER_OUTPUT_RATE) / (1000UL * MIXER_BLOCK_FRAMES);
+    if (blocks == 0) blocks = 1;
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        Channel& channel = _channels[i];
+        if (channel.state != ChannelState::ACTIVE || channel.tag != tag || channel.fade_step != 0) continue;
+        uint32_t step = (channel.gain + blocks - 1) / blocks;
+        channel.fade_step = step ? (uint16_t)step : 1;
+    }
+}
+
+void SoftwareMixer::setMasterGain(uint16_t gain) {
+    _master_gain = gain > MIXER_GAIN_UNITY ? MIXER_GAIN_UNITY : gain;
+}
+
+void SoftwareMixer::setMasterVolume(uint8_t volume) {
+    setMasterGain((uint16_t)(((uint32_t)volume * MIXER_GAIN_UNITY + 127) / 255));
+    _soundController.setVolume(volume);
+}
+
+int SoftwareMixer::channel_index(const WAVStream* stream) const {
+    for (int i = 0; i < MAX_CHANNELS; ++i) {
+        if (&_channels[i].stream == stream) return i;
+    }
+    return -1;
+}
+
+void SoftwareMixer::free_channel(int index) {
+    // Closes the voice's file or inflate source so it can be reused.
+    _channels[index].stream.end();
+    _channels[index].state = ChannelState::FREE;
+}
+
+uint32_t SoftwareMixer::frames_to_starvation(const Channel& channel) const {
+    uint64_t frames = ((uint64_t)channel.stream.get_buffered_frames() << 16) / channel.step;
+    return frames > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)frames;
+}
+
+void SoftwareMixer::refill() {
+    SoundStats& stats = _soundController.getStats();
+    size_t budget = _refill_budget;
+    uint32_t stalled = 0; // Voices that made no progress in this call
+
+    while (budget > 0) {
+        int next = -1;
+        uint32_t next_deadline = 0xFFFFFFFF;
+        for (int i = 0; i < MAX_CHANNELS; ++i) {
+            const Channel& channel = _channels[i];
+            if (channel.state != ChannelState::ACTIVE || (stalled & (1UL << i))) continue;
+            if (!channel.stream.wants_refill() || channel.stream.get_buffer_space() < MIXER_REFILL_MIN_BYTES) continue;
+            uint32_t deadline = frames_to_starvation(channel);
+            if (next < 0 || deadline < next_deadline) {
+                next = i;
+                next_deadline = deadline;
+            }
+        }
+        if (next < 0) break; // Everything is topped up
+
+        uint32_t service_start = micros();
+        size_t read = _channels[next].stream.service(budget);
+        stats.recordServiceTime(_channels[next].tag, micros() - service_start);
+        if (read == 0) {
+            // At its end, or waiting on a loop wrap; try again next call.
+            stalled |= 1UL << next;
         }
+        budget -= read;
     }
-    // If no channels were free, the sound is dropped.
-    // We must delete the stream to avoid a memory leak.
-    delete stream;
 }
 
 void SoftwareMixer::update() {
-    // This mixing logic is simplified. A real implementation would need to handle
-    // different sample rates and bit depths, and use a more sophisticated mixing algorithm.
-    // For now, we assume all streams are 16-bit stereo at the same sample rate as the output.
+    refill();
 
-    size_t samples_to_mix = _soundController.availableForWrite() / 4; // 2 channels, 16 bits
-    if (samples_to_mix == 0) return;
+    if (_pull_mode) {
+        _soundController.render();
+        return;
+    }
+
+    size_t frames = _soundController.availableForWrite() / 4; // 2 channels, 16 bits
+    if (frames == 0) return;
+
+    frames = render(_mix_buffer, frames);
 
-    samples_to_mix = min(samples_to_mix, sizeof(_mix_buffer) / sizeof(_mix_buffer[0]) / 2);
+    // Write the mixed buffer to the sound controller
+    _soundController.write((uint8_t*)_mix_buffer, frames * 4);
+}
 
-    // Clear the mix buffer
-    memset(_mix_buffer, 0, samples_to_mix * 4);
+size_t SoftwareMixer::render(int16_t* out, size_t frames) {
+    // Bit depth and channel count are normalised to 16-bit stereo by the
+    // stream itself, sample rate and pitch by the voice's resampler.
+    if (frames > MIXER_BLOCK_FRAMES) frames = MIXER_BLOCK_FRAMES;
+
+    // Apply the events that are due and end the block at the next one, so
+    // every event takes effect on its exact frame.
+    run_due_events();
+    if (_event_count > 0) {
+        int32_t until = (int32_t)(_events[0].frame - _frame_clock);
+        if (until > 0 && (size_t)until < frames) frames = (size_t)until;
+    }
+    size_t samples = frames * 2;
+    bool accumulator_loaded = false;
+    SoundStats& stats = _soundController.getStats();
+    uint32_t block_start = micros();
+    uint8_t active_voices = 0;
+
+    // Fade-outs of voices stolen since the last block go in first.
+    if (_steal_tail_frames > 0) {
+        size_t tail = _steal_tail_frames < frames ? _steal_tail_frames : frames;
+        load_block(_accumulator, _steal_tail, tail * 2);
+        memset(_accumulator + tail * 2, 0, (samples - tail * 2) * sizeof(int32_t));
+        _steal_tail_frames -= tail;
+        memmove(_steal_tail, _steal_tail + tail * 2, _steal_tail_frames * 2 * sizeof(int16_t));
+        accumulator_loaded = true;
+    }
 
-    // Mix active channels
     for (int i = 0; i < MAX_CHANNELS; ++i) {
-        if (_channels[i].is_active) {
-            // Service the stream to refill its buffer from disk
-            _channels[i].stream->service();
-
-            if (_channels[i].stream->is_finished()) {
-                delete _channels[i].stream;
-                _channels[i].stream = nullptr;
-                _channels[i].is_active = false;
+        if (_channels[i].state != ChannelState::ACTIVE) continue;
+        WAVStream* stream = &_channels[i].stream;
+
+        Channel& channel = _channels[i];
+
+        // refill() keeps the voices ahead of the mix. One it left short of
+        // this block (e.g. render() called without update()) is serviced here.
+        // Fast voices needing more than a full buffer per block are topped up
+        // by read_source() as they go.
+        size_t needed = channel.resampling
+            ? resampler_source_frames(channel.resampler.phase, channel.step, frames) : frames;
+        if (stream->get_buffered_frames() < needed && stream->wants_refill() &&
+            stream->get_buffer_space() >= MIXER_REFILL_MIN_BYTES) {
+            uint32_t service_start = micros();
+            stream->service();
+            stats.recordServiceTime(channel.tag, micros() - service_start);
+            stats.recordRefillMiss();
+        }
+
+        if (stream->is_finished()) {
+            free_channel(i);
+            continue;
+        }
+
+        fill_channel_block(channel, _channel_block, frames);
+        active_voices++;
+
+        // Advance the fade, then ramp from last block's gain to this one's.
+        if (channel.fade_step) {
+            channel.gain = channel.gain > channel.fade_step ? channel.gain - channel.fade_step : 0;
+        }
+        int32_t gain = channel.applied_gain;
+        int32_t target = (int32_t)(((uint32_t)channel.gain * _master_gain) >> 15);
+        channel.applied_gain = (uint16_t)target;
+        if (_steal_policy == StealPolicy::QUIETEST) {
+            channel.level = (uint16_t)((block_peak(_channel_block, samples) * target) >> 15);
+        }
+
+        // The first channel initialises the accumulator, saving a clear pass.
+        // Voices at unity gain take the plain kernels, silent ones are skipped.
+        if (gain == MIXER_GAIN_UNITY && target == MIXER_GAIN_UNITY) {
+            if (accumulator_loaded) {
+                accumulate_block(_accumulator, _channel_block, samples);
+            } else {
+                load_block(_accumulator, _channel_block, samples);
+                accumulator_loaded = true;
+            }
+        } else if (gain != 0 || target != 0) {
+            if (accumulator_loaded) {
+                accumulate_block_gain(_accumulator, _channel_block, frames, gain, target);
             } else {
-                for (size_t j = 0; j < samples_to_mix; ++j) {
-                    int16_t left, right;
-                    _channels[i].stream->get_next_sample(&left, &right);
-                    // Simple additive mixing with clipping
-                    int32_t mixed_left = _mix_buffer[j * 2] + left;
-                    int32_t mixed_right = _mix_buffer[j * 2 + 1] + right;
-                    _mix_buffer[j * 2] = (int16_t)max(min(mixed_left, 32767), -32768);
-                    _mix_buffer[j * 2 + 1] = (int16_t)max(min(mixed_right, 32767), -32768);
-                }
+                load_block_gain(_accumulator, _channel_block, frames, gain, target);
+                accumulator_loaded = true;
             }
         }
+
+        if (channel.fade_step && channel.gain == 0) {
+            free_channel(i); // Faded out
+        }
     }
 
-    // Write the mixed buffer to the sound controller
-    _soundController.write((uint8_t*)_mix_buffer, samples_to_mix * 4);
+    if (accumulator_loaded) {
+        if (_limiter) {
+            limit_block(out, _accumulator, samples);
+        } else {
+            saturate_block(out, _accumulator, samples);
+        }
+    } else {
+        memset(out, 0, samples * sizeof(int16_t));
+    }
+
+    _frame_clock += frames;
+    uint32_t render_us = micros() - block_start;
+    stats.recordActiveVoices(active_voices);
+    stats.recordRenderTime(render_us);
+
+    // Governor: shed a voice while blocks take longer than the budget.
+    if (_shed_holdoff > 0) {
+        _shed_holdoff--;
+    } else if (_render_budget_us && render_us > _render_budget_us) {
+        shed_voice();
+    }
+    return frames;
+}
+
+void SoftwareMixer::fill_channel_block(Channel& channel, int16_t* dst, size_t frames) {
+    if (!channel.resampling) {
+        size_t got = channel.stream.read_frames(dst, frames);
+        if (got < frames) {
+            // Underrun or end of stream: pad the rest of the block with silence.
+            memset(dst + got * 2, 0, (frames - got) * 2 * sizeof(int16_t));
+        }
+        // Keep the resampler history current so a pitch change joins
+        // seamlessly, also after a segment shorter than the history.
+        channel.resampler.resume(dst, frames);
+        return;
+    }
+
+    ResamplerState& state = channel.resampler;
+    size_t source_frames = resampler_source_frames(state.phase, channel.step, frames);
+    memcpy(_resample_source, state.history, sizeof(state.history));
+    read_source(&channel.stream, _resample_source + RESAMPLER_TAPS * 2, source_frames);
+
+    uint32_t phase;
+    if (_resample_quality == ResampleQuality::POLYPHASE) {
+        phase = resample_polyphase(_resample_source, state.phase, channel.step, dst, frames);
+    } else {
+        phase = resample_linear(_resample_source, state.phase, channel.step, dst, frames);
+    }
+
+    // The frames from the new integer position on become the next history.
+    memcpy(state.history, _resample_source + (phase >> 16) * 2, sizeof(state.history));
+    state.phase = phase & 0xFFFF;
+}
+
+void SoftwareMixer::read_source(WAVStream* stream, int16_t* dst, size_t frames) {
+    size_t got = stream->read_frames(dst, frames);
+    while (got < frames && !stream->is_finished()) {
+        stream->service();
+        size_t more = stream->read_frames(dst + got * 2, frames - got);
+        if (more == 0) break; // Underrun
+        got += more;
+    }
+    if (got < frames) {
+        memset(dst + got * 2, 0, (frames - got) * 2 * sizeof(int16_t));
+    }
 }
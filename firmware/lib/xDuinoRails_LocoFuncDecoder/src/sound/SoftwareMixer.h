@@ -2,35 +2,293 @@
 #define SOFTWARE_MIXER_H
 
 #include "WAVStream.h"
+#include "Resampler.h"
 #include <xDuinoRails_DccSounds.h>
 
 #define MAX_CHANNELS 16
 
+// Tag of voices that were started without one.
+#define MIXER_NO_TAG 0xFF
+
+// Number of stereo frames rendered per mix pass.
+#define MIXER_BLOCK_FRAMES 128
+
+// Output sample rate. Voices at other rates are resampled to it.
+#ifndef MIXER_OUTPUT_RATE
+#define MIXER_OUTPUT_RATE 44100
+#endif
+
+// Voice pitch, Q8.8: 0x100 plays at the recorded pitch, 0x200 an octave up.
+#define MIXER_PITCH_UNITY 0x100
+
+// Gains are Q15: 0x8000 passes a voice unchanged.
+#define MIXER_GAIN_UNITY 0x8000
+
+// Bytes the refill scheduler may read per update() across all voices. This
+// bounds the time one main loop pass spends on flash reads and inflating.
+// A 44.1 kHz 16-bit stereo voice drains 512 bytes per block, so the default
+// keeps eight such voices topped up with one update() per block.
+#ifndef MIXER_REFILL_BUDGET_BYTES
+#define MIXER_REFILL_BUDGET_BYTES 4096
+#endif
+
+// Free buffer space below which a voice is not worth a refill yet.
+#define MIXER_REFILL_MIN_BYTES 128
+
+// Render time per block above which the governor sheds a voice, in
+// microseconds; 0 turns the governor off. Defaults to 3/4 of a block period.
+#ifndef MIXER_RENDER_BUDGET_US
+#define MIXER_RENDER_BUDGET_US (MIXER_BLOCK_FRAMES * 750000UL / MIXER_OUTPUT_RATE)
+#endif
+
+// Blocks over which a shed voice fades out. No further voice is shed until
+// the fade is done and its cost is gone.
+#define MIXER_SHED_FADE_BLOCKS 4
+
+// Scheduled events (playAt(), stopAt(), setGainAt()) that can be pending
+// at once.
+#define MIXER_EVENT_QUEUE_SIZE 32
+
+// Voice priorities, lowest first. A voice can only be stolen for a voice of
+// the same or a higher priority.
+enum class VoicePriority : uint8_t {
+    AMBIENT,    // Random ambient sounds
+    ONE_SHOT,   // Short effects
+    HORN_BELL,  // Held function sounds such as horn and bell
+    CHUFF,      // Steam chuffs; short, so they never take the engine loop
+    PRIME_MOVER // Engine sound; never shed by the governor
+};
+
+// Which voice acquire() takes over when all voices are busy. Voices that are
+// already fading out are always taken first.
+enum class StealPolicy : uint8_t {
+    NONE,           // Drop the new sound
+    OLDEST,         // The voice that started first
+    QUIETEST,       // The voice with the lowest output level in the last block
+    LOWEST_PRIORITY // The lowest priority voice, the oldest among equals
+};
+
+// Output level above which the soft limiter bends the mix towards full
+// scale instead of clipping it.
+#define MIXER_LIMITER_KNEE 30720
+
 class SoftwareMixer {
 public:
     SoftwareMixer(SoundController& soundController);
     ~SoftwareMixer();
 
-    // Starts the mixer.
+    // Starts the mixer. If the sound driver supports pull mode, the mixer
+    // registers itself as its render callback and renders straight into the
+    // driver's output buffers from then on.
     void begin();
 
-    // Plays a WAV stream on the next available channel.
-    // The mixer takes ownership of the stream and will delete it when finished.
-    void play(WAVStream* stream);
+    // Hands out a free voice from the mixer's fixed pool for a sound of
+    // `priority`. If all MAX_CHANNELS voices are busy, a voice of at most that
+    // priority is stolen according to the steal policy: its next block is
+    // faded out into a tail mixed by the next render() and its slot is
+    // reused at once. Returns nullptr if no voice could be had.
+    // The voice is reserved until it is either passed to play() or given
+    // back with release().
+    WAVStream* acquire(VoicePriority priority = VoicePriority::ONE_SHOT);
+
+    // Sets the policy acquire() uses to steal a voice (LOWEST_PRIORITY by default).
+    void setStealPolicy(StealPolicy policy) { _steal_policy = policy; }
+
+    // Sets the render time per block above which the governor fades out the
+    // lowest priority voice below PRIME_MOVER; 0 turns it off.
+    void setRenderBudget(uint32_t us) { _render_budget_us = us; }
+
+    // Gives back a voice obtained from acquire() that will not be played,
+    // e.g. because its begin() failed.
+    void release(WAVStream* stream);
+
+    // Starts playing a voice obtained from acquire() at `gain` (Q15).
+    // The mixer returns the voice to the pool when it has finished.
+    // `tag` identifies the voice for stop(), e.g. the sound ID it plays.
+    void play(WAVStream* stream, uint8_t tag = MIXER_NO_TAG, uint16_t gain = MIXER_GAIN_UNITY);
+
+    // Stops all voices started with `tag` and returns them to the pool,
+    // including voices scheduled with playAt() that have not started yet.
+    void stop(uint8_t tag);
+
+    // Stops every voice and drops all scheduled events.
+    void stopAll();
+
+    // Output frames rendered so far. This is the time base of the
+    // scheduling calls below.
+    uint32_t getFrameTime() const { return _frame_clock; }
+
+    // Schedule play(), stop() and setGain() for output frame `frame`.
+    // render() ends a block early at the next event, so each takes effect on
+    // exactly that frame; a gain change starts its ramp there. Events that
+    // are already due apply at the start of the next block.
+    // Return false if the event queue is full or, for playAt(), `stream`
+    // was not obtained from acquire(). A scheduled voice belongs to the
+    // mixer until it finishes or is stopped.
+    bool playAt(uint32_t frame, WAVStream* stream, uint8_t tag = MIXER_NO_TAG,
+                uint16_t gain = MIXER_GAIN_UNITY);
+    bool stopAt(uint32_t frame, uint8_t tag);
+    bool setGainAt(uint32_t frame, uint8_t tag, uint16_t gain);
+
+    // Sets the pitch (Q8.8, see MIXER_PITCH_UNITY) of all voices started
+    // with `tag`, e.g. to let motor whine follow the speed. The playback
+    // rate is clamped to four times the output rate.
+    void setPitch(uint8_t tag, uint16_t pitch);
+
+    // Sets the gain (Q15, see MIXER_GAIN_UNITY) of all voices started with
+    // `tag`. The change is ramped linearly over the next block.
+    void setGain(uint8_t tag, uint16_t gain);
+
+    // Ramps all voices started with `tag` down to silence over about `ms`
+    // milliseconds, then stops them. Voices already fading keep their fade.
+    void fadeOut(uint8_t tag, uint16_t ms);
+
+    // Sets the gain applied to every voice, ramped like setGain().
+    void setMasterGain(uint16_t gain);
+
+    // Sets the master gain from a 0-255 volume (e.g. a CV) and passes the
+    // volume on to the sound driver for the sounds it plays by itself.
+    void setMasterVolume(uint8_t volume);
+
+    // Enables the soft limiter on the final mix (on by default). When off,
+    // the mix is hard clipped at full scale.
+    void setLimiter(bool enabled) { _limiter = enabled; }
+
+    // Selects the interpolation used by resampled voices.
+    void setResampleQuality(ResampleQuality quality) { _resample_quality = quality; }
+
+    SoundController& getSoundController() { return _soundController; }
+
+    // Sets the number of bytes refill() may read per call.
+    void setRefillBudget(size_t bytes) { _refill_budget = bytes; }
+    size_t getRefillBudget() const { return _refill_budget; }
+
+    // Refills voice buffers earliest deadline first: the voice that will run
+    // dry soonest at its playback rate is serviced next, until the refill
+    // budget is spent or every voice is topped up. Called by update().
+    void refill();
 
     // This method should be called repeatedly in the main loop.
-    // It mixes audio from all active channels and sends it to the SoundController.
+    // It refills the voices, then mixes audio from all active channels and
+    // sends it to the SoundController, or in pull mode lets the driver render
+    // into any buffer it has released.
     void update();
 
+    // Mixes up to `frames` stereo frames (interleaved L/R) into `out`.
+    // Every active channel renders a whole block into a 32-bit accumulator,
+    // scaled by its gain times the master gain in the same pass, and the
+    // result is limited once per output sample.
+    // Returns the number of frames rendered (at most MIXER_BLOCK_FRAMES, and
+    // fewer if a scheduled event falls inside the block).
+    size_t render(int16_t* out, size_t frames);
+
 private:
+    enum class ChannelState : uint8_t {
+        FREE,     // Voice is in the pool
+        ACQUIRED, // Voice is handed out but not playing yet
+        ACTIVE    // Voice is being mixed
+    };
+
+    // Each channel owns one preallocated voice, so no stream is ever
+    // allocated or freed on the trigger path.
+    // Voices recorded at the output rate and played at unity pitch are
+    // copied straight through; any other voice is resampled from then on.
     struct Channel {
-        WAVStream* stream;
-        bool is_active;
+        WAVStream stream;
+        ChannelState state;
+        uint8_t tag;
+        bool resampling;
+        uint32_t base_step;   // Source rate / output rate, Q16.16
+        uint32_t step;        // base_step scaled by the pitch
+        ResamplerState resampler;
+        uint16_t gain;         // Voice gain, Q15
+        uint16_t applied_gain; // Voice gain times master gain at the end of the last block
+        uint16_t fade_step;    // Gain removed per block while fading out, 0 otherwise
+        VoicePriority priority;
+        uint32_t serial;       // Start order, for stealing the oldest voice
+        uint16_t level;        // Peak output level of the last block (QUIETEST only)
     };
 
+    // SoundDriver::RenderCallback used in pull mode. Fills any number of
+    // frames by rendering consecutive blocks in place.
+    static void render_callback(void* context, int16_t* out, size_t frames);
+
+    // A scheduled play(), stop() or setGain().
+    struct Event {
+        enum class Type : uint8_t { PLAY, STOP, SET_GAIN };
+        uint32_t frame;
+        Type type;
+        uint8_t tag;
+        uint16_t gain;
+        WAVStream* stream; // PLAY only
+    };
+
+    int channel_index(const WAVStream* stream) const;
+    void free_channel(int index);
+
+    // Stops the playing voices with `tag`, leaving scheduled events alone.
+    void stop_active(uint8_t tag);
+
+    // True if a PLAY event for `stream` is pending.
+    bool is_scheduled(const WAVStream* stream) const;
+
+    // Inserts `event` behind all events due at or before its frame.
+    bool schedule(const Event& event);
+
+    // Drops scheduled events with `tag` (all if `all`), freeing the voices
+    // of pending plays.
+    void cancel_events(uint8_t tag, bool all);
+
+    // Executes the events due at the current frame time.
+    void run_due_events();
+
+    // True if `a` should be stolen or shed before `b` under `policy`.
+    bool steal_before(const Channel& a, const Channel& b, StealPolicy policy) const;
+
+    // Fades the next block of a voice into the steal tail and frees it.
+    void steal_channel(int index);
+
+    // Starts fading out the least important voice below PRIME_MOVER.
+    void shed_voice();
+
+    // Fetches the next `frames` stereo frames of a channel into `dst`.
+    void fill_channel_block(Channel& channel, int16_t* dst, size_t frames);
+
+    // Output frames until a channel's buffered source frames run out.
+    uint32_t frames_to_starvation(const Channel& channel) const;
+
+    // Reads exactly `frames` source frames, servicing the stream when a
+    // high playback rate drains its buffer, and pads with silence at its end.
+    void read_source(WAVStream* stream, int16_t* dst, size_t frames);
+
     SoundController& _soundController;
     Channel _channels[MAX_CHANNELS];
-    int16_t _mix_buffer[256]; // A buffer to hold mixed audio data
+    bool _pull_mode;
+    int16_t _mix_buffer[MIXER_BLOCK_FRAMES * 2];    // Output block for push-mode drivers
+    int16_t _channel_block[MIXER_BLOCK_FRAMES * 2]; // Scratch block for one channel
+    int32_t _accumulator[MIXER_BLOCK_FRAMES * 2];   // 32-bit sum of all channels
+
+    // Source frames of the voice being resampled: history plus up to
+    // RESAMPLER_MAX_STEP times a block. The read position starts up to
+    // RESAMPLER_TAPS - RESAMPLER_CENTER frames into the history (see
+    // ResamplerState::reset()), so a block can ask for that many more.
+    int16_t _resample_source[(RESAMPLER_TAPS + (RESAMPLER_TAPS - RESAMPLER_CENTER) +
+                              MIXER_BLOCK_FRAMES * (RESAMPLER_MAX_STEP >> 16) + 1) * 2];
+    ResampleQuality _resample_quality;
+    uint16_t _master_gain;
+    bool _limiter;
+    size_t _refill_budget;
+
+    StealPolicy _steal_policy;
+    uint32_t _play_serial;
+    int16_t _steal_tail[MIXER_BLOCK_FRAMES * 2]; // Fade-outs of stolen voices
+    size_t _steal_tail_frames;
+    uint32_t _render_budget_us;
+    uint8_t _shed_holdoff; // Blocks until the governor may shed again
+
+    uint32_t _frame_clock;
+    Event _events[MIXER_EVENT_QUEUE_SIZE]; // Sorted by frame
+    uint8_t _event_count;
 };
 
 #endif // SOFTWARE_MIXER_H
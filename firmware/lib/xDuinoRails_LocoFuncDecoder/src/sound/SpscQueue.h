@@ -0,0 +1,60 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * @class SpscQueue
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ *
+ * One core (or thread) may call push() while another calls pop(), without
+ * locks or disabling interrupts. The indices only ever grow; the slot is
+ * selected by masking, so `Capacity` must be a power of two.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : _head(0), _tail(0) {}
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T& item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) >= Capacity) {
+            return false;
+        }
+        _items[head & (Capacity - 1)] = item;
+        // Publish the item before the new head becomes visible.
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T& item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = _items[tail & (Capacity - 1)];
+        // Release the slot only after it has been read.
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate number of queued items (exact when called by either side
+    // while the other is idle).
+    size_t size() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    std::atomic<size_t> _head; // Written by the producer only
+    std::atomic<size_t> _tail; // Written by the consumer only
+    T _items[Capacity];
+};
+
+#endif // SPSC_QUEUE_H
@@ -1,6 +1,9 @@
 #include "VSDConfigParser.h"
 
-VSDConfigParser::VSDConfigParser() : _state(ParserState::NONE), _trigger_count(0), _sound_count(0) {
+VSDConfigParser::VSDConfigParser()
+    : _state(ParserState::NONE), _trigger_count(0), _sound_count(0),
+      _current_sound_id(VSD_INVALID_SOUND_ID) {
+    memset(_function_first, 0, sizeof(_function_first));
 }
 
 bool VSDConfigParser::parse(char* xml_data, size_t size) {
@@ -9,10 +12,12 @@ bool VSDConfigParser::parse(char* xml_data, size_t size) {
     XML_SetElementHandler(parser, start_element_handler, end_element_handler);
 
     if (XML_Parse(parser, xml_data, size, 1) == XML_STATUS_ERROR) {
+        XML_ParserFree(parser);
         return false;
     }
 
     XML_ParserFree(parser);
+    build_function_index();
     return true;
 }
 
@@ -33,6 +38,83 @@ const char* VSDConfigParser::get_sound_type(const char* name) const {
     return nullptr;
 }
 
+void VSDConfigParser::resolve_assets(VSDReader& reader) {
+    for (int i = 0; i < _sound_count; ++i) {
+        _handles[i].is_resolved = reader.locate_asset(_sounds[i].name.c_str(), &_handles[i].location);
+    }
+}
+
+const uint8_t* VSDConfigParser::get_function_sounds(int function_number, int* count) const {
+    if (function_number < 0 || function_number >= VSD_MAX_FUNCTIONS) {
+        *count = 0;
+        return _function_sounds;
+    }
+    *count = _function_first[function_number + 1] - _function_first[function_number];
+    return &_function_sounds[_function_first[function_number]];
+}
+
+const SoundHandle& VSDConfigParser::get_sound(uint8_t sound_id) const {
+    return _handles[sound_id];
+}
+
+const char* VSDConfigParser::get_sound_name(uint8_t sound_id) const {
+    return _sounds[sound_id].name.c_str();
+}
+
+int VSDConfigParser::get_sound_count() const {
+    return _sound_count;
+}
+
+uint8_t VSDConfigParser::get_notch_sounds(uint8_t* sound_ids, uint8_t max) const {
+    uint8_t count = 0;
+    // Insertion sort by notch; stable, so equal notches keep file order.
+    for (int i = 0; i < _sound_count && count < max; ++i) {
+        if (_handles[i].type != SoundType::PRIME_MOVER) continue;
+        uint8_t pos = count++;
+        while (pos > 0 && _handles[sound_ids[pos - 1]].notch > _handles[i].notch) {
+            sound_ids[pos] = sound_ids[pos - 1];
+            pos--;
+        }
+        sound_ids[pos] = (uint8_t)i;
+    }
+    return count;
+}
+
+SoundType VSDConfigParser::parse_sound_type(const char* type) {
+    if (strcmp(type, "CONTINUOUS_LOOP") == 0) return SoundType::CONTINUOUS_LOOP;
+    if (strcmp(type, "RANDOM_AMBIENT") == 0) return SoundType::RANDOM_AMBIENT;
+    if (strcmp(type, "PRIME_MOVER") == 0) return SoundType::PRIME_MOVER;
+    if (strcmp(type, "STEAM_CHUFF") == 0) return SoundType::STEAM_CHUFF;
+    return SoundType::ONE_SHOT;
+}
+
+void VSDConfigParser::build_function_index() {
+    // Counting sort of the triggers by function number, keeping file order
+    // within a function.
+    uint8_t counts[VSD_MAX_FUNCTIONS];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < _trigger_count; ++i) {
+        int fn = _triggers[i].function_number;
+        if (fn >= 0 && fn < VSD_MAX_FUNCTIONS && _triggers[i].sound_id != VSD_INVALID_SOUND_ID) {
+            counts[fn]++;
+        }
+    }
+
+    _function_first[0] = 0;
+    for (int fn = 0; fn < VSD_MAX_FUNCTIONS; ++fn) {
+        _function_first[fn + 1] = _function_first[fn] + counts[fn];
+    }
+
+    uint8_t fill[VSD_MAX_FUNCTIONS];
+    memcpy(fill, _function_first, sizeof(fill));
+    for (int i = 0; i < _trigger_count; ++i) {
+        int fn = _triggers[i].function_number;
+        if (fn >= 0 && fn < VSD_MAX_FUNCTIONS && _triggers[i].sound_id != VSD_INVALID_SOUND_ID) {
+            _function_sounds[fill[fn]++] = _triggers[i].sound_id;
+        }
+    }
+}
+
 void XMLCALL VSDConfigParser::start_element_handler(void* userData, const XML_Char* name, const XML_Char** atts) {
     VSDConfigParser* self = (VSDConfigParser*)userData;
 
@@ -40,21 +122,31 @@ void XMLCALL VSDConfigParser::start_element_handler(void* userData, const XML_Ch
         self->_state = ParserState::IN_SOUND;
         String sound_name = "";
         String sound_type = "ONE_SHOT"; // Default type
+        int notch = VSD_NO_NOTCH;
 
         for (int i = 0; atts[i]; i += 2) {
             if (strcmp(atts[i], "name") == 0) {
                 sound_name = atts[i + 1];
             } else if (strcmp(atts[i], "type") == 0) {
                 sound_type = atts[i + 1];
+            } else if (strcmp(atts[i], "notch") == 0) {
+                notch = atoi(atts[i + 1]);
+                if (notch < 0 || notch > VSD_NO_NOTCH) notch = VSD_NO_NOTCH;
             }
         }
 
         self->_current_sound_name = sound_name;
+        self->_current_sound_id = VSD_INVALID_SOUND_ID;
 
         // Store definition if we have space
-        if (self->_sound_count < 16 && sound_name.length() > 0) {
-            self->_sounds[self->_sound_count].name = sound_name;
-            self->_sounds[self->_sound_count].type = sound_type;
+        if (self->_sound_count < VSD_MAX_SOUNDS && sound_name.length() > 0) {
+            int id = self->_sound_count;
+            self->_sounds[id].name = sound_name;
+            self->_sounds[id].type = sound_type;
+            self->_handles[id].type = parse_sound_type(sound_type.c_str());
+            self->_handles[id].notch = (uint8_t)notch;
+            self->_handles[id].is_resolved = false;
+            self->_current_sound_id = (uint8_t)id;
             self->_sound_count++;
         }
 
@@ -67,9 +159,10 @@ void XMLCALL VSDConfigParser::start_element_handler(void* userData, const XML_Ch
                 break;
             }
         }
-        if (function_number != -1 && self->_trigger_count < 16) {
+        if (function_number != -1 && self->_trigger_count < VSD_MAX_TRIGGERS) {
             self->_triggers[self->_trigger_count].function_number = function_number;
             self->_triggers[self->_trigger_count].sound_name = self->_current_sound_name;
+            self->_triggers[self->_trigger_count].sound_id = self->_current_sound_id;
             self->_trigger_count++;
         }
     }
@@ -3,10 +3,30 @@
 
 #include "expat.h"
 #include <Arduino.h>
+#include "VSDReader.h"
+
+#define VSD_MAX_SOUNDS 16
+#define VSD_MAX_TRIGGERS 16
+#define VSD_MAX_FUNCTIONS 29 // F0-F28
+
+// Sound IDs are indices into the parser's sound table.
+#define VSD_INVALID_SOUND_ID 0xFF
+
+// Notch of sounds without a "notch" attribute.
+#define VSD_NO_NOTCH 0xFF
+
+enum class SoundType : uint8_t {
+    ONE_SHOT,
+    CONTINUOUS_LOOP,
+    RANDOM_AMBIENT,
+    PRIME_MOVER,
+    STEAM_CHUFF
+};
 
 struct SoundTrigger {
     int function_number;
     String sound_name;
+    uint8_t sound_id;
 };
 
 struct SoundDefinition {
@@ -14,6 +34,15 @@ struct SoundDefinition {
     String type;
 };
 
+// A sound resolved at load time, so triggering it needs no string
+// comparisons or filesystem metadata calls.
+struct SoundHandle {
+    SoundType type;
+    uint8_t notch; // PRIME_MOVER notch (0 = idle), or VSD_NO_NOTCH
+    VSDAssetLocation location;
+    bool is_resolved; // True if the asset was found in the archive
+};
+
 class VSDConfigParser {
 public:
     VSDConfigParser();
@@ -22,9 +51,29 @@ public:
     int get_trigger_count() const;
     const char* get_sound_type(const char* name) const;
 
+    // Looks up every sound's asset in the archive once, filling in the
+    // locations of the sound handles. Call after parse().
+    void resolve_assets(VSDReader& reader);
+
+    // Returns the IDs of the sounds triggered by function `function_number`
+    // and stores their number in `count`. Built by parse().
+    const uint8_t* get_function_sounds(int function_number, int* count) const;
+
+    const SoundHandle& get_sound(uint8_t sound_id) const;
+    const char* get_sound_name(uint8_t sound_id) const;
+    int get_sound_count() const;
+
+    // Fills `sound_ids` with the PRIME_MOVER sounds ordered by their
+    // "notch" attribute, sounds without one last in file order, and
+    // returns their number (at most `max`).
+    uint8_t get_notch_sounds(uint8_t* sound_ids, uint8_t max) const;
+
 private:
     static void XMLCALL start_element_handler(void* userData, const XML_Char* name, const XML_Char** atts);
     static void XMLCALL end_element_handler(void* userData, const XML_Char* name);
+    static SoundType parse_sound_type(const char* type);
+
+    void build_function_index();
 
     enum class ParserState {
         NONE,
@@ -33,13 +82,20 @@ private:
     };
 
     ParserState _state;
-    SoundTrigger _triggers[16];
+    SoundTrigger _triggers[VSD_MAX_TRIGGERS];
     int _trigger_count;
 
-    SoundDefinition _sounds[16];
+    SoundDefinition _sounds[VSD_MAX_SOUNDS];
+    SoundHandle _handles[VSD_MAX_SOUNDS];
     int _sound_count;
 
     String _current_sound_name;
+    uint8_t _current_sound_id;
+
+    // Function index in compressed row form: the sounds of function `fn` are
+    // _function_sounds[_function_first[fn]] up to _function_first[fn + 1].
+    uint8_t _function_first[VSD_MAX_FUNCTIONS + 1];
+    uint8_t _function_sounds[VSD_MAX_TRIGGERS];
 };
 
 #endif // VSD_CONFIG_PARSER_H
@@ -8,20 +8,18 @@ size_t VSDReader::read_callback(void *pOpaque, mz_uint64 file_ofs, void *pBuf, s
     return f->read((uint8_t*)pBuf, n);
 }
 
-size_t VSDReader::write_callback(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n) {
-    File* f = (File*)pOpaque;
-    if (f->position() != file_ofs) {
-        if (!f->seek(file_ofs)) return 0;
-    }
-    return f->write((uint8_t*)pBuf, n);
-}
-
-VSDReader::VSDReader() : _is_open(false), _cache_dir("/vsd_cache") {
+VSDReader::VSDReader() : _is_open(false), _inflater_count(0) {
     mz_zip_zero_struct(&_zip_archive);
+    for (int i = 0; i < VSD_MAX_INFLATE_STREAMS; i++) {
+        _inflaters[i] = nullptr;
+    }
 }
 
 VSDReader::~VSDReader() {
     end();
+    for (int i = 0; i < _inflater_count; i++) {
+        delete _inflaters[i];
+    }
 }
 
 bool VSDReader::begin(const char* filename) {
@@ -29,6 +27,7 @@ bool VSDReader::begin(const char* filename) {
 
     _vsd_file = LittleFS.open(filename, "r");
     if (!_vsd_file) return false;
+    _vsd_filename = filename;
 
     _zip_archive.m_pRead = read_callback;
     _zip_archive.m_pIO_opaque = &_vsd_file;
@@ -40,13 +39,8 @@ bool VSDReader::begin(const char* filename) {
 
     _is_open = true;
 
-    // Ensure cache directory exists
-    if (!LittleFS.exists(_cache_dir)) {
-        LittleFS.mkdir(_cache_dir);
-    }
-
-    // Extract assets
-    return extract_all_assets();
+    allocate_inflaters();
+    return true;
 }
 
 void VSDReader::end() {
@@ -57,43 +51,38 @@ void VSDReader::end() {
     }
 }
 
-bool VSDReader::extract_all_assets() {
+void VSDReader::allocate_inflaters() {
+    // Inflate sources are large, so only allocate as many as the archive can
+    // actually use, and do it here rather than on the trigger path.
+    int deflated_assets = 0;
     mz_uint num_files = mz_zip_reader_get_num_files(&_zip_archive);
     for (mz_uint i = 0; i < num_files; i++) {
         mz_zip_archive_file_stat stat;
         if (!mz_zip_reader_file_stat(&_zip_archive, i, &stat)) continue;
-
-        if (stat.m_is_directory) continue;
+        if (stat.m_is_directory || stat.m_method != MZ_DEFLATED) continue;
 
         String fname = stat.m_filename;
         if (fname.endsWith(".wav") || fname.endsWith(".WAV")) {
-            // Flatten path
-            String flatName = fname;
-            flatName.replace("/", "_");
-            flatName.replace("\\", "_");
-
-            String targetPath = _cache_dir + "/" + flatName;
-
-            // Check if file exists and has same size
-            if (LittleFS.exists(targetPath)) {
-                File existing = LittleFS.open(targetPath, "r");
-                if (existing) {
-                    size_t sz = existing.size();
-                    existing.close();
-                    if (sz == stat.m_uncomp_size) {
-                        continue; // Already cached
-                    }
-                }
-            }
+            deflated_assets++;
+        }
+    }
+
+    while (_inflater_count < deflated_assets && _inflater_count < VSD_MAX_INFLATE_STREAMS) {
+        _inflaters[_inflater_count++] = new InflateSource();
+    }
+}
 
-            File target = LittleFS.open(targetPath, "w");
-            if (target) {
-                mz_zip_reader_extract_to_callback(&_zip_archive, i, write_callback, &target, 0);
-                target.close();
+InflateSource* VSDReader::open_inflate_source(const VSDAssetLocation& location) {
+    if (!_is_open || !location.is_deflated) return nullptr;
+    for (int i = 0; i < _inflater_count; i++) {
+        if (!_inflaters[i]->is_open()) {
+            if (_inflaters[i]->open(open_archive(), location.offset, location.length, location.uncompressed_length)) {
+                return _inflaters[i];
             }
+            return nullptr;
         }
     }
-    return true;
+    return nullptr;
 }
 
 bool VSDReader::get_file_data(const char* filename, uint8_t** data, size_t* size) {
@@ -102,13 +91,39 @@ bool VSDReader::get_file_data(const char* filename, uint8_t** data, size_t* size
     return (*data != nullptr);
 }
 
-String VSDReader::get_asset_path(const char* filename) {
-    // Flatten name to match cache
-    String flatName = filename;
-    flatName.replace("/", "_");
-    flatName.replace("\\", "_");
+bool VSDReader::locate_asset(const char* filename, VSDAssetLocation* location) {
+    if (!_is_open) return false;
+    int index = mz_zip_reader_locate_file(&_zip_archive, filename, nullptr, 0);
+    if (index < 0) return false;
+    return locate_entry_data((mz_uint)index, location);
+}
+
+bool VSDReader::locate_entry_data(mz_uint file_index, VSDAssetLocation* location) {
+    mz_zip_archive_file_stat stat;
+    if (!mz_zip_reader_file_stat(&_zip_archive, file_index, &stat)) return false;
+    if (stat.m_is_directory || stat.m_is_encrypted) return false;
+
+    // The central directory only points at the local file header, whose
+    // name and extra field lengths may differ from the central copy.
+    uint8_t local_header[30];
+    if (read_callback(&_vsd_file, stat.m_local_header_ofs, local_header, sizeof(local_header)) != sizeof(local_header)) {
+        return false;
+    }
+    if (local_header[0] != 'P' || local_header[1] != 'K' || local_header[2] != 3 || local_header[3] != 4) {
+        return false;
+    }
+    uint16_t name_len = local_header[26] | (local_header[27] << 8);
+    uint16_t extra_len = local_header[28] | (local_header[29] << 8);
+
+    location->offset = (uint32_t)(stat.m_local_header_ofs + sizeof(local_header) + name_len + extra_len);
+    location->length = (uint32_t)stat.m_comp_size;
+    location->uncompressed_length = (uint32_t)stat.m_uncomp_size;
+    location->is_stored = (stat.m_method == 0) && (stat.m_comp_size == stat.m_uncomp_size);
+    location->is_deflated = (stat.m_method == MZ_DEFLATED);
+    return location->offset + location->length <= _vsd_file.size();
+}
 
-    String path = _cache_dir + "/" + flatName;
-    if (LittleFS.exists(path)) return path;
-    return "";
+File VSDReader::open_archive() {
+    if (!_is_open) return File();
+    return LittleFS.open(_vsd_filename, "r");
 }
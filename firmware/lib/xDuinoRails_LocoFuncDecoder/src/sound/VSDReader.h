@@ -4,35 +4,61 @@
 #include <Arduino.h>
 #include <LittleFS.h>
 #include "miniz.h"
+#include "InflateSource.h"
+
+// Maximum number of compressed entries that can play at the same time.
+// Each one costs an InflateSource (about 41 KB of RAM).
+#define VSD_MAX_INFLATE_STREAMS 2
+
+// Location of an asset's bytes inside the VSD archive file.
+struct VSDAssetLocation {
+    uint32_t offset;              // Absolute file offset of the entry's data
+    uint32_t length;              // Size of the entry's data in the archive
+    uint32_t uncompressed_length; // Size of the entry once decoded
+    bool is_stored;               // True if the entry is uncompressed (zip method 0)
+    bool is_deflated;             // True if the entry is DEFLATE compressed (zip method 8)
+};
 
 class VSDReader {
 public:
     VSDReader();
     ~VSDReader();
 
-    // Opens the VSD file and extracts assets to local cache.
+    // Opens the VSD file. Audio is never extracted: STORED entries are played
+    // in place and DEFLATE entries are inflated on the fly during playback.
     bool begin(const char* filename);
     void end();
 
     // Reads a file from the VSD (e.g. config.xml) into memory.
     // Caller owns the buffer and must free() it.
-    // For audio files, use the cached files on disk.
+    // For audio files, use locate_asset() and stream them instead.
     bool get_file_data(const char* filename, uint8_t** data, size_t* size);
 
-    // Returns the path to the cached asset file on LittleFS.
-    // Returns empty string if not found.
-    String get_asset_path(const char* filename);
+    // Looks up an entry in the archive's central directory.
+    // Returns false if the entry does not exist.
+    bool locate_asset(const char* filename, VSDAssetLocation* location);
+
+    // Opens a new, independent handle to the VSD file, e.g. for a WAVStream
+    // that plays a STORED entry in place.
+    File open_archive();
+
+    // Opens a free inflate source on a DEFLATE entry.
+    // Returns nullptr if all sources are busy. The source is handed back by
+    // calling its close() method (WAVStream does this when it is done).
+    InflateSource* open_inflate_source(const VSDAssetLocation& location);
 
 private:
     mz_zip_archive _zip_archive;
     bool _is_open;
     File _vsd_file;
-    String _cache_dir;
+    String _vsd_filename;
+
+    InflateSource* _inflaters[VSD_MAX_INFLATE_STREAMS];
+    int _inflater_count;
 
-    bool extract_all_assets();
-    bool extract_file_to_cache(const char* filename);
+    bool locate_entry_data(mz_uint file_index, VSDAssetLocation* location);
+    void allocate_inflaters();
     static size_t read_callback(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n);
-    static size_t write_callback(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n);
 };
 
 #endif // VSD_READER_H
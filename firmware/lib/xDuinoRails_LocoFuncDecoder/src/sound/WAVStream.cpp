@@ -1,137 +1,623 @@
 #include "WAVStream.h"
 #include <string.h>
 
+// --- Format Converters ---
+// One of these is selected per stream, so the inner loops never branch on
+// bit depth or channel count. Source samples are little-endian.
+
+static void convert_16bit_stereo(int16_t* dst, const uint8_t* src, size_t frames) {
+    memcpy(dst, src, frames * 4);
+}
+
+static void convert_16bit_mono(int16_t* dst, const uint8_t* src, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        int16_t s = (int16_t)(src[0] | (src[1] << 8));
+        dst[0] = s;
+        dst[1] = s;
+        dst += 2;
+        src += 2;
+    }
+}
+
+static void convert_8bit_stereo(int16_t* dst, const uint8_t* src, size_t frames) {
+    for (size_t i = 0; i < frames * 2; i++) {
+        dst[i] = (int16_t)((src[i] - 128) << 8);
+    }
+}
+
+static void convert_8bit_mono(int16_t* dst, const uint8_t* src, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        int16_t s = (int16_t)((src[i] - 128) << 8);
+        dst[0] = s;
+        dst[1] = s;
+        dst += 2;
+    }
+}
+
 WAVStream::WAVStream()
-    : _buffer_head(0), _buffer_tail(0), _buffer_count(0),
+    : _file_base(0), _file_length(0),
+      _mem_data(nullptr), _mem_size(0), _mem_pos(0), _inflater(nullptr),
+      _shared(nullptr), _shared_pos(0), _converter(nullptr), _frame_size(0),
+      _adpcm(false), _adpcm_units_per_block(0), _adpcm_unit_in_block(0),
+      _adpcm_pending_pos(0), _adpcm_pending_count(0),
+      _buffer_head(0), _buffer_tail(0), _buffer_count(0),
       _data_start_offset(0), _data_length(0), _bytes_read_from_file(0),
-      _is_looping(false), _finished(true) {
-    memset(&_header, 0, sizeof(wav_header_t));
+      _is_looping(false), _finished(true),
+      _has_loop_points(false), _loop_start(0), _loop_end(0),
+      _loop_head_len(0), _loop_head_fill(0), _source_synced(true),
+      _wrap_first(0), _wrap_count(0), _produced_total(0), _consumed_total(0), _read_pos(0),
+      _crossfade_frames(0), _crossfade_ready(false) {
+    memset(&_format, 0, sizeof(wav_format_t));
 }
 
 WAVStream::~WAVStream() {
+    close_source();
+}
+
+void WAVStream::end() {
+    close_source();
+    _converter = nullptr;
+    _adpcm = false;
+    _buffer_head = 0;
+    _buffer_tail = 0;
+    _buffer_count = 0;
+    _is_looping = false;
+    _finished = true;
+    _has_loop_points = false;
+    _crossfade_frames = 0;
+}
+
+void WAVStream::close_source() {
     if (_file) {
         _file.close();
     }
+    if (_inflater) {
+        _inflater->close();
+        _inflater = nullptr;
+    }
+    if (_shared) {
+        _shared->release();
+        _shared = nullptr;
+    }
+    _mem_data = nullptr;
 }
 
 bool WAVStream::begin(File file) {
+    if (!file) {
+        return false;
+    }
+    return begin(file, 0, file.size());
+}
+
+bool WAVStream::begin(File file, size_t offset, size_t length) {
+    close_source();
     _file = file;
+    _file_base = offset;
+    _file_length = length;
     if (!_file) {
         return false;
     }
+    return parse_header();
+}
+
+bool WAVStream::begin(const uint8_t* data, size_t size) {
+    close_source();
+    _mem_data = data;
+    _mem_size = size;
+    _mem_pos = 0;
+    if (!_mem_data) {
+        return false;
+    }
+    return parse_header();
+}
+
+bool WAVStream::begin(InflateSource* source) {
+    close_source();
+    if (!source || !source->is_open()) {
+        return false;
+    }
+    _inflater = source;
+    return parse_header();
+}
+
+bool WAVStream::begin(SharedSource* source) {
+    close_source();
+    if (!source || !source->is_open()) {
+        return false;
+    }
+    _shared = source;
+    _shared_pos = 0;
+    return parse_header();
+}
+
+// Reads a little-endian value from a chunk.
+static inline uint16_t read_le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    _file.seek(0);
-    if (_file.read((uint8_t*)&_header, sizeof(wav_header_t)) != sizeof(wav_header_t)) {
+bool WAVStream::parse_header() {
+    _converter = nullptr;
+    _adpcm = false;
+
+    // The "fmt " chunk is not always the canonical 16 bytes and other chunks
+    // (e.g. "fact", "LIST") may come before "data", so walk the chunk list.
+    uint8_t riff[12];
+    source_seek(0);
+    if (source_read(riff, sizeof(riff)) != sizeof(riff)) {
+        return false;
+    }
+    if (memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
         return false;
     }
 
-    // Basic validation
-    if (strncmp(_header.chunk_id, "RIFF", 4) != 0 || strncmp(_header.format, "WAVE", 4) != 0) {
+    size_t image_length = _inflater ? _inflater->size() :
+                          _shared ? _shared->size() :
+                          _mem_data ? _mem_size : _file_length;
+    size_t chunk_pos = sizeof(riff);
+    bool have_format = false;
+    bool have_data = false;
+    uint8_t smpl[36 + 24]; // Header and first loop
+    size_t smpl_len = 0;
+    while (chunk_pos + 8 <= image_length) {
+        uint8_t chunk[8];
+        if (!source_seek(chunk_pos) || source_read(chunk, sizeof(chunk)) != sizeof(chunk)) {
+            return false;
+        }
+        uint32_t chunk_size = read_le32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[20];
+            size_t fmt_len = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+            if (source_read(fmt, fmt_len) != fmt_len || !parse_format(fmt, fmt_len)) {
+                return false;
+            }
+            have_format = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            _data_start_offset = chunk_pos + sizeof(chunk);
+            _data_length = chunk_size;
+            have_data = true;
+        } else if (memcmp(chunk, "smpl", 4) == 0) {
+            smpl_len = chunk_size < sizeof(smpl) ? chunk_size : sizeof(smpl);
+            if (source_read(smpl, smpl_len) != smpl_len) smpl_len = 0;
+        }
+
+        // Chunks are padded to an even size.
+        chunk_pos += sizeof(chunk) + chunk_size + (chunk_size & 1);
+
+        // A "smpl" chunk may also follow the data. A compressed source can
+        // only seek forward by inflating everything in between, so there it
+        // is only found ahead of the data.
+        if (have_data && (_inflater || smpl_len > 0)) break;
+    }
+    if (!have_format || !have_data) {
         return false;
     }
 
-    _data_start_offset = sizeof(wav_header_t);
-    _data_length = _header.subchunk2_size;
+    // Never read past the end of the WAV image, e.g. into the next zip entry.
+    if (_data_start_offset + _data_length > image_length) {
+        _data_length = image_length > _data_start_offset ? image_length - _data_start_offset : 0;
+    }
+    // Only whole frames (ADPCM: units) can be decoded; a trailing partial one is dropped.
+    _data_length -= _data_length % _frame_size;
     _bytes_read_from_file = 0;
     _finished = false;
 
-    // We only support PCM audio format (1).
-    if (_header.audio_format != 1) return false;
+    _has_loop_points = false;
+    _loop_start = 0;
+    _loop_end = _data_length;
+    if (smpl_len > 0) {
+        parse_loop_points(smpl, smpl_len);
+    }
+    _loop_head_len = _loop_end - _loop_start;
+    if (_loop_head_len > WAV_STREAM_LOOP_HEAD_SIZE) _loop_head_len = WAV_STREAM_LOOP_HEAD_SIZE;
+    _loop_head_fill = 0;
+    _crossfade_ready = false;
+    reset_loop_state();
 
     // Reset buffer
     _buffer_head = 0;
     _buffer_tail = 0;
     _buffer_count = 0;
+    reset_adpcm();
 
     // Fill buffer initially
+    source_seek(_data_start_offset);
     service();
 
     return true;
 }
 
-void WAVStream::service() {
-    if (!_file || _finished) return;
+bool WAVStream::parse_format(const uint8_t* fmt, size_t size) {
+    if (size < 16) return false;
+    _format.audio_format = read_le16(fmt);
+    _format.num_channels = read_le16(fmt + 2);
+    _format.sample_rate = read_le32(fmt + 4);
+    _format.byte_rate = read_le32(fmt + 8);
+    _format.block_align = read_le16(fmt + 12);
+    _format.bits_per_sample = read_le16(fmt + 14);
+
+    if (_format.audio_format == IMA_ADPCM_FORMAT_TAG) {
+        // 4-bit mono or stereo. Every unit must fit the ring buffer without
+        // straddling its wrap point, which holds for any whole-unit block.
+        size_t unit = IMA_ADPCM_UNIT_BYTES * _format.num_channels;
+        if (_format.bits_per_sample != 4 || _format.num_channels < 1 || _format.num_channels > 2 ||
+            _format.block_align < unit * 2 || _format.block_align % unit != 0) {
+            return false;
+        }
+        _adpcm = true;
+        _frame_size = unit;
+        _adpcm_units_per_block = _format.block_align / unit;
+        return true;
+    }
+
+    // Otherwise only PCM audio format (1) is supported.
+    if (_format.audio_format != 1) return false;
+
+    if (_format.bits_per_sample == 16 && _format.num_channels == 2) {
+        _converter = convert_16bit_stereo;
+    } else if (_format.bits_per_sample == 16 && _format.num_channels == 1) {
+        _converter = convert_16bit_mono;
+    } else if (_format.bits_per_sample == 8 && _format.num_channels == 2) {
+        _converter = convert_8bit_stereo;
+    } else if (_format.bits_per_sample == 8 && _format.num_channels == 1) {
+        _converter = convert_8bit_mono;
+    } else {
+        return false;
+    }
+    _frame_size = (_format.bits_per_sample / 8) * _format.num_channels;
+    return true;
+}
+
+void WAVStream::parse_loop_points(const uint8_t* smpl, size_t size) {
+    // 36-byte header, then 24 bytes per loop; only the first loop is used.
+    if (size < 36 + 24 || read_le32(smpl + 28) == 0) return;
+    const uint8_t* loop = smpl + 36;
+    size_t start = read_le32(loop + 8);
+    size_t end = (size_t)read_le32(loop + 12) + 1; // The end frame is inclusive
+
+    size_t start_bytes, end_bytes;
+    if (_adpcm) {
+        // Decoding can only restart at a block header, so the loop is
+        // widened to whole blocks.
+        size_t per_block = ima_adpcm_frames_per_block(_format.block_align, _format.num_channels);
+        start_bytes = (start / per_block) * _format.block_align;
+        end_bytes = ((end + per_block - 1) / per_block) * _format.block_align;
+    } else {
+        start_bytes = start * _frame_size;
+        end_bytes = end * _frame_size;
+    }
+    if (end_bytes > _data_length) end_bytes = _data_length;
+    if (start_bytes >= end_bytes) return;
+
+    _loop_start = start_bytes;
+    _loop_end = end_bytes;
+    _has_loop_points = true;
+}
+
+void WAVStream::reset_loop_state() {
+    _source_synced = true;
+    _wrap_first = 0;
+    _wrap_count = 0;
+    _produced_total = 0;
+    _consumed_total = 0;
+    _read_pos = 0;
+}
+
+void WAVStream::reset_adpcm() {
+    _adpcm_unit_in_block = 0;
+    _adpcm_pending_pos = 0;
+    _adpcm_pending_count = 0;
+}
+
+bool WAVStream::source_is_open() const {
+    return _mem_data != nullptr || _inflater != nullptr || _shared != nullptr || (bool)_file;
+}
 
-    // While we have space in buffer
-    while (_buffer_count < WAV_STREAM_BUFFER_SIZE) {
+size_t WAVStream::source_read(uint8_t* dst, size_t len) {
+    if (_mem_data) {
+        size_t available = _mem_size - _mem_pos;
+        if (len > available) len = available;
+        memcpy(dst, _mem_data + _mem_pos, len);
+        _mem_pos += len;
+        return len;
+    }
+    if (_inflater) {
+        return _inflater->read(dst, len);
+    }
+    if (_shared) {
+        size_t read = _shared->read_at(_shared_pos, dst, len);
+        _shared_pos += read;
+        return read;
+    }
+    return _file.read(dst, len);
+}
+
+bool WAVStream::source_seek(size_t pos) {
+    if (_mem_data) {
+        if (pos > _mem_size) return false;
+        _mem_pos = pos;
+        return true;
+    }
+    if (_inflater) {
+        return _inflater->seek(pos);
+    }
+    if (_shared) {
+        if (pos > _shared->size()) return false;
+        _shared_pos = pos;
+        return true;
+    }
+    if (pos > _file_length) return false;
+    return _file.seek(_file_base + pos);
+}
+
+size_t WAVStream::service(size_t max_bytes) {
+    if (!source_is_open() || _finished) return 0;
+    bool served_from_head = false;
+    size_t added = 0;
+
+    // While we have space in buffer and budget left
+    while (_buffer_count < WAV_STREAM_BUFFER_SIZE && added < max_bytes) {
         // Determine how much we can write to the buffer (linear space at head)
         size_t space_at_end = WAV_STREAM_BUFFER_SIZE - _buffer_head;
         size_t space_total = WAV_STREAM_BUFFER_SIZE - _buffer_count;
         size_t write_len = (space_at_end < space_total) ? space_at_end : space_total;
+        if (write_len > max_bytes - added) write_len = max_bytes - added;
 
-        // Limit to remaining data in current file pass
-        if (_bytes_read_from_file >= _data_length) {
-            if (_is_looping) {
-                // Loop: Reset to data start
-                _bytes_read_from_file = 0;
-                _file.seek(_data_start_offset);
-            } else {
-                // End of file
-                if (_buffer_count == 0) _finished = true;
-                return;
-            }
+        if (_is_looping && _bytes_read_from_file >= _loop_end) {
+            // Wrap to the loop start and mark the spot for the consumer.
+            if (_wrap_count == WAV_STREAM_MAX_WRAPS) return added;
+            _wrap_marks[(_wrap_first + _wrap_count) % WAV_STREAM_MAX_WRAPS] = _produced_total;
+            _wrap_count++;
+            _bytes_read_from_file = _loop_start;
+            _source_synced = false;
+        } else if (!_is_looping && _bytes_read_from_file >= _data_length) {
+            // End of file
+            if (_buffer_count == 0) _finished = true;
+            return added;
         }
 
-        size_t bytes_remaining = _data_length - _bytes_read_from_file;
+        // Limit to remaining data in current pass
+        size_t end = _is_looping ? _loop_end : _data_length;
+        size_t bytes_remaining = end - _bytes_read_from_file;
         if (write_len > bytes_remaining) write_len = bytes_remaining;
 
-        // Read from file
-        size_t read = _file.read(_buffer + _buffer_head, write_len);
-        if (read == 0) {
-            // Read error or unexpected EOF
-             if (_is_looping) {
-                _bytes_read_from_file = 0;
-                _file.seek(_data_start_offset);
-                continue;
-             } else {
-                 // Stop filling
-                 if (_buffer_count == 0) _finished = true;
-                 break;
-             }
+        size_t read;
+        if (!_source_synced && _loop_head_fill == _loop_head_len &&
+            _bytes_read_from_file >= _loop_start && _bytes_read_from_file < _loop_start + _loop_head_len) {
+            // Serve the wrap from the RAM copy of the loop head.
+            size_t offset = _bytes_read_from_file - _loop_start;
+            if (write_len > _loop_head_len - offset) write_len = _loop_head_len - offset;
+            memcpy(_buffer + _buffer_head, _loop_head + offset, write_len);
+            read = write_len;
+            served_from_head = true;
+        } else {
+            if (!_source_synced) {
+                // Re-seek on the next call if this one served the head, so the
+                // seek never holds up the wrap itself.
+                if (served_from_head) return added;
+                source_seek(_data_start_offset + _bytes_read_from_file);
+                _source_synced = true;
+            }
+
+            // Read from file
+            read = source_read(_buffer + _buffer_head, write_len);
+            if (read == 0) {
+                // Read error or unexpected EOF
+                if (_is_looping && _bytes_read_from_file > _loop_start) {
+                    _loop_end = _bytes_read_from_file; // Loop over what is there
+                    continue;
+                }
+                // Stop filling
+                if (_buffer_count == 0) _finished = true;
+                break;
+            }
+
+            // Capture the loop head the first time it is read.
+            size_t head_pos = _loop_start + _loop_head_fill;
+            if (_loop_head_fill < _loop_head_len &&
+                head_pos >= _bytes_read_from_file && head_pos < _bytes_read_from_file + read) {
+                size_t n = _bytes_read_from_file + read - head_pos;
+                if (n > _loop_head_len - _loop_head_fill) n = _loop_head_len - _loop_head_fill;
+                memcpy(_loop_head + _loop_head_fill, _buffer + _buffer_head + (head_pos - _bytes_read_from_file), n);
+                _loop_head_fill += n;
+            }
         }
 
-        _buffer_head = (_buffer_head + read) % WAV_STREAM_BUFFER_SIZE;
+        // write_len never crosses the end of the buffer, so no modulo is needed.
+        _buffer_head += read;
+        if (_buffer_head == WAV_STREAM_BUFFER_SIZE) _buffer_head = 0;
         _buffer_count += read;
         _bytes_read_from_file += read;
+        _produced_total += read;
+        added += read;
     }
+    return added;
 }
 
-void WAVStream::get_next_sample(int16_t* left, int16_t* right) {
-    // Check if we have enough data for a sample
-    uint16_t bytes_per_sample = (_header.bits_per_sample / 8) * _header.num_channels;
+size_t WAVStream::get_buffered_frames() const {
+    if (_frame_size == 0) return 0;
+    size_t frames = _buffer_count / _frame_size;
+    if (_adpcm) {
+        frames = frames * IMA_ADPCM_FRAMES_PER_GROUP + (_adpcm_pending_count - _adpcm_pending_pos);
+    }
+    return frames;
+}
+
+bool WAVStream::wants_refill() const {
+    if (!source_is_open() || _finished || _buffer_count == WAV_STREAM_BUFFER_SIZE) return false;
+    return _is_looping || _bytes_read_from_file < _data_length;
+}
+
+size_t WAVStream::bytes_to_wrap_mark() const {
+    if (_wrap_count == 0) return (size_t)-1;
+    return _wrap_marks[_wrap_first] - _consumed_total;
+}
+
+void WAVStream::take_wrap_marks() {
+    while (_wrap_count > 0 && _wrap_marks[_wrap_first] == _consumed_total) {
+        _wrap_first = (_wrap_first + 1) % WAV_STREAM_MAX_WRAPS;
+        _wrap_count--;
+        _read_pos = _loop_start;
+        _adpcm_unit_in_block = 0; // ADPCM loops start on a block header
+    }
+}
 
-    if (_buffer_count < bytes_per_sample) {
+void WAVStream::consume(size_t bytes) {
+    _buffer_tail += bytes;
+    if (_buffer_tail == WAV_STREAM_BUFFER_SIZE) _buffer_tail = 0;
+    _buffer_count -= bytes;
+    _consumed_total += bytes;
+    _read_pos += bytes;
+}
+
+void WAVStream::get_next_sample(int16_t* left, int16_t* right) {
+    int16_t frame[2];
+    if (read_frames(frame, 1) == 0) {
         // Buffer underrun or finished
         *left = 0;
         *right = 0;
-        if (_bytes_read_from_file >= _data_length && !_is_looping && _buffer_count == 0) {
-            _finished = true;
-        }
         return;
     }
+    *left = frame[0];
+    *right = frame[1];
+}
+
+size_t WAVStream::read_frames(int16_t* dst, size_t frames) {
+    if (_adpcm) return read_adpcm_frames(dst, frames);
+    if (!_converter) return 0;
+
+    size_t delivered = 0;
+    while (delivered < frames) {
+        take_wrap_marks();
+        if (_buffer_count < _frame_size) break;
 
-    uint8_t sample_bytes[4]; // Max 2 channels * 16 bits = 4 bytes
-    for (int i=0; i<bytes_per_sample; i++) {
-        sample_bytes[i] = _buffer[_buffer_tail];
-        _buffer_tail = (_buffer_tail + 1) % WAV_STREAM_BUFFER_SIZE;
-        _buffer_count--;
+        // Largest run of whole frames that is contiguous in the ring buffer
+        // and does not cross a loop wrap.
+        // The buffer size is a multiple of every supported frame size, so a
+        // frame never straddles the wrap point.
+        size_t contiguous = WAV_STREAM_BUFFER_SIZE - _buffer_tail;
+        if (contiguous > _buffer_count) contiguous = _buffer_count;
+        size_t to_mark = bytes_to_wrap_mark();
+        if (contiguous > to_mark) contiguous = to_mark;
+        size_t run = contiguous / _frame_size;
+        if (run > frames - delivered) run = frames - delivered;
+
+        int16_t* out = dst + delivered * 2;
+        _converter(out, _buffer + _buffer_tail, run);
+        if (_crossfade_frames) {
+            apply_crossfade(out, _read_pos / _frame_size, run);
+        }
+
+        consume(run * _frame_size);
+        delivered += run;
+    }
+    take_wrap_marks();
+
+    // The last sample of a non-looping stream ends it right away.
+    if (_buffer_count < _frame_size && _bytes_read_from_file >= _data_length && !_is_looping) {
+        _finished = true;
+    }
+    return delivered;
+}
+
+void WAVStream::apply_crossfade(int16_t* frames, size_t first_frame, size_t count) {
+    size_t loop_start = _loop_start / _frame_size;
+    size_t loop_end = _loop_end / _frame_size;
+    size_t n = _crossfade_frames;
+    if (n > loop_start) n = loop_start;
+    if (n > loop_end - loop_start) n = loop_end - loop_start;
+    if (n == 0) return;
+    size_t last_frame = first_frame + count;
+
+    // Capture the lead-in to the loop start on the first pass.
+    size_t lead_in = loop_start - n;
+    if (!_crossfade_ready && first_frame < loop_start && last_frame > lead_in) {
+        size_t from = first_frame > lead_in ? first_frame : lead_in;
+        size_t to = last_frame < loop_start ? last_frame : loop_start;
+        memcpy(_crossfade + (from - lead_in) * 2, frames + (from - first_frame) * 2,
+               (to - from) * 2 * sizeof(int16_t));
+        if (to == loop_start) _crossfade_ready = true;
     }
 
-    if (_header.bits_per_sample == 16) {
-        if (_header.num_channels == 2) {
-            *left = *((int16_t*)(sample_bytes));
-            *right = *((int16_t*)(sample_bytes + 2));
-        } else { // Mono
-            *left = *right = *((int16_t*)(sample_bytes));
+    // Blend the loop tail into the lead-in when the stream is going to wrap,
+    // so the wrap continues exactly where the blend ends.
+    size_t tail = loop_end - n;
+    if (_crossfade_ready && (_is_looping || _wrap_count > 0) && first_frame < loop_end && last_frame > tail) {
+        size_t from = first_frame > tail ? first_frame : tail;
+        size_t to = last_frame < loop_end ? last_frame : loop_end;
+        for (size_t p = from; p < to; p++) {
+            size_t k = p - tail;
+            int32_t w = (int32_t)(((k + 1) << 15) / (n + 1)); // Q15 weight of the lead-in
+            int16_t* f = frames + (p - first_frame) * 2;
+            const int16_t* c = _crossfade + k * 2;
+            f[0] = (int16_t)((f[0] * (32768 - w) + c[0] * w) >> 15);
+            f[1] = (int16_t)((f[1] * (32768 - w) + c[1] * w) >> 15);
         }
-    } else if (_header.bits_per_sample == 8) {
-        if (_header.num_channels == 2) {
-            *left = (sample_bytes[0] - 128) << 8;
-            *right = (sample_bytes[1] - 128) << 8;
-        } else { // Mono
-            *left = *right = (sample_bytes[0] - 128) << 8;
+    }
+}
+
+size_t WAVStream::read_adpcm_frames(int16_t* dst, size_t frames) {
+    size_t delivered = 0;
+    const uint16_t channels = _format.num_channels;
+
+    while (delivered < frames) {
+        // Hand out what is left of a group that was decoded earlier.
+        if (_adpcm_pending_pos < _adpcm_pending_count) {
+            size_t run = _adpcm_pending_count - _adpcm_pending_pos;
+            if (run > frames - delivered) run = frames - delivered;
+            memcpy(dst + delivered * 2, _adpcm_pending + _adpcm_pending_pos * 2, run * 2 * sizeof(int16_t));
+            _adpcm_pending_pos += run;
+            delivered += run;
+            continue;
+        }
+
+        take_wrap_marks();
+        if (_buffer_count < _frame_size) break;
+
+        size_t units = 1;
+        if (_adpcm_unit_in_block == 0) {
+            ima_adpcm_decode_header(_adpcm_state, channels, _buffer + _buffer_tail, dst + delivered * 2);
+            delivered++;
+        } else {
+            // Decode as many whole groups straight into `dst` as the request,
+            // the current block and the contiguous part of the buffer allow.
+            size_t contiguous = WAV_STREAM_BUFFER_SIZE - _buffer_tail;
+            if (contiguous > _buffer_count) contiguous = _buffer_count;
+            units = contiguous / _frame_size;
+            size_t block_left = _adpcm_units_per_block - _adpcm_unit_in_block;
+            if (units > block_left) units = block_left;
+            size_t to_mark = bytes_to_wrap_mark() / _frame_size;
+            if (units > to_mark) units = to_mark;
+
+            size_t direct = (frames - delivered) / IMA_ADPCM_FRAMES_PER_GROUP;
+            if (direct == 0) {
+                // Less than a group requested: decode one group aside.
+                ima_adpcm_decode_groups(_adpcm_state, channels, _buffer + _buffer_tail, 1, _adpcm_pending);
+                _adpcm_pending_pos = 0;
+                _adpcm_pending_count = IMA_ADPCM_FRAMES_PER_GROUP;
+                units = 1;
+            } else {
+                if (units > direct) units = direct;
+                ima_adpcm_decode_groups(_adpcm_state, channels, _buffer + _buffer_tail, units, dst + delivered * 2);
+                delivered += units * IMA_ADPCM_FRAMES_PER_GROUP;
+            }
         }
+
+        consume(units * _frame_size);
+        _adpcm_unit_in_block += units;
+        if (_adpcm_unit_in_block == _adpcm_units_per_block) _adpcm_unit_in_block = 0;
     }
+    take_wrap_marks();
+
+    if (_adpcm_pending_pos == _adpcm_pending_count && _buffer_count < _frame_size &&
+        _bytes_read_from_file >= _data_length && !_is_looping) {
+        _finished = true;
+    }
+    return delivered;
 }
 
 bool WAVStream::is_finished() const {
@@ -139,12 +625,14 @@ bool WAVStream::is_finished() const {
 }
 
 void WAVStream::rewind() {
-    if (_file) {
-        _file.seek(_data_start_offset);
+    if (source_is_open()) {
+        source_seek(_data_start_offset);
         _bytes_read_from_file = 0;
         _buffer_head = 0;
         _buffer_tail = 0;
         _buffer_count = 0;
+        reset_adpcm();
+        reset_loop_state();
         _finished = false;
         service(); // Refill immediately
     }
@@ -154,19 +642,51 @@ void WAVStream::setLooping(bool looping) {
     _is_looping = looping;
 }
 
+void WAVStream::setLoopCrossfade(uint16_t frames) {
+    _crossfade_frames = frames > WAV_STREAM_MAX_CROSSFADE ? WAV_STREAM_MAX_CROSSFADE : frames;
+    _crossfade_ready = false;
+}
+
+size_t WAVStream::get_loop_start() const {
+    return bytes_to_frames(_loop_start);
+}
+
+size_t WAVStream::get_loop_end() const {
+    return bytes_to_frames(_loop_end);
+}
+
 uint32_t WAVStream::get_sample_rate() const {
-    return _header.sample_rate;
+    return _format.sample_rate;
 }
 
 uint16_t WAVStream::get_num_channels() const {
-    return _header.num_channels;
+    return _format.num_channels;
 }
 
 uint16_t WAVStream::get_bits_per_sample() const {
-    return _header.bits_per_sample;
+    return _format.bits_per_sample;
+}
+
+uint16_t WAVStream::get_audio_format() const {
+    return _format.audio_format;
 }
 
 size_t WAVStream::get_total_samples() const {
-    if (_header.block_align == 0) return 0;
-    return _data_length / _header.block_align;
+    return bytes_to_frames(_data_length);
+}
+
+size_t WAVStream::bytes_to_frames(size_t bytes) const {
+    if (_format.block_align == 0) return 0;
+    if (_adpcm) {
+        size_t full_blocks = bytes / _format.block_align;
+        size_t tail_units = (bytes % _format.block_align) / _frame_size;
+        size_t frames = full_blocks * ima_adpcm_frames_per_block(_format.block_align, _format.num_channels);
+        if (tail_units > 0) frames += (tail_units - 1) * IMA_ADPCM_FRAMES_PER_GROUP + 1;
+        return frames;
+    }
+    return bytes / _format.block_align;
+}
+
+uint32_t WAVStream::get_decode_us() const {
+    return _inflater ? _inflater->get_inflate_us() : 0;
 }
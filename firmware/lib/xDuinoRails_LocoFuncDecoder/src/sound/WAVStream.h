@@ -3,9 +3,23 @@
 
 #include <Arduino.h>
 #include <LittleFS.h>
+#include "InflateSource.h"
+#include "AssetCache.h"
+#include "ImaAdpcm.h"
 
 #define WAV_STREAM_BUFFER_SIZE 1024
 
+// Bytes from the loop start kept in RAM, so a loop wrap is served from
+// memory while the source re-seeks on a later service() call.
+#define WAV_STREAM_LOOP_HEAD_SIZE 512
+
+// Loop wraps that may be in the ring buffer at once (short loops wrap
+// several times per buffer fill).
+#define WAV_STREAM_MAX_WRAPS 8
+
+// Longest loop crossfade, in frames.
+#define WAV_STREAM_MAX_CROSSFADE 64
+
 class WAVStream {
 public:
     WAVStream();
@@ -14,30 +28,138 @@ public:
     // Initializes the stream with a file from LittleFS.
     bool begin(File file);
 
-    // Refills the internal buffer from the file. Must be called frequently.
-    void service();
+    // Initializes the stream with a WAV image embedded in a larger file,
+    // e.g. a STORED entry inside a VSD archive. `offset` is where the RIFF
+    // header starts and `length` is the size of the embedded image.
+    bool begin(File file, size_t offset, size_t length);
+
+    // Initializes the stream from a complete WAV image in memory.
+    // The data is not copied and must outlive the stream.
+    bool begin(const uint8_t* data, size_t size);
+
+    // Initializes the stream with an opened inflate source (a compressed
+    // VSD entry). The source is closed, i.e. handed back, when the stream
+    // is destroyed or restarted.
+    bool begin(InflateSource* source);
+
+    // Initializes the stream as a cursor on a shared source (see
+    // AssetCache). The stream takes over the reference the caller holds
+    // and releases it when it is ended or restarted.
+    bool begin(SharedSource* source);
+
+    // Stops playback and closes the source, leaving the stream ready for
+    // another begin(). Called by the mixer when a voice returns to its pool.
+    void end();
+
+    // Refills the internal buffer from the file, reading at most `max_bytes`.
+    // Must be called frequently. Returns the number of bytes added.
+    size_t service(size_t max_bytes = WAV_STREAM_BUFFER_SIZE);
+
+    // Refill state for the mixer's refill scheduler.
+    // Frames ready to be read, approximate for IMA-ADPCM (header units
+    // count as a whole group).
+    size_t get_buffered_frames() const;
+    // Free space in the buffer, in bytes.
+    size_t get_buffer_space() const { return WAV_STREAM_BUFFER_SIZE - _buffer_count; }
+    // True while the source still has data for the free buffer space.
+    bool wants_refill() const;
 
     // Gets the next audio sample. Samples are returned as signed 16-bit integers.
     // Mono samples will be duplicated to both left and right channels.
     void get_next_sample(int16_t* left, int16_t* right);
 
+    // Reads up to `frames` frames as interleaved 16-bit stereo into `dst`.
+    // Contiguous runs of the ring buffer are converted in one go by a
+    // converter chosen for the stream's format when the header is parsed.
+    // IMA-ADPCM streams are decoded here as well, a group of 8 frames at a
+    // time, so the ring buffer holds compressed data.
+    // Returns the number of frames delivered; fewer than requested means the
+    // buffer ran dry (underrun) or the stream ended.
+    size_t read_frames(int16_t* dst, size_t frames);
+
     // Returns true if the end of the audio data has been reached.
     bool is_finished() const;
 
     // Resets the playback position to the beginning of the audio data.
     void rewind();
 
-    // Enables or disables looping playback.
+    // Enables or disables looping playback. A stream loops between the
+    // points of its "smpl" chunk if it has one, otherwise over all its data.
+    // Turning looping off lets the stream play on past the loop end.
     void setLooping(bool looping);
 
+    // Crossfades the last `frames` frames before the loop end into the frames
+    // leading up to the loop start, hiding a level or phase jump at the loop
+    // point. 0 (the default) turns it off. PCM streams with audio before the
+    // loop start only.
+    void setLoopCrossfade(uint16_t frames);
+
+    // Loop points in frames, [start, end). Without a "smpl" chunk these are
+    // 0 and the total number of frames.
+    bool has_loop_points() const { return _has_loop_points; }
+    size_t get_loop_start() const;
+    size_t get_loop_end() const;
+
     // Public accessors for WAV properties
     uint32_t get_sample_rate() const;
     uint16_t get_num_channels() const;
     uint16_t get_bits_per_sample() const;
+    uint16_t get_audio_format() const;
+    uint32_t get_byte_rate() const { return _format.byte_rate; }
     size_t get_total_samples() const;
 
+    // CPU time spent decoding the source (inflating), in microseconds.
+    // Zero for uncompressed sources.
+    uint32_t get_decode_us() const;
+
 private:
     File _file;
+    size_t _file_base;   // Offset of the WAV image within _file
+    size_t _file_length; // Size of the WAV image within _file
+
+    // In-memory source (used instead of _file when non-null)
+    const uint8_t* _mem_data;
+    size_t _mem_size;
+    size_t _mem_pos;
+
+    // Compressed source (used instead of _file when non-null)
+    InflateSource* _inflater;
+
+    // Shared source (used instead of _file when non-null), read at _shared_pos
+    SharedSource* _shared;
+    size_t _shared_pos;
+
+    void close_source();
+    bool source_is_open() const;
+    size_t source_read(uint8_t* dst, size_t len);
+    bool source_seek(size_t pos);
+    bool parse_header();
+    bool parse_format(const uint8_t* fmt, size_t size);
+    void parse_loop_points(const uint8_t* smpl, size_t size);
+    void reset_loop_state();
+    size_t bytes_to_wrap_mark() const;
+    void consume(size_t bytes);
+    void take_wrap_marks();
+    void apply_crossfade(int16_t* frames, size_t first_frame, size_t count);
+    size_t bytes_to_frames(size_t bytes) const;
+    size_t read_adpcm_frames(int16_t* dst, size_t frames);
+    void reset_adpcm();
+
+    // Converts `frames` packed source frames to interleaved 16-bit stereo.
+    typedef void (*FrameConverter)(int16_t* dst, const uint8_t* src, size_t frames);
+    FrameConverter _converter;
+    size_t _frame_size; // Bytes per source frame (block align), or per ADPCM unit
+
+    // IMA-ADPCM decoding. The data is consumed in units of 4 bytes per
+    // channel: a header unit at the start of every block, then group units
+    // of 8 frames each.
+    bool _adpcm;
+    ImaAdpcmChannel _adpcm_state[2];
+    size_t _adpcm_units_per_block;
+    size_t _adpcm_unit_in_block;  // Next unit's position in its block
+    int16_t _adpcm_pending[IMA_ADPCM_FRAMES_PER_GROUP * 2]; // Decoded, not yet delivered
+    uint8_t _adpcm_pending_pos;
+    uint8_t _adpcm_pending_count;
 
     // Ring Buffer
     uint8_t _buffer[WAV_STREAM_BUFFER_SIZE];
@@ -52,24 +174,42 @@ private:
     bool _is_looping;
     bool _finished;
 
-    // WAV header format
-    struct wav_header_t {
-        char chunk_id[4];
-        uint32_t chunk_size;
-        char format[4];
-        char subchunk1_id[4];
-        uint32_t subchunk1_size;
+    // Loop region in bytes relative to the data start, [start, end).
+    bool _has_loop_points;
+    size_t _loop_start;
+    size_t _loop_end;
+
+    // RAM copy of the loop head, captured while the first pass plays.
+    uint8_t _loop_head[WAV_STREAM_LOOP_HEAD_SIZE];
+    size_t _loop_head_len;  // Bytes the head should hold
+    size_t _loop_head_fill; // Bytes captured so far
+    bool _source_synced;    // False while the source is not at _bytes_read_from_file
+
+    // Wraps in the ring buffer, as values of _produced_total at the wrap.
+    // The consumer jumps to the loop start when _consumed_total reaches one.
+    uint32_t _wrap_marks[WAV_STREAM_MAX_WRAPS];
+    uint8_t _wrap_first;
+    uint8_t _wrap_count;
+    uint32_t _produced_total;
+    uint32_t _consumed_total;
+    size_t _read_pos; // Consumer's position in the data, in bytes
+
+    // Crossfade: the frames before the loop start, captured on the first pass.
+    uint16_t _crossfade_frames;
+    bool _crossfade_ready;
+    int16_t _crossfade[WAV_STREAM_MAX_CROSSFADE * 2];
+
+    // Fields of the "fmt " chunk
+    struct wav_format_t {
         uint16_t audio_format;
         uint16_t num_channels;
         uint32_t sample_rate;
         uint32_t byte_rate;
         uint16_t block_align;
         uint16_t bits_per_sample;
-        char subchunk2_id[4];
-        uint32_t subchunk2_size;
     };
 
-    wav_header_t _header;
+    wav_format_t _format;
 };
 
 #endif // WAV_STREAM_H
@@ -12,6 +12,7 @@ LocoFuncDecoder::LocoFuncDecoder() : cvManagerAdapter(cvManager)
 
 LocoFuncDecoder::~LocoFuncDecoder() {
     if (motor) delete motor;
+    if (audioEngine) delete audioEngine;
     if (mixer) delete mixer;
     if (soundController) delete soundController;
     if (vsdReader) delete vsdReader;
@@ -43,6 +44,7 @@ void LocoFuncDecoder::begin(const LocoFuncDecoderConfig& conf) {
     if (config.enableSound) {
         soundController = new SoundController();
         mixer = new SoftwareMixer(*soundController);
+        audioEngine = new AudioEngine(*mixer);
         vsdReader = new VSDReader();
         vsdConfigParser = new VSDConfigParser();
 
@@ -52,20 +54,33 @@ void LocoFuncDecoder::begin(const LocoFuncDecoderConfig& conf) {
                                   // For now, we assume it picks up the board defaults or build flags.
 
         mixer->begin();
-        soundController->setVolume(25);
+        mixer->setMasterVolume(cvManager.readCV(CV_SOUND_MASTER_VOLUME));
 
         // VSD Loading
         if (LittleFS.begin()) {
-             // Initialize VSDReader which will extract assets to cache
+             // Initialize VSDReader; audio assets are streamed from the archive
              if (vsdReader->begin("/test.vsd")) {
                 uint8_t* xml_data = nullptr;
                 size_t xml_size = 0;
                 if (vsdReader->get_file_data("config.xml", &xml_data, &xml_size)) {
                     vsdConfigParser->parse((char*)xml_data, xml_size);
                     free(xml_data);
+                    // Resolve every sound's archive location once, up front
+                    vsdConfigParser->resolve_assets(*vsdReader);
+                    audioEngine->setSoundProject(vsdReader, vsdConfigParser);
+                    audioEngine->setCacheSize(cvManager.readCV(CV_SOUND_CACHE_SIZE));
+                    audioEngine->setNotchTime(cvManager.readCV(CV_SOUND_NOTCH_TIME) * 10);
+                    audioEngine->setChuffsPerRevolution(cvManager.readCV(CV_SOUND_CHUFFS_PER_REV));
+                    audioEngine->setWheelDiameter(cvManager.readCV(CV_SOUND_WHEEL_DIAMETER));
+                    audioEngine->setFullSpeed(cvManager.readCV(CV_SOUND_FULL_SPEED) * 10);
+                    for (int id = 0; id < vsdConfigParser->get_sound_count(); id++) {
+                        audioEngine->setSoundVolume(id, cvManager.readCV(CV_SOUND_VOLUME_START + id));
+                    }
                 }
             }
         }
+
+        audioReady = true;
     }
 
     // --- Lights & Aux ---
@@ -114,9 +129,18 @@ void LocoFuncDecoder::update() {
     if (motor) motor->update();
     auxController.update(delta_ms);
 
-    if (soundController) {
+    if (audioReady && !config.soundOnCore1) {
         soundController->loop();
-        if (mixer) mixer->update();
+        audioEngine->loop();
+    }
+}
+
+void LocoFuncDecoder::updateAudio() {
+    // The driver renders into buffers the mixer owns, so it is only used
+    // from the core that runs the mixer.
+    if (audioReady && config.soundOnCore1) {
+        soundController->loop();
+        audioEngine->loop();
     }
 }
 
@@ -136,6 +160,10 @@ void LocoFuncDecoder::handleDccSpeed(uint16_t Addr, uint8_t Speed, bool isForwar
         motor->setTargetSpeed(pps);
     }
 
+    // The prime mover notches up and down with the target speed, and the
+    // chuffs follow it as the wheel speed.
+    if (audioEngine) audioEngine->setSpeed(Speed);
+
     auxController.setDirection(isForward ? xDuinoRails::DECODER_DIRECTION_FORWARD : xDuinoRails::DECODER_DIRECTION_REVERSE);
     auxController.setSpeed(Speed); // Aux controller expects 0-255
 }
@@ -173,37 +201,15 @@ void LocoFuncDecoder::processFunctionGroup(int start_fn, int count, uint8_t stat
         int current_fn = start_fn + i;
         auxController.setFunctionState(current_fn, state);
 
-        if (config.enableSound && soundController && mixer && vsdConfigParser && vsdReader) {
-            // Hardcoded beep logic from main.cpp
-             if (current_fn == 1 && state) {
-                soundController->play(1);
+        if (config.enableSound && soundController && audioEngine && vsdConfigParser) {
+            // Hardcoded beep logic from main.cpp, played by the audio core
+            if (current_fn == 1 && state) {
+                audioEngine->playTrack(1);
             }
 
-            if (state) {
-                // Trigger sound
-                 for (int j = 0; j < vsdConfigParser->get_trigger_count(); j++) {
-                    const SoundTrigger* trigger = &vsdConfigParser->get_triggers()[j];
-                    if (trigger->function_number == current_fn) {
-                        String assetPath = vsdReader->get_asset_path(trigger->sound_name.c_str());
-                        if (assetPath.length() > 0) {
-                            File audioFile = LittleFS.open(assetPath, "r");
-                            if (audioFile) {
-                                WAVStream* stream = new WAVStream();
-                                if (stream->begin(audioFile)) {
-                                    const char* sound_type = vsdConfigParser->get_sound_type(trigger->sound_name.c_str());
-                                    if (sound_type && strcmp(sound_type, "CONTINUOUS_LOOP") == 0) {
-                                        stream->setLooping(true);
-                                    }
-                                    mixer->play(stream);
-                                } else {
-                                    delete stream;
-                                    audioFile.close();
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+            // Trigger sounds through the index compiled at load time.
+            // The audio engine opens and mixes them on the audio core.
+            audioEngine->setFunction(current_fn, state, cvManager.readCV(CV_SOUND_FADE_TIME) * 10);
         }
     }
 }
@@ -211,6 +217,24 @@ void LocoFuncDecoder::processFunctionGroup(int start_fn, int count, uint8_t stat
 void LocoFuncDecoder::handleCVChange(uint16_t CV, uint8_t Value) {
     cvManager.writeCV(CV, Value);
 
+    if (audioEngine) {
+        if (CV == CV_SOUND_MASTER_VOLUME) {
+            audioEngine->setVolume(Value);
+        } else if (CV >= CV_SOUND_VOLUME_START && CV <= CV_SOUND_VOLUME_END) {
+            audioEngine->setSoundVolume(CV - CV_SOUND_VOLUME_START, Value);
+        } else if (CV == CV_SOUND_NOTCH_TIME) {
+            audioEngine->setNotchTime(Value * 10);
+        } else if (CV == CV_SOUND_CHUFFS_PER_REV) {
+            audioEngine->setChuffsPerRevolution(Value);
+        } else if (CV == CV_SOUND_WHEEL_DIAMETER) {
+            audioEngine->setWheelDiameter(Value);
+        } else if (CV == CV_SOUND_FULL_SPEED) {
+            audioEngine->setFullSpeed(Value * 10);
+        } else if (CV == CV_SOUND_CACHE_SIZE) {
+            audioEngine->setCacheSize(Value);
+        }
+    }
+
     if (motor) {
          switch (CV) {
             case CV_START_VOLTAGE:
@@ -253,6 +277,7 @@ void LocoFuncDecoder::handleMMPacket(void* voidData) {
             uint8_t pps = map(data->Speed, 0, 14, 0, max_speed);
             motor->setTargetSpeed(pps);
         }
+        if (audioEngine) audioEngine->setSpeed(data->Stop ? 0 : map(data->Speed, 0, 14, 0, 255));
         auxController.setDirection(motor->getDirection() ? xDuinoRails::DECODER_DIRECTION_FORWARD : xDuinoRails::DECODER_DIRECTION_REVERSE);
         auxController.setSpeed(motor->getTargetSpeed());
     }
@@ -11,6 +11,7 @@
 #include "sound/WAVStream.h"
 #include "sound/VSDConfigParser.h"
 #include "sound/SoftwareMixer.h"
+#include "sound/AudioEngine.h"
 #include <XDuinoRails_MotorControl.h>
 
 #if defined(PROTOCOL_DCC)
@@ -36,6 +37,14 @@ public:
      */
     void update();
 
+    /**
+     * @brief Audio core loop: executes queued sound commands, renders the mix
+     * and services the sound driver.
+     * Call it from `loop1()` when `soundOnCore1` is set; otherwise update()
+     * runs the audio engine itself.
+     */
+    void updateAudio();
+
     /**
      * @brief Accessors for subsystems.
      */
@@ -71,6 +80,9 @@ private:
     VSDReader* vsdReader = nullptr;
     VSDConfigParser* vsdConfigParser = nullptr;
     SoftwareMixer* mixer = nullptr;
+    AudioEngine* audioEngine = nullptr;
+    // Set once the sound system is fully set up; loop1() may start earlier.
+    volatile bool audioReady = false;
     XDuinoRails_MotorDriver* motor = nullptr;
 
 #if defined(PROTOCOL_DCC)
@@ -0,0 +1,331 @@
+"""Compiles a VSD sound project into the package the decoder plays directly.
+
+Every WAV asset is converted to the mixer's output format: 44100 Hz, 16-bit
+PCM, mono or stereo as recorded. Loop points from the "smpl" chunk are
+carried over to the new rate. With --adpcm, sounds without loop points are
+IMA ADPCM encoded instead (4:1), in the block layout the decoder's ADPCM
+reader expects. Looped sounds stay PCM, because ADPCM can only restart a loop
+at a block boundary. All entries are STORED in the output archive, so the
+decoder reads them without inflating and voices share one open source.
+
+At runtime a compiled asset then takes the mixer's fast paths: no resampling
+(the voice step is exactly unity), no bit depth conversion and no inflate.
+
+Only the Python standard library is used. Usage:
+
+    python vsd_compile.py <input.vsd> <output.vsd> [--adpcm] [--stereo]
+"""
+import argparse
+import math
+import operator
+import struct
+import sys
+import zipfile
+
+OUTPUT_RATE = 44100  # MIXER_OUTPUT_RATE
+
+# Resampler: windowed sinc, RESAMPLE_TAPS taps per output sample, one of
+# RESAMPLE_PHASES precomputed fractional positions.
+RESAMPLE_TAPS = 16
+RESAMPLE_PHASES = 256
+
+# IMA ADPCM block size per channel: 1017 frames per block at 44.1 kHz.
+ADPCM_BLOCK_BYTES = 512
+
+WAVE_FORMAT_PCM = 0x0001
+WAVE_FORMAT_IEEE_FLOAT = 0x0003
+WAVE_FORMAT_IMA_ADPCM = 0x0011
+WAVE_FORMAT_EXTENSIBLE = 0xFFFE
+
+IMA_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+IMA_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+class CompileError(Exception):
+    pass
+
+
+class Sound:
+    """Decoded audio: one list of 16-bit samples per channel."""
+
+    def __init__(self, rate, channels, loop=None):
+        self.rate = rate
+        self.channels = channels
+        self.loop = loop  # (start, end) frames, end exclusive, or None
+
+    def frames(self):
+        return len(self.channels[0])
+
+
+def read_chunks(data):
+    if len(data) < 12 or data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+        raise CompileError("not a RIFF/WAVE file")
+    chunks = {}
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, size = struct.unpack_from("<4sI", data, pos)
+        chunks.setdefault(chunk_id, data[pos + 8:pos + 8 + size])
+        pos += 8 + size + (size & 1)
+    if b"fmt " not in chunks or b"data" not in chunks:
+        raise CompileError("missing fmt or data chunk")
+    return chunks
+
+
+def ima_decode(data, channels, block_align, frames):
+    out = [[] for _ in range(channels)]
+    unit = 4 * channels
+    for block_start in range(0, len(data) - unit + 1, block_align):
+        block = data[block_start:block_start + block_align]
+        state = []
+        for ch in range(channels):
+            predictor, index = struct.unpack_from("<hB", block, ch * 4)
+            state.append([predictor, min(index, 88)])
+            out[ch].append(predictor)
+        for group in range(unit, len(block) - unit + 1, unit):
+            for ch in range(channels):
+                predictor, index = state[ch]
+                for byte in block[group + ch * 4:group + ch * 4 + 4]:
+                    for nibble in (byte & 0x0F, byte >> 4):
+                        step = IMA_STEP_TABLE[index]
+                        diff = step >> 3
+                        if nibble & 1:
+                            diff += step >> 2
+                        if nibble & 2:
+                            diff += step >> 1
+                        if nibble & 4:
+                            diff += step
+                        predictor = max(-32768, predictor - diff) if nibble & 8 else min(32767, predictor + diff)
+                        index = min(88, max(0, index + IMA_INDEX_TABLE[nibble & 7]))
+                        out[ch].append(predictor)
+                state[ch] = [predictor, index]
+    if frames is not None:
+        out = [samples[:frames] for samples in out]
+    return out
+
+
+def read_wav(data):
+    """Decodes a WAV image of any format the tool knows into a Sound."""
+    chunks = read_chunks(data)
+    fmt = chunks[b"fmt "]
+    tag, channels, rate, _, block_align, bits = struct.unpack_from("<HHIIHH", fmt)
+    if tag == WAVE_FORMAT_EXTENSIBLE and len(fmt) >= 26:
+        tag = struct.unpack_from("<H", fmt, 24)[0]
+    if channels not in (1, 2):
+        raise CompileError(f"{channels} channels, only mono and stereo are supported")
+    raw = chunks[b"data"]
+
+    if tag == WAVE_FORMAT_IMA_ADPCM:
+        frames = struct.unpack("<I", chunks[b"fact"][:4])[0] if b"fact" in chunks else None
+        samples = ima_decode(raw, channels, block_align, frames)
+    elif tag == WAVE_FORMAT_PCM and bits == 8:
+        flat = [(b - 128) << 8 for b in raw]
+        samples = [flat[ch::channels] for ch in range(channels)]
+    elif tag == WAVE_FORMAT_PCM and bits in (16, 24, 32):
+        width = bits // 8
+        count = len(raw) // width
+        if bits == 16:
+            flat = list(struct.unpack(f"<{count}h", raw[:count * 2]))
+        else:
+            shift = bits - 16
+            flat = []
+            for i in range(count):
+                value = int.from_bytes(raw[i * width:(i + 1) * width], "little", signed=True)
+                flat.append(max(-32768, min(32767, (value + (1 << (shift - 1))) >> shift)))
+        samples = [flat[ch::channels] for ch in range(channels)]
+    elif tag == WAVE_FORMAT_IEEE_FLOAT and bits == 32:
+        count = len(raw) // 4
+        flat = [max(-32768, min(32767, round(v * 32768))) for v in struct.unpack(f"<{count}f", raw[:count * 4])]
+        samples = [flat[ch::channels] for ch in range(channels)]
+    else:
+        raise CompileError(f"unsupported format {tag:#06x}, {bits} bits")
+
+    length = min(len(s) for s in samples)
+    sound = Sound(rate, [s[:length] for s in samples])
+    smpl = chunks.get(b"smpl")
+    if smpl and len(smpl) >= 36 + 24 and struct.unpack_from("<I", smpl, 28)[0] > 0:
+        start, end = struct.unpack_from("<II", smpl, 36 + 8)
+        end = min(end + 1, length)  # The end frame is inclusive
+        if start < end:
+            sound.loop = (start, end)
+    return sound
+
+
+def sinc_table(ratio):
+    """Filter taps for every phase; cut off below the lower Nyquist rate."""
+    cutoff = 0.45 * min(1.0, ratio) * 2  # Of the source rate, times two
+    half = RESAMPLE_TAPS // 2
+    table = []
+    for phase in range(RESAMPLE_PHASES):
+        frac = phase / RESAMPLE_PHASES
+        taps = []
+        for k in range(RESAMPLE_TAPS):
+            x = k - (half - 1) - frac
+            window = 0.42 + 0.5 * math.cos(math.pi * x / half) + 0.08 * math.cos(2 * math.pi * x / half)
+            if abs(x) >= half:
+                window = 0.0
+            value = cutoff if x == 0 else math.sin(math.pi * cutoff * x) / (math.pi * x)
+            taps.append(value * window)
+        total = sum(taps)
+        table.append([t / total for t in taps])
+    return table
+
+
+def resample(samples, source_rate, target_rate):
+    if source_rate == target_rate or not samples:
+        return list(samples)
+    table = sinc_table(target_rate / source_rate)
+    half = RESAMPLE_TAPS // 2
+    padded = [0] * half + list(samples) + [0] * half
+    count = len(samples) * target_rate // source_rate
+    step = source_rate / target_rate
+    out = []
+    for i in range(count):
+        pos = i * step
+        base = int(pos)
+        taps = table[int((pos - base) * RESAMPLE_PHASES)]
+        window = padded[base + 1:base + 1 + RESAMPLE_TAPS]
+        value = round(sum(map(operator.mul, taps, window)))
+        out.append(max(-32768, min(32767, value)))
+    return out
+
+
+def ima_encode(channels):
+    """Encodes channel sample lists as IMA ADPCM; returns (data, block_align)."""
+    count = len(channels)
+    block_align = ADPCM_BLOCK_BYTES * count
+    frames_per_block = (block_align // (4 * count) - 1) * 8 + 1
+    frames = len(channels[0])
+    state = [[0, 0] for _ in range(count)]
+    out = bytearray()
+    for start in range(0, frames, frames_per_block):
+        # The last block is cut short after the 8-frame group holding the
+        # final sample, which pads the rest of that group.
+        length = min(frames_per_block, frames - start)
+        length = 1 + (length - 1 + 7) // 8 * 8
+        block = []
+        for samples in channels:
+            chunk = samples[start:start + length]
+            block.append(chunk + [chunk[-1]] * (length - len(chunk)))
+        for ch in range(count):
+            state[ch][0] = block[ch][0]
+            out += struct.pack("<hBB", block[ch][0], state[ch][1], 0)
+        for group in range(1, length, 8):
+            for ch in range(count):
+                predictor, index = state[ch]
+                nibbles = []
+                for sample in block[ch][group:group + 8]:
+                    step = IMA_STEP_TABLE[index]
+                    diff = sample - predictor
+                    nibble = 0
+                    if diff < 0:
+                        nibble = 8
+                        diff = -diff
+                    delta = step >> 3
+                    if diff >= step:
+                        nibble |= 4
+                        diff -= step
+                        delta += step
+                    if diff >= step >> 1:
+                        nibble |= 2
+                        diff -= step >> 1
+                        delta += step >> 1
+                    if diff >= step >> 2:
+                        nibble |= 1
+                        delta += step >> 2
+                    predictor = max(-32768, predictor - delta) if nibble & 8 else min(32767, predictor + delta)
+                    index = min(88, max(0, index + IMA_INDEX_TABLE[nibble & 7]))
+                    nibbles.append(nibble)
+                state[ch] = [predictor, index]
+                out += bytes(nibbles[i] | (nibbles[i + 1] << 4) for i in range(0, 8, 2))
+    return bytes(out), block_align
+
+
+def chunk(chunk_id, payload):
+    return struct.pack("<4sI", chunk_id, len(payload)) + payload + (b"\0" if len(payload) & 1 else b"")
+
+
+def write_wav(sound, adpcm):
+    count = len(sound.channels)
+    frames = sound.frames()
+    if adpcm:
+        data, block_align = ima_encode(sound.channels)
+        frames_per_block = (block_align // (4 * count) - 1) * 8 + 1
+        byte_rate = OUTPUT_RATE * block_align // frames_per_block
+        fmt = struct.pack("<HHIIHHHH", WAVE_FORMAT_IMA_ADPCM, count, OUTPUT_RATE, byte_rate,
+                          block_align, 4, 2, frames_per_block)
+        body = chunk(b"fmt ", fmt) + chunk(b"fact", struct.pack("<I", frames)) + chunk(b"data", data)
+    else:
+        interleaved = [s for frame in zip(*sound.channels) for s in frame]
+        data = struct.pack(f"<{len(interleaved)}h", *interleaved)
+        fmt = struct.pack("<HHIIHH", WAVE_FORMAT_PCM, count, OUTPUT_RATE, OUTPUT_RATE * 2 * count, 2 * count, 16)
+        body = chunk(b"fmt ", fmt) + chunk(b"data", data)
+    if sound.loop:
+        start, end = sound.loop
+        header = struct.pack("<9I", 0, 0, round(1e9 / OUTPUT_RATE), 60, 0, 0, 0, 1, 0)
+        loop = struct.pack("<6I", 0, 0, start, end - 1, 0, 0)
+        body += chunk(b"smpl", header + loop)
+    return b"RIFF" + struct.pack("<I", 4 + len(body)) + b"WAVE" + body
+
+
+def compile_sound(data, adpcm, stereo):
+    """Returns (output WAV image, description of the conversion)."""
+    sound = read_wav(data)
+    source = f"{sound.rate} Hz {len(sound.channels)} ch"
+    if sound.rate != OUTPUT_RATE:
+        if sound.loop:
+            start, end = sound.loop
+            sound.loop = (start * OUTPUT_RATE // sound.rate, end * OUTPUT_RATE // sound.rate)
+        sound.channels = [resample(s, sound.rate, OUTPUT_RATE) for s in sound.channels]
+        sound.rate = OUTPUT_RATE
+    if stereo and len(sound.channels) == 1:
+        sound.channels = sound.channels * 2
+    use_adpcm = adpcm and sound.loop is None
+    image = write_wav(sound, use_adpcm)
+    target = f"{OUTPUT_RATE} Hz {len(sound.channels)} ch {'adpcm' if use_adpcm else 'pcm16'}"
+    loop = f", loop {sound.loop[0]}-{sound.loop[1]}" if sound.loop else ""
+    return image, f"{source} -> {target}{loop}"
+
+
+def compile_project(input_path, output_path, adpcm=False, stereo=False):
+    with zipfile.ZipFile(input_path) as archive:
+        names = archive.namelist()
+        if "config.xml" not in names:
+            raise CompileError(f"{input_path} has no config.xml")
+        with zipfile.ZipFile(output_path, "w", zipfile.ZIP_STORED) as package:
+            for name in names:
+                data = archive.read(name)
+                if name.lower().endswith(".wav"):
+                    try:
+                        data, description = compile_sound(data, adpcm, stereo)
+                    except CompileError as e:
+                        raise CompileError(f"{name}: {e}")
+                    print(f"  {name}: {description}, {len(data)} bytes")
+                package.writestr(name, data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile a VSD sound project for the decoder.")
+    parser.add_argument("input", help="VSD archive to compile")
+    parser.add_argument("output", help="device package to write, upload it as /test.vsd")
+    parser.add_argument("--adpcm", action="store_true", help="IMA ADPCM encode sounds without loop points")
+    parser.add_argument("--stereo", action="store_true", help="store mono sounds as stereo, trading flash for a plain copy per sample")
+    args = parser.parse_args()
+    try:
+        compile_project(args.input, args.output, args.adpcm, args.stereo)
+    except (CompileError, zipfile.BadZipFile, OSError) as e:
+        print(f"vsd_compile: {e}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -7,7 +7,11 @@
  */
 #include <unity.h>
 #include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <thread>
 #include <ArduinoFake.h>
 
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
@@ -31,8 +35,28 @@ public:
 // Include the source files directly to resolve linker errors in the test environment.
 #include "AuxController.cpp"
 #include "CVManager.cpp"
-// Include WAVStream for testing
+// Include WAVStream, its inflate source and ADPCM decoder for testing
+#include "sound/InflateSource.cpp"
+#include "sound/ImaAdpcm.cpp"
 #include "sound/WAVStream.cpp"
+#include "sound/AssetCache.cpp"
+#include "sound/SampleCache.cpp"
+// Include the VSD reader and config parser for the trigger index
+#include "sound/VSDReader.cpp"
+#include "sound/VSDConfigParser.cpp"
+#include "sound/AudioEngine.cpp"
+#include "sound/PrimeMover.cpp"
+#include "sound/ChuffGenerator.cpp"
+// Include the mixer and its (driverless on native) sound controller
+#include "SoundStats.cpp"
+#include "SoundController.cpp"
+#include "NoiseShaper.cpp"
+#include "SigmaDelta.cpp"
+#include "DFPlayerQueue.cpp"
+#include "DFPlayerDriver.cpp"
+#include "WAVFileDriver.cpp"
+#include "sound/Resampler.cpp"
+#include "sound/SoftwareMixer.cpp"
 
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 // Test Globals & Setup
@@ -55,6 +79,15 @@ void setUp(void) {
     mock_outputs.push_back(&mock_output2.get());
     When(Method(mock_output1, setValue)).AlwaysReturn();
     When(Method(mock_output2, setValue)).AlwaysReturn();
+    // The sound path times itself, and the render governor sheds voices
+    // when a block runs over budget. micros() is a fake clock that moves
+    // 1 us per reading, so host scheduling can never shed a voice; tests
+    // of the governor install their own clock.
+    static unsigned long fake_micros;
+    fake_micros = 0;
+    When(Method(ArduinoFake(), micros)).AlwaysDo([]() -> unsigned long {
+        return ++fake_micros;
+    });
 }
 
 /**
@@ -444,6 +477,2343 @@ void test_wav_stream_looping() {
     TEST_ASSERT_FALSE(stream.is_finished());
 }
 
+/**
+ * @brief Builds a 16-bit stereo PCM WAV image in memory.
+ * Left and right channels are filled with the given constant values.
+ */
+std::vector<uint8_t> make_wav_16bit_stereo(size_t frames, int16_t left, int16_t right) {
+    uint32_t data_size = frames * 4;
+    std::vector<uint8_t> wav(44 + data_size);
+    auto put32 = [&](size_t at, uint32_t v) { memcpy(&wav[at], &v, 4); };
+    auto put16 = [&](size_t at, uint16_t v) { memcpy(&wav[at], &v, 2); };
+    memcpy(&wav[0], "RIFF", 4); put32(4, 36 + data_size);
+    memcpy(&wav[8], "WAVE", 4);
+    memcpy(&wav[12], "fmt ", 4); put32(16, 16);
+    put16(20, 1); put16(22, 2); put32(24, 44100); put32(28, 44100 * 4);
+    put16(32, 4); put16(34, 16);
+    memcpy(&wav[36], "data", 4); put32(40, data_size);
+    for (size_t i = 0; i < frames; i++) {
+        put16(44 + i * 4, (uint16_t)left);
+        put16(44 + i * 4 + 2, (uint16_t)right);
+    }
+    return wav;
+}
+
+/**
+ * @brief Test WAVStream::read_frames() against the per-sample path.
+ * Uses 16-bit mono data longer than the ring buffer so that runs wrap around.
+ */
+void test_wav_stream_read_frames() {
+    const size_t frames = WAV_STREAM_BUFFER_SIZE; // 2 KB of mono data
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(frames / 2, 0, 0);
+    // Reinterpret the data chunk as 16-bit mono with a ramp.
+    uint16_t channels = 1, align = 2;
+    memcpy(&wav[22], &channels, 2);
+    memcpy(&wav[32], &align, 2);
+    for (size_t i = 0; i < frames; i++) {
+        int16_t v = (int16_t)(i * 7 - 3000);
+        memcpy(&wav[44 + i * 2], &v, 2);
+    }
+
+    WAVStream bulk, single;
+    TEST_ASSERT_TRUE(bulk.begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(single.begin(wav.data(), wav.size()));
+
+    std::vector<int16_t> out(frames * 2);
+    size_t done = 0;
+    while (done < frames) {
+        // Odd request sizes so runs do not line up with the buffer wrap.
+        size_t got = bulk.read_frames(&out[done * 2], 97);
+        if (got == 0) bulk.service();
+        done += got;
+        single.service();
+    }
+    TEST_ASSERT_TRUE(bulk.is_finished());
+
+    for (size_t i = 0; i < frames; i++) {
+        int16_t l, r;
+        if (i % 200 == 0) single.service();
+        single.get_next_sample(&l, &r);
+        TEST_ASSERT_EQUAL(l, out[i * 2]);
+        TEST_ASSERT_EQUAL(r, out[i * 2 + 1]);
+        TEST_ASSERT_EQUAL((int16_t)(i * 7 - 3000), out[i * 2]);
+    }
+}
+
+/**
+ * @brief Builds a 16-bit stereo WAV image with a deterministic two-tone signal.
+ * Unlike a constant signal it does not compress to almost nothing.
+ */
+std::vector<uint8_t> make_wav_tone(size_t frames) {
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(frames, 0, 0);
+    uint32_t noise = 12345;
+    for (size_t i = 0; i < frames * 2; i++) {
+        noise = noise * 1103515245 + 12345;
+        int16_t v = (int16_t)(((i * 131) % 8000) - 4000 + ((noise >> 16) & 0x3F));
+        memcpy(&wav[44 + i * 2], &v, 2);
+    }
+    return wav;
+}
+
+/**
+ * @brief Compresses a buffer to a raw DEFLATE stream, as stored in a zip entry.
+ */
+std::vector<uint8_t> deflate_raw(const std::vector<uint8_t>& data) {
+    size_t out_len = 0;
+    void* out = tdefl_compress_mem_to_heap(data.data(), data.size(), &out_len, TDEFL_DEFAULT_MAX_PROBES);
+    std::vector<uint8_t> result((uint8_t*)out, (uint8_t*)out + out_len);
+    mz_free(out);
+    return result;
+}
+
+/**
+ * @brief Test WAVStream playback of a DEFLATE entry through InflateSource.
+ * The data is larger than the 32 KB window so it wraps, and looping
+ * exercises the restart of the decompressor.
+ */
+void test_wav_stream_inflate() {
+    const size_t frames = 20000; // ~80 KB of audio
+    std::vector<uint8_t> wav = make_wav_tone(frames);
+    std::vector<uint8_t> packed = deflate_raw(wav);
+    TEST_ASSERT_TRUE(packed.size() < wav.size());
+    std::vector<int16_t> reference(frames * 2);
+    memcpy(reference.data(), &wav[44], frames * 4);
+
+    // One pass: every frame decodes to the uncompressed reference, and every
+    // byte of the entry is inflated exactly once.
+    InflateSource* source = new InflateSource();
+    TEST_ASSERT_TRUE(source->open(packed.data(), packed.size(), wav.size()));
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(source));
+    std::vector<int16_t> out(256);
+    size_t done = 0;
+    while (!stream.is_finished()) {
+        stream.service();
+        size_t got = stream.read_frames(out.data(), 128);
+        TEST_ASSERT_TRUE(done + got <= frames);
+        TEST_ASSERT_EQUAL_INT16_ARRAY(&reference[done * 2], out.data(), got * 2);
+        done += got;
+    }
+    TEST_ASSERT_EQUAL(frames, done);
+    TEST_ASSERT_EQUAL(wav.size(), source->get_inflated_bytes());
+
+    // Looping: the second and third passes restart the decompressor and
+    // decode to the same frames.
+    stream.end(); // Hands the source back
+    TEST_ASSERT_TRUE(source->open(packed.data(), packed.size(), wav.size()));
+    TEST_ASSERT_TRUE(stream.begin(source));
+    stream.setLooping(true);
+    for (done = 0; done < frames * 5 / 2;) {
+        stream.service();
+        size_t got = stream.read_frames(out.data(), 128);
+        TEST_ASSERT_TRUE(got > 0);
+        for (size_t i = 0; i < got; i++) {
+            size_t frame = (done + i) % frames;
+            TEST_ASSERT_EQUAL(reference[frame * 2], out[i * 2]);
+            TEST_ASSERT_EQUAL(reference[frame * 2 + 1], out[i * 2 + 1]);
+        }
+        done += got;
+    }
+    TEST_ASSERT_FALSE(stream.is_finished());
+    TEST_ASSERT_TRUE(source->get_inflated_bytes() > 2 * wav.size());
+
+    // Restarting the stream hands the source back.
+    stream.begin(wav.data(), wav.size());
+    TEST_ASSERT_FALSE(source->is_open());
+    delete source;
+}
+
+/**
+ * @brief Writes a VSD archive at `path` holding `wav` as a STORED entry.
+ */
+void write_stored_vsd(const char* path, const std::vector<uint8_t>& wav) {
+    mz_zip_archive zip;
+    mz_zip_zero_struct(&zip);
+    TEST_ASSERT_TRUE(mz_zip_writer_init_heap(&zip, 0, 0));
+    TEST_ASSERT_TRUE(mz_zip_writer_add_mem(&zip, "config.xml", "<vsd/>", 6, MZ_DEFAULT_LEVEL));
+    TEST_ASSERT_TRUE(mz_zip_writer_add_mem(&zip, "tone.wav", wav.data(), wav.size(), MZ_NO_COMPRESSION));
+    void* archive = nullptr;
+    size_t archive_size = 0;
+    TEST_ASSERT_TRUE(mz_zip_writer_finalize_heap_archive(&zip, &archive, &archive_size));
+    FILE* file = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(archive_size, fwrite(archive, 1, archive_size, file));
+    fclose(file);
+    mz_free(archive);
+    mz_zip_writer_end(&zip);
+}
+
+/**
+ * @brief Test AssetCache: voices of the same sound share one reference
+ * counted source and still play from their own positions.
+ */
+void test_asset_cache_shared_source() {
+    const char* path = "test_asset_cache_shared_source.vsd";
+    const size_t frames = 1000;
+    std::vector<uint8_t> wav = make_wav_tone(frames);
+    write_stored_vsd(path, wav);
+    VSDReader reader;
+    TEST_ASSERT_TRUE(reader.begin(path));
+    VSDAssetLocation location;
+    TEST_ASSERT_TRUE(reader.locate_asset("tone.wav", &location));
+    AssetCache cache;
+
+    SharedSource* a = cache.acquire(reader, 3, location);
+    SharedSource* b = cache.acquire(reader, 3, location);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_EQUAL_PTR(a, b);
+    TEST_ASSERT_EQUAL(2, a->get_refs());
+    TEST_ASSERT_EQUAL(1, cache.get_open_count());
+    TEST_ASSERT_EQUAL(1, cache.get_shared_count());
+
+    // Two cursors, the second starting while the first is half way.
+    WAVStream first, second;
+    TEST_ASSERT_TRUE(first.begin(a));
+    std::vector<int16_t> out(frames * 2);
+    first.service();
+    TEST_ASSERT_EQUAL(100, first.read_frames(out.data(), 100));
+    TEST_ASSERT_TRUE(second.begin(b));
+    for (WAVStream* stream : { &second, &first }) {
+        size_t done = stream == &first ? 100 : 0;
+        while (done < frames) {
+            stream->service();
+            size_t got = stream->read_frames(out.data(), frames - done);
+            TEST_ASSERT_TRUE(got > 0);
+            TEST_ASSERT_EQUAL_MEMORY(&wav[44 + done * 4], out.data(), got * 4);
+            done += got;
+        }
+        TEST_ASSERT_TRUE(stream->is_finished());
+    }
+
+    // Ending a cursor drops its reference; the idle source stays open.
+    first.end();
+    second.end();
+    TEST_ASSERT_EQUAL(0, a->get_refs());
+    TEST_ASSERT_TRUE(a->is_open());
+    TEST_ASSERT_EQUAL_PTR(a, cache.acquire(reader, 3, location));
+    TEST_ASSERT_EQUAL(1, cache.get_open_count());
+
+    // With every slot held by a playing voice there is no source to give.
+    SharedSource* held[ASSET_CACHE_MAX_SOURCES - 1];
+    for (int i = 0; i < ASSET_CACHE_MAX_SOURCES - 1; i++) {
+        held[i] = cache.acquire(reader, 10 + i, location);
+        TEST_ASSERT_NOT_NULL(held[i]);
+    }
+    TEST_ASSERT_NULL(cache.acquire(reader, 20, location));
+
+    // Once idle, the least recently used source gives up its slot.
+    a->release();
+    held[0]->release();
+    SharedSource* reused = cache.acquire(reader, 20, location);
+    TEST_ASSERT_EQUAL_PTR(a, reused);
+    TEST_ASSERT_EQUAL(ASSET_CACHE_MAX_SOURCES + 1, cache.get_open_count());
+    cache.clear();
+    reader.end();
+    remove(path);
+}
+
+/**
+ * @brief Test a file-backed SharedSource: two voices reading at different
+ * offsets share the read-ahead blocks, and each block is read from the file
+ * only once while it stays cached.
+ */
+void test_asset_cache_file_source() {
+    const char* path = "test_asset_cache_file_source.bin";
+    const uint32_t offset = 100; // The asset starts inside the file, as a VSD entry does
+    const uint32_t length = 4000;
+    std::vector<uint8_t> file_data(offset + length);
+    for (size_t i = 0; i < file_data.size(); i++) {
+        file_data[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    FILE* file = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(file_data.size(), fwrite(file_data.data(), 1, file_data.size(), file));
+    fclose(file);
+
+    static uint8_t read_ahead[ASSET_CACHE_BLOCKS * ASSET_CACHE_BLOCK_SIZE];
+    SharedSource source;
+    source.set_read_ahead(read_ahead);
+    TEST_ASSERT_TRUE(source.open(LittleFS.open(path, "r"), offset, length));
+    TEST_ASSERT_EQUAL(length, source.size());
+
+    // Voice a plays blocks 0 and 1, voice b blocks 2 to 4, one chunk each in turn.
+    const size_t chunk = 128;
+    size_t pos[2] = { 0, 1500 };
+    uint8_t out[chunk];
+    for (int step = 0; step < 8; step++) {
+        for (int voice = 0; voice < 2; voice++) {
+            TEST_ASSERT_EQUAL(chunk, source.read_at(pos[voice], out, chunk));
+            TEST_ASSERT_EQUAL_MEMORY(&file_data[offset + pos[voice]], out, chunk);
+            pos[voice] += chunk;
+        }
+    }
+    // Five blocks touched, each read once: every other chunk was a hit.
+    TEST_ASSERT_EQUAL(5, source.get_block_reads());
+
+    // Block 4 took the place of block 2, the least recently used; block 0
+    // is still cached.
+    TEST_ASSERT_EQUAL(chunk, source.read_at(0, out, chunk));
+    TEST_ASSERT_EQUAL(5, source.get_block_reads());
+    TEST_ASSERT_EQUAL(chunk, source.read_at(2 * ASSET_CACHE_BLOCK_SIZE, out, chunk));
+    TEST_ASSERT_EQUAL_MEMORY(&file_data[offset + 2 * ASSET_CACHE_BLOCK_SIZE], out, chunk);
+    TEST_ASSERT_EQUAL(6, source.get_block_reads());
+
+    // The end of the asset, not of the file, ends a read.
+    TEST_ASSERT_EQUAL(length - 3990, source.read_at(3990, out, chunk));
+    TEST_ASSERT_EQUAL_MEMORY(&file_data[offset + 3990], out, length - 3990);
+    source.close();
+    remove(path);
+}
+
+/**
+ * @brief Plays `stream` to its end and checks it against the frames of `wav`.
+ */
+void check_stream_plays(WAVStream& stream, const std::vector<uint8_t>& wav) {
+    size_t frames = (wav.size() - 44) / 4;
+    std::vector<int16_t> out(256);
+    size_t done = 0;
+    while (!stream.is_finished()) {
+        stream.service();
+        size_t got = stream.read_frames(out.data(), 128);
+        TEST_ASSERT_TRUE(done + got <= frames);
+        TEST_ASSERT_EQUAL_MEMORY(&wav[44 + done * 4], out.data(), got * 4);
+        done += got;
+    }
+    TEST_ASSERT_EQUAL(frames, done);
+}
+
+/**
+ * @brief Test VSDReader::locate_asset() on a zip with a STORED and a DEFLATE
+ * WAV: the STORED entry plays in place from its offset in the archive, the
+ * DEFLATE one is reported as such and plays through an inflate source.
+ */
+void test_vsd_reader_locate_asset() {
+    const char* path = "test_vsd_reader_locate_asset.vsd";
+    std::vector<uint8_t> stored = make_wav_tone(1000);
+    std::vector<uint8_t> deflated = make_wav_tone(3000);
+    mz_zip_archive zip;
+    mz_zip_zero_struct(&zip);
+    TEST_ASSERT_TRUE(mz_zip_writer_init_heap(&zip, 0, 0));
+    TEST_ASSERT_TRUE(mz_zip_writer_add_mem(&zip, "config.xml", "<vsd/>", 6, MZ_DEFAULT_LEVEL));
+    TEST_ASSERT_TRUE(mz_zip_writer_add_mem(&zip, "stored.wav", stored.data(), stored.size(), MZ_NO_COMPRESSION));
+    TEST_ASSERT_TRUE(mz_zip_writer_add_mem(&zip, "deflated.wav", deflated.data(), deflated.size(), MZ_BEST_COMPRESSION));
+    void* archive = nullptr;
+    size_t archive_size = 0;
+    TEST_ASSERT_TRUE(mz_zip_writer_finalize_heap_archive(&zip, &archive, &archive_size));
+    std::vector<uint8_t> file_data((uint8_t*)archive, (uint8_t*)archive + archive_size);
+    mz_free(archive);
+    mz_zip_writer_end(&zip);
+    FILE* file = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(file_data.size(), fwrite(file_data.data(), 1, file_data.size(), file));
+    fclose(file);
+
+    VSDReader reader;
+    TEST_ASSERT_TRUE(reader.begin(path));
+    VSDAssetLocation location;
+    TEST_ASSERT_FALSE(reader.locate_asset("missing.wav", &location));
+
+    // The STORED entry: its bytes are the WAV image, at the offset reported.
+    TEST_ASSERT_TRUE(reader.locate_asset("stored.wav", &location));
+    TEST_ASSERT_TRUE(location.is_stored);
+    TEST_ASSERT_FALSE(location.is_deflated);
+    TEST_ASSERT_EQUAL(stored.size(), location.length);
+    TEST_ASSERT_EQUAL(stored.size(), location.uncompressed_length);
+    TEST_ASSERT_TRUE(location.offset + location.length <= file_data.size());
+    TEST_ASSERT_EQUAL_MEMORY(stored.data(), &file_data[location.offset], stored.size());
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(reader.open_archive(), location.offset, location.length));
+    check_stream_plays(stream, stored);
+    stream.end();
+
+    // The DEFLATE entry cannot play in place; it falls back to inflating.
+    TEST_ASSERT_TRUE(reader.locate_asset("deflated.wav", &location));
+    TEST_ASSERT_FALSE(location.is_stored);
+    TEST_ASSERT_TRUE(location.is_deflated);
+    TEST_ASSERT_TRUE(location.length < deflated.size());
+    TEST_ASSERT_EQUAL(deflated.size(), location.uncompressed_length);
+    InflateSource* source = reader.open_inflate_source(location);
+    TEST_ASSERT_NOT_NULL(source);
+    TEST_ASSERT_TRUE(stream.begin(source));
+    check_stream_plays(stream, deflated);
+    stream.end();
+
+    reader.end();
+    remove(path);
+}
+
+/**
+ * @brief Copies a WAV image to the heap, as the sample cache holds it.
+ */
+uint8_t* heap_copy(const std::vector<uint8_t>& data) {
+    uint8_t* copy = (uint8_t*)malloc(data.size());
+    memcpy(copy, data.data(), data.size());
+    return copy;
+}
+
+/**
+ * @brief Test SampleCache: resident sounds play from RAM, stay within the
+ * byte budget, and only idle sounds are evicted, by LRU or LFU.
+ */
+void test_sample_cache() {
+    std::vector<uint8_t> wav = make_wav_tone(100); // 444 bytes
+    SampleCache cache;
+    cache.set_capacity_kb(1);
+    TEST_ASSERT_FALSE(cache.accepts(1025));
+    TEST_ASSERT_FALSE(cache.insert(9, heap_copy(make_wav_tone(300)), 1244));
+
+    TEST_ASSERT_TRUE(cache.insert(1, heap_copy(wav), wav.size()));
+    TEST_ASSERT_TRUE(cache.insert(2, heap_copy(wav), wav.size()));
+    TEST_ASSERT_EQUAL(2 * wav.size(), cache.get_used_bytes());
+    TEST_ASSERT_NULL(cache.acquire(3));
+
+    // A resident sound plays without any file.
+    SharedSource* source = cache.acquire(1);
+    TEST_ASSERT_NOT_NULL(source);
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(source));
+    std::vector<int16_t> out(200);
+    stream.service();
+    TEST_ASSERT_EQUAL(100, stream.read_frames(out.data(), 100));
+    TEST_ASSERT_EQUAL_MEMORY(&wav[44], out.data(), 400);
+
+    // Sound 1 is playing, so room for sound 3 comes from sound 2.
+    TEST_ASSERT_FALSE(cache.insert(3, heap_copy(wav), wav.size(), false));
+    TEST_ASSERT_TRUE(cache.insert(3, heap_copy(wav), wav.size()));
+    TEST_ASSERT_TRUE(cache.contains(1));
+    TEST_ASSERT_FALSE(cache.contains(2));
+    TEST_ASSERT_EQUAL(1, cache.get_evictions());
+
+    // Nothing idle to evict while both are playing.
+    SharedSource* other = cache.acquire(3);
+    TEST_ASSERT_FALSE(cache.insert(2, heap_copy(wav), wav.size()));
+
+    // LRU gives up sound 1, triggered longest ago.
+    stream.end();
+    other->release();
+    TEST_ASSERT_TRUE(cache.insert(2, heap_copy(wav), wav.size()));
+    TEST_ASSERT_FALSE(cache.contains(1));
+
+    // LFU keeps sound 3, triggered more often than sound 2.
+    cache.set_policy(SampleCachePolicy::LFU);
+    cache.acquire(2)->release();
+    cache.acquire(3)->release();
+    cache.acquire(3)->release();
+    TEST_ASSERT_TRUE(cache.insert(1, heap_copy(wav), wav.size()));
+    TEST_ASSERT_TRUE(cache.contains(3));
+    TEST_ASSERT_FALSE(cache.contains(2));
+
+    // Shrinking the budget evicts down to it.
+    cache.set_capacity_kb(0);
+    TEST_ASSERT_EQUAL(0, cache.get_entry_count());
+    TEST_ASSERT_EQUAL(0, cache.get_used_bytes());
+}
+
+/**
+ * @brief Test the block mixing kernel of SoftwareMixer.
+ * Verifies channels are summed in 32 bits and saturated once per output sample.
+ */
+void test_mixer_block_render() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    // No active channels renders silence.
+    TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES, mixer.render(out, MIXER_BLOCK_FRAMES * 4));
+    TEST_ASSERT_EQUAL(0, out[0]);
+
+    // Three channels whose partial sums overflow but whose total does not:
+    // 30000 + 30000 - 30000 must mix to 30000, not to a clipped intermediate.
+    std::vector<uint8_t> up = make_wav_16bit_stereo(256, 30000, -20000);
+    std::vector<uint8_t> down = make_wav_16bit_stereo(256, -30000, -20000);
+    WAVStream* streams[3] = { mixer.acquire(), mixer.acquire(), mixer.acquire() };
+    TEST_ASSERT_TRUE(streams[0]->begin(up.data(), up.size()));
+    TEST_ASSERT_TRUE(streams[1]->begin(up.data(), up.size()));
+    TEST_ASSERT_TRUE(streams[2]->begin(down.data(), down.size()));
+    for (WAVStream* stream : streams) mixer.play(stream);
+
+    TEST_ASSERT_EQUAL(64, mixer.render(out, 64));
+    TEST_ASSERT_EQUAL(30000, out[0]);
+    TEST_ASSERT_EQUAL(30000, out[126]);
+    // -60000 on the right channel is soft limited just short of full scale:
+    // -(30720 + 29280 * 2047 / (29280 + 2047)).
+    TEST_ASSERT_EQUAL(-32633, out[1]);
+
+    // Without the limiter it saturates.
+    mixer.setLimiter(false);
+    TEST_ASSERT_EQUAL(64, mixer.render(out, 64));
+    TEST_ASSERT_EQUAL(30000, out[0]);
+    TEST_ASSERT_EQUAL(-32768, out[1]);
+}
+
+/**
+ * @brief Test the preallocated voice pool of SoftwareMixer.
+ * Voices are handed out up to MAX_CHANNELS and return to the pool when
+ * released or when they finish playing.
+ */
+void test_mixer_voice_pool() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    mixer.setStealPolicy(StealPolicy::NONE); // Pool behaviour only; see test_mixer_voice_stealing
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(16, 100, 100);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    WAVStream* voices[MAX_CHANNELS];
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        voices[i] = mixer.acquire();
+        TEST_ASSERT_NOT_NULL(voices[i]);
+    }
+    TEST_ASSERT_NULL(mixer.acquire());
+
+    // A released voice is handed out again.
+    mixer.release(voices[3]);
+    TEST_ASSERT_EQUAL_PTR(voices[3], mixer.acquire());
+
+    // A finished voice goes back to the pool on the next render.
+    TEST_ASSERT_TRUE(voices[0]->begin(wav.data(), wav.size()));
+    mixer.play(voices[0]);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_TRUE(voices[0]->is_finished());
+    TEST_ASSERT_NULL(mixer.acquire());
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL_PTR(voices[0], mixer.acquire());
+}
+
+/**
+ * @brief Fills the mixer with voices of `wav`, `priorities[i]` for voice i,
+ * each playing at `gains[i]` and tagged with its index.
+ */
+void fill_voices(SoftwareMixer& mixer, std::vector<uint8_t>& wav,
+                 const VoicePriority* priorities, const uint16_t* gains) {
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        WAVStream* voice = mixer.acquire(priorities[i]);
+        TEST_ASSERT_NOT_NULL(voice);
+        TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+        voice->setLooping(true);
+        mixer.play(voice, i, gains[i]);
+    }
+}
+
+/**
+ * @brief Test the steal policies, the fade-out tail of a stolen voice and
+ * the render time governor.
+ */
+void test_mixer_voice_stealing() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    mixer.setRenderBudget(0);
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(1000, 1000, 1000);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    // Voice 5 is the only ambient voice, voice 9 the quietest, voice 0 the oldest.
+    VoicePriority priorities[MAX_CHANNELS];
+    uint16_t gains[MAX_CHANNELS];
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        priorities[i] = i == 5 ? VoicePriority::AMBIENT : VoicePriority::HORN_BELL;
+        gains[i] = i == 9 ? MIXER_GAIN_UNITY / 4 : MIXER_GAIN_UNITY / 2;
+    }
+
+    // Lowest priority: the ambient voice makes room. Its level fades across
+    // the next block on top of the remaining voices.
+    fill_voices(mixer, wav, priorities, gains);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    int32_t full = out[0];
+    WAVStream* voice = mixer.acquire(VoicePriority::HORN_BELL);
+    TEST_ASSERT_NOT_NULL(voice);
+    TEST_ASSERT_EQUAL(1, controller.getStats().getVoicesStolen());
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    voice->setLooping(true);
+    mixer.play(voice, 5, 0); // Silent, so only the fade is heard
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_INT_WITHIN(8, full, out[0]);
+    TEST_ASSERT_INT_WITHIN(8, full - 500, out[MIXER_BLOCK_FRAMES * 2 - 2]);
+    for (size_t n = 1; n < MIXER_BLOCK_FRAMES; n++) {
+        TEST_ASSERT_TRUE(out[n * 2] <= out[(n - 1) * 2]);
+    }
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(full - 500, out[0]);
+
+    // A one-shot cannot steal from the remaining horn/bell voices.
+    TEST_ASSERT_NULL(mixer.acquire(VoicePriority::ONE_SHOT));
+    mixer.stopAll();
+
+    // Quietest: the voice at a quarter gain goes.
+    mixer.setStealPolicy(StealPolicy::QUIETEST);
+    fill_voices(mixer, wav, priorities, gains);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    voice = mixer.acquire(VoicePriority::PRIME_MOVER);
+    TEST_ASSERT_NOT_NULL(voice);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(full - 250, out[0]);
+    mixer.release(voice);
+    mixer.stopAll();
+
+    // Oldest: the first voice started goes, whatever its priority.
+    mixer.setStealPolicy(StealPolicy::OLDEST);
+    fill_voices(mixer, wav, priorities, gains);
+    voice = mixer.acquire(VoicePriority::HORN_BELL);
+    TEST_ASSERT_NOT_NULL(voice);
+    mixer.stop(5);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(full - 1000, out[0]);
+    mixer.release(voice);
+    mixer.stopAll();
+
+    // Governor: blocks over budget shed the ambient voice first, one voice
+    // per fade, and never the prime mover.
+    priorities[0] = VoicePriority::PRIME_MOVER;
+    mixer.setStealPolicy(StealPolicy::NONE);
+    fill_voices(mixer, wav, priorities, gains);
+    controller.resetStats();
+    mixer.setRenderBudget(1);
+    When(Method(ArduinoFake(), micros)).AlwaysDo([]() -> unsigned long {
+        static unsigned long now = 0;
+        return now += 10; // Every measurement takes 10 us
+    });
+    for (int i = 0; i < MIXER_SHED_FADE_BLOCKS + 2; i++) {
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL(1, controller.getStats().getVoicesShed());
+    TEST_ASSERT_EQUAL(MAX_CHANNELS - 1, controller.getStats().getActiveVoices());
+    for (int i = 0; i < 100; i++) {
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL(1, controller.getStats().getActiveVoices());
+    TEST_ASSERT_EQUAL(MAX_CHANNELS - 1, controller.getStats().getVoicesShed());
+    mixer.stopAll();
+}
+
+/**
+ * @brief Test a steal while the tail of an earlier steal is partly played:
+ * both fades are heard, nothing left over from the first block.
+ */
+void test_mixer_steal_partial_tail() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    mixer.setRenderBudget(0);
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(1000, 1000, 1000);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    // Voices 4 to 6 are ambient and go first, all at the same level.
+    VoicePriority priorities[MAX_CHANNELS];
+    uint16_t gains[MAX_CHANNELS];
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        priorities[i] = i >= 4 && i <= 6 ? VoicePriority::AMBIENT : VoicePriority::HORN_BELL;
+        gains[i] = MIXER_GAIN_UNITY / 2;
+    }
+    fill_voices(mixer, wav, priorities, gains);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    int32_t full = out[0];
+
+    // A steal on a block boundary gives the reference fade.
+    WAVStream* voice = mixer.acquire(VoicePriority::HORN_BELL);
+    TEST_ASSERT_NOT_NULL(voice);
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    voice->setLooping(true);
+    mixer.play(voice, 4, 0);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    int32_t fade[MIXER_BLOCK_FRAMES];
+    for (size_t n = 0; n < MIXER_BLOCK_FRAMES; n++) {
+        fade[n] = out[n * 2] - (full - 500);
+    }
+    TEST_ASSERT_INT_WITHIN(8, 500, fade[0]);
+
+    // Second steal, then a partial block. The refills update() does between
+    // blocks keep the stolen voice buffered for its whole fade.
+    const size_t partial = 32;
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        mixer.update();
+    }
+    voice = mixer.acquire(VoicePriority::HORN_BELL);
+    TEST_ASSERT_NOT_NULL(voice);
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    voice->setLooping(true);
+    mixer.play(voice, 5, 0);
+    TEST_ASSERT_EQUAL(partial, mixer.render(out, partial));
+
+    // Third steal: the rest of the second fade plus the new one.
+    voice = mixer.acquire(VoicePriority::HORN_BELL);
+    TEST_ASSERT_NOT_NULL(voice);
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    voice->setLooping(true);
+    mixer.play(voice, 6, 0);
+    TEST_ASSERT_EQUAL(3, controller.getStats().getVoicesStolen());
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    for (size_t n = 0; n < MIXER_BLOCK_FRAMES; n++) {
+        int32_t expected = full - 1500 + fade[n];
+        if (n + partial < MIXER_BLOCK_FRAMES) {
+            expected += fade[n + partial];
+        }
+        TEST_ASSERT_INT_WITHIN(2, expected, out[n * 2]);
+    }
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(full - 1500, out[0]);
+    mixer.stopAll();
+}
+
+/**
+ * @brief Renders `frames` frames of the mix into `out`, however the mixer
+ * splits them into blocks.
+ */
+void render_frames(SoftwareMixer& mixer, int16_t* out, size_t frames) {
+    while (frames > 0) {
+        size_t rendered = mixer.render(out, frames);
+        out += rendered * 2;
+        frames -= rendered;
+    }
+}
+
+/**
+ * @brief Test that scheduled play, gain and stop events take effect on
+ * their exact output frame, wherever it falls in a block.
+ */
+void test_mixer_event_timing() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(4000, 1000, -1000);
+    std::vector<int16_t> out(512 * 2);
+
+    // Start off a block boundary.
+    render_frames(mixer, out.data(), 37);
+    uint32_t start = mixer.getFrameTime();
+    TEST_ASSERT_EQUAL(37, start);
+
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(mixer.playAt(start + 100, voice, 1));
+    TEST_ASSERT_TRUE(mixer.stopAt(start + 301, 1));
+    TEST_ASSERT_TRUE(mixer.setGainAt(start + 200, 1, 0));
+    mixer.release(voice); // Scheduled voices are not handed back
+    TEST_ASSERT_FALSE(mixer.playAt(start + 10, voice, 1));
+
+    render_frames(mixer, out.data(), 512);
+    for (size_t i = 0; i < 512; i++) {
+        int16_t expected = (i >= 100 && i < 200) ? 1000 : 0;
+        if (i >= 200 && i < 301) {
+            // The gain ramp to 0 starts on frame 200.
+            TEST_ASSERT_TRUE(out[i * 2] < out[(i - 1) * 2]);
+            continue;
+        }
+        TEST_ASSERT_EQUAL_INT16(expected, out[i * 2]);
+        TEST_ASSERT_EQUAL_INT16(-expected, out[i * 2 + 1]);
+    }
+    TEST_ASSERT_EQUAL(0, controller.getStats().getActiveVoices());
+
+    // An event already due applies at the start of the next block.
+    voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(mixer.playAt(mixer.getFrameTime() - 5, voice, 2));
+    render_frames(mixer, out.data(), 1);
+    TEST_ASSERT_EQUAL_INT16(1000, out[0]);
+
+    // stop() also cancels plays that have not started yet.
+    WAVStream* pending = mixer.acquire();
+    TEST_ASSERT_TRUE(pending->begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(mixer.playAt(mixer.getFrameTime() + 50, pending, 2));
+    mixer.stop(2);
+    render_frames(mixer, out.data(), 100);
+    TEST_ASSERT_EQUAL_INT16(0, out[99 * 2]);
+    TEST_ASSERT_EQUAL_PTR(voice, mixer.acquire());
+    TEST_ASSERT_EQUAL_PTR(pending, mixer.acquire());
+}
+
+/**
+ * @brief Host stand-in for a pull-mode driver such as I2SDriver: one output
+ * buffer that is rendered in place whenever it has been "released".
+ */
+class PullTestDriver : public SoundDriver {
+public:
+    static const size_t FRAMES = 300; // Not a multiple of MIXER_BLOCK_FRAMES
+    int16_t buffer[FRAMES * 2];
+    bool released = true;
+
+    bool begin() override { return true; }
+    void play(uint16_t track) override {}
+    void setVolume(uint8_t volume) override {}
+    void loop() override {}
+    size_t availableForWrite() override { return 0; }
+    size_t write(const uint8_t* data, size_t size) override { return 0; }
+
+    bool setRenderCallback(RenderCallback callback, void* context) override {
+        _callback = callback;
+        _context = context;
+        return true;
+    }
+
+    size_t render() override {
+        if (!released) return 0;
+        _callback(_context, buffer, FRAMES);
+        released = false;
+        return FRAMES;
+    }
+
+private:
+    RenderCallback _callback = nullptr;
+    void* _context = nullptr;
+};
+
+/**
+ * @brief Test that the mixer renders straight into a pull-mode driver buffer.
+ */
+void test_mixer_pull_mode() {
+    PullTestDriver* driver = new PullTestDriver();
+    SoundController controller(driver);
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+
+    std::vector<uint8_t> wav = make_wav_tone(1000);
+    WAVStream reference;
+    TEST_ASSERT_TRUE(reference.begin(wav.data(), wav.size()));
+    int16_t expected[PullTestDriver::FRAMES * 2];
+    for (size_t done = 0; done < PullTestDriver::FRAMES; ) {
+        reference.service();
+        done += reference.read_frames(expected + done * 2, PullTestDriver::FRAMES - done);
+    }
+
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    mixer.play(voice);
+
+    mixer.update();
+    TEST_ASSERT_FALSE(driver->released);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(expected, driver->buffer, PullTestDriver::FRAMES * 2);
+
+    // Nothing is rendered until the driver releases the buffer again.
+    driver->buffer[0] = 1234;
+    mixer.update();
+    TEST_ASSERT_EQUAL(1234, driver->buffer[0]);
+}
+
+/**
+ * @brief Test that the WAV file sink records the mixer's pull-mode output
+ * into a file that reads back as the same frames.
+ */
+void test_wav_file_driver() {
+    const char* path = "test_wav_file_driver.wav";
+    const size_t blocks = 3;
+    std::vector<uint8_t> wav = make_wav_tone(WAV_FILE_BUFFER_FRAMES * blocks);
+    {
+        WAVFileDriver* driver = new WAVFileDriver();
+        TEST_ASSERT_TRUE(driver->open(path));
+        SoundController controller(driver);
+        SoftwareMixer mixer(controller);
+        mixer.begin();
+        WAVStream* voice = mixer.acquire();
+        TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+        mixer.play(voice);
+
+        // Every update is one buffer, there is no clock to wait for.
+        for (size_t i = 0; i < blocks; i++) {
+            mixer.update();
+        }
+        TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES * blocks, driver->getFramesWritten());
+        TEST_ASSERT_TRUE(driver->close());
+    }
+
+    FILE* file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    std::vector<uint8_t> written(44 + WAV_FILE_BUFFER_FRAMES * blocks * 4 + 1);
+    written.resize(fread(written.data(), 1, written.size(), file));
+    fclose(file);
+    remove(path);
+    TEST_ASSERT_EQUAL(44 + WAV_FILE_BUFFER_FRAMES * blocks * 4, written.size());
+
+    WAVStream expected, actual;
+    TEST_ASSERT_TRUE(expected.begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(actual.begin(written.data(), written.size()));
+    int16_t a[WAV_FILE_BUFFER_FRAMES * 2], b[WAV_FILE_BUFFER_FRAMES * 2];
+    for (size_t i = 0; i < blocks; i++) {
+        expected.service();
+        actual.service();
+        TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES, expected.read_frames(a, WAV_FILE_BUFFER_FRAMES));
+        TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES, actual.read_frames(b, WAV_FILE_BUFFER_FRAMES));
+        TEST_ASSERT_EQUAL_INT16_ARRAY(a, b, WAV_FILE_BUFFER_FRAMES * 2);
+    }
+
+    // A push-mode write takes no more than availableForWrite() reports.
+    WAVFileDriver driver;
+    TEST_ASSERT_TRUE(driver.open(path));
+    TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES * 4, driver.availableForWrite());
+    std::vector<uint8_t> frames(WAV_FILE_BUFFER_FRAMES * 4 * 2);
+    TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES * 4, driver.write(frames.data(), frames.size()));
+    TEST_ASSERT_EQUAL(WAV_FILE_BUFFER_FRAMES, driver.getFramesWritten());
+    TEST_ASSERT_TRUE(driver.close());
+    remove(path);
+}
+
+/**
+ * @brief Power of `signal` between `min_hz` and `max_hz` at
+ * MIXER_OUTPUT_RATE, from a Hann windowed DFT of the bins in that band.
+ */
+double band_power(const std::vector<double>& signal, double min_hz, double max_hz) {
+    const size_t n = signal.size();
+    const size_t first = min_hz > 0 ? (size_t)(min_hz * n / MIXER_OUTPUT_RATE) : 1;
+    const size_t last = (size_t)(max_hz * n / MIXER_OUTPUT_RATE);
+    std::vector<double> windowed(n);
+    for (size_t i = 0; i < n; i++) {
+        windowed[i] = signal[i] * (0.5 - 0.5 * cos(2 * M_PI * i / n));
+    }
+    double power = 0;
+    for (size_t k = first; k <= last; k++) {
+        double re = 0, im = 0;
+        for (size_t i = 0; i < n; i++) {
+            double phase = 2 * M_PI * k * i / n;
+            re += windowed[i] * cos(phase);
+            im -= windowed[i] * sin(phase);
+        }
+        power += re * re + im * im;
+    }
+    return power;
+}
+
+/**
+ * @brief Test the PWM noise shaper: it keeps the signal level and moves
+ * the requantization noise up out of the low audio band at a bounded cost
+ * over the whole band.
+ */
+void test_noise_shaper() {
+    NoiseShaper shaper(10);
+    TEST_ASSERT_EQUAL(1023, shaper.getMaxLevel());
+
+    // Dithered DC averages out to its exact level.
+    double sum = 0;
+    for (int i = 0; i < 4096; i++) sum += shaper.next(1000);
+    TEST_ASSERT_TRUE(fabs(sum / 4096 - (32768 + 1000) / 64.0) < 0.05);
+
+    // Full scale clips without the feedback running away.
+    for (int i = 0; i < 1000; i++) shaper.next(32767);
+    TEST_ASSERT_EQUAL(1023, shaper.next(32767));
+    shaper.reset();
+    for (int i = 0; i < 100; i++) shaper.next(0);
+    TEST_ASSERT_INT_WITHIN(8, 512, shaper.next(0));
+
+    // Requantization error of a 1 kHz tone, shaped and plainly rounded.
+    const size_t n = 2048;
+    std::vector<int16_t> stereo(n * 2);
+    for (size_t i = 0; i < n; i++) {
+        stereo[i * 2] = stereo[i * 2 + 1] = (int16_t)(8000 * sin(2 * M_PI * 1000 * i / MIXER_OUTPUT_RATE));
+    }
+    std::vector<uint16_t> levels(n);
+    shaper.reset();
+    shaper.convert(levels.data(), stereo.data(), n);
+    std::vector<double> shaped_error(n), plain_error(n);
+    for (size_t i = 0; i < n; i++) {
+        int32_t x = stereo[i * 2];
+        shaped_error[i] = levels[i] * 64.0 - 32768 - x;
+        plain_error[i] = ((x + 32768 + 32) >> 6) * 64.0 - 32768 - x;
+    }
+
+    // Below 2 kHz the shaped noise, dither included, is far below plain
+    // rounding. Over the audible band it is higher, since first-order
+    // shaping can only move it up within the 22 kHz of the sample rate;
+    // keep that cost bounded.
+    double shaped_low = band_power(shaped_error, 0, 2000);
+    double plain_low = band_power(plain_error, 0, 2000);
+    double shaped_all = band_power(shaped_error, 20, 20000);
+    double plain_all = band_power(plain_error, 20, 20000);
+    char msg[128];
+    snprintf(msg, sizeof(msg), "noise vs rounded: %.1f dB below 2 kHz, %.1f dB over 20 Hz-20 kHz",
+             10 * log10(shaped_low / plain_low), 10 * log10(shaped_all / plain_all));
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(shaped_low < plain_low / 4);
+    TEST_ASSERT_TRUE(shaped_all < plain_all * 8);
+}
+
+/**
+ * @brief Test the sigma-delta modulator of the PDM output against the
+ * spectrum of its bit stream, decoded as the PIO shifts it out.
+ */
+void test_sigma_delta_spectrum() {
+    SigmaDelta modulator;
+
+    // Silence is an even bit density.
+    int ones = 0;
+    for (int i = 0; i < 64; i++) ones += __builtin_popcount(modulator.modulate(0));
+    TEST_ASSERT_INT_WITHIN(2, 64 * SIGMA_DELTA_OVERSAMPLING / 2, ones);
+
+    // A 1 kHz tone at half scale, 2048 samples.
+    const size_t n = 2048;
+    std::vector<int16_t> stereo(n * 2);
+    for (size_t i = 0; i < n; i++) {
+        stereo[i * 2] = stereo[i * 2 + 1] = (int16_t)(16384 * sin(2 * M_PI * 1000 * i / MIXER_OUTPUT_RATE));
+    }
+    std::vector<uint32_t> words(n);
+    modulator.reset();
+    modulator.convert(words.data(), stereo.data(), n);
+
+    // Reference receiver: the bits, least significant first, as +-1 levels
+    // through a third-order CIC decimator back down to the sample rate.
+    const int r = SIGMA_DELTA_OVERSAMPLING;
+    std::vector<double> bits(n * r);
+    for (size_t i = 0; i < n * r; i++) {
+        bits[i] = (words[i / r] >> (i % r)) & 1 ? 1.0 : -1.0;
+    }
+    for (int stage = 0; stage < 3; stage++) {
+        double sum = 0;
+        std::vector<double> filtered(bits.size());
+        for (size_t i = 0; i < bits.size(); i++) {
+            sum += bits[i] - (i >= (size_t)r ? bits[i - r] : 0);
+            filtered[i] = sum / r;
+        }
+        bits.swap(filtered);
+    }
+    std::vector<double> decoded(n);
+    for (size_t i = 0; i < n; i++) decoded[i] = bits[i * r];
+
+    // The tone comes out at its level (inputs are halved, full scale is +-1)
+    // and the noise in the band around it is far below.
+    double tone = band_power(decoded, 900, 1100);
+    double noise = band_power(decoded, 100, 850) + band_power(decoded, 1150, 8000);
+    std::vector<double> reference(n);
+    for (size_t i = 0; i < n; i++) reference[i] = stereo[i * 2] / 65536.0;
+    double expected = band_power(reference, 900, 1100);
+    double snr = 10 * log10(tone / noise);
+    char msg[96];
+    snprintf(msg, sizeof(msg), "pdm: tone %.2f dB of expected, SNR %.1f dB to 8 kHz",
+             10 * log10(tone / expected), snr);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(fabs(10 * log10(tone / expected)) < 0.5);
+    TEST_ASSERT_TRUE(snr > 50);
+}
+
+/**
+ * @brief Test the DFPlayer command queue: frames, pacing and coalescing.
+ */
+void test_dfplayer_queue() {
+    uint8_t frame[DFPLAYER_FRAME_SIZE];
+    const uint8_t volume_15[] = {0x7E, 0xFF, 0x06, 0x06, 0x00, 0x00, 0x0F, 0xFE, 0xE6, 0xEF};
+    DFPlayerQueue::encode(DFPLAYER_CMD_SET_VOLUME, 15, frame);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(volume_15, frame, DFPLAYER_FRAME_SIZE);
+
+    DFPlayerQueue queue;
+    TEST_ASSERT_FALSE(queue.next(0, frame));
+
+    // A burst of volume steps collapses into one command, in the place of
+    // the first; a repeated track restart into one play.
+    TEST_ASSERT_TRUE(queue.setVolume(10));
+    TEST_ASSERT_TRUE(queue.play(3));
+    TEST_ASSERT_TRUE(queue.play(3));
+    TEST_ASSERT_TRUE(queue.setVolume(12));
+    TEST_ASSERT_TRUE(queue.setVolume(15));
+    TEST_ASSERT_EQUAL(2, queue.getPending());
+    TEST_ASSERT_EQUAL(3, queue.getCoalesced());
+
+    TEST_ASSERT_TRUE(queue.next(1000, frame));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(volume_15, frame, DFPLAYER_FRAME_SIZE);
+
+    // The next command waits for the interval.
+    TEST_ASSERT_FALSE(queue.next(1000 + DFPLAYER_COMMAND_INTERVAL_MS - 1, frame));
+    TEST_ASSERT_TRUE(queue.next(1000 + DFPLAYER_COMMAND_INTERVAL_MS, frame));
+    TEST_ASSERT_EQUAL_HEX8(DFPLAYER_CMD_PLAY_TRACK, frame[3]);
+    TEST_ASSERT_EQUAL_HEX8(3, frame[6]);
+
+    // Setting the volume the module already has sends nothing, also when a
+    // queued change is set back to it.
+    TEST_ASSERT_TRUE(queue.setVolume(15));
+    TEST_ASSERT_EQUAL(0, queue.getPending());
+    TEST_ASSERT_TRUE(queue.setVolume(20));
+    TEST_ASSERT_TRUE(queue.setVolume(15));
+    TEST_ASSERT_FALSE(queue.next(5000, frame));
+    TEST_ASSERT_EQUAL(0, queue.getPending());
+
+    // A full queue drops new commands instead of blocking.
+    for (int i = 0; i < DFPLAYER_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(queue.play(i + 1));
+    }
+    TEST_ASSERT_FALSE(queue.play(100));
+    TEST_ASSERT_EQUAL(1, queue.getDropped());
+    uint32_t now = 6000;
+    for (int i = 0; i < DFPLAYER_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(queue.next(now, frame));
+        TEST_ASSERT_EQUAL_HEX8(i + 1, frame[6]);
+        now += DFPLAYER_COMMAND_INTERVAL_MS;
+    }
+    TEST_ASSERT_FALSE(queue.next(now, frame));
+}
+
+/**
+ * @brief Serial link that keeps every byte written to it.
+ */
+class CaptureSerial : public Stream {
+public:
+    std::vector<uint8_t> written;
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t value) override {
+        written.push_back(value);
+        return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        written.insert(written.end(), buffer, buffer + size);
+        return size;
+    }
+};
+
+/**
+ * @brief Test that DFPlayerDriver::loop() puts the queued frames on the
+ * serial link, paced, and the UART choice by pins.
+ */
+void test_dfplayer_driver() {
+    static unsigned long now = 1000;
+    When(Method(ArduinoFake(), millis)).AlwaysDo([]() -> unsigned long { return now; });
+    CaptureSerial serial;
+    DFPlayerDriver driver(&serial);
+    TEST_ASSERT_TRUE(driver.begin());
+    driver.loop();
+    TEST_ASSERT_EQUAL(0, serial.written.size());
+
+    uint8_t frame[DFPLAYER_FRAME_SIZE];
+    driver.play(5);
+    driver.play(6);
+    driver.loop();
+    DFPlayerQueue::encode(DFPLAYER_CMD_PLAY_TRACK, 5, frame);
+    TEST_ASSERT_EQUAL(DFPLAYER_FRAME_SIZE, serial.written.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, serial.written.data(), DFPLAYER_FRAME_SIZE);
+    driver.loop();
+    TEST_ASSERT_EQUAL(DFPLAYER_FRAME_SIZE, serial.written.size());
+    now += DFPLAYER_COMMAND_INTERVAL_MS;
+    driver.loop();
+    DFPlayerQueue::encode(DFPLAYER_CMD_PLAY_TRACK, 6, frame);
+    TEST_ASSERT_EQUAL(2 * DFPLAYER_FRAME_SIZE, serial.written.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, &serial.written[DFPLAYER_FRAME_SIZE], DFPLAYER_FRAME_SIZE);
+
+    // TX on GPIO 4n, RX on the next pin, and the UART by pin group.
+    TEST_ASSERT_EQUAL(0, DFPlayerDriver::uartForPins(0, 1));
+    TEST_ASSERT_EQUAL(1, DFPlayerDriver::uartForPins(4, 5));
+    TEST_ASSERT_EQUAL(1, DFPlayerDriver::uartForPins(8, 9));
+    TEST_ASSERT_EQUAL(0, DFPlayerDriver::uartForPins(12, 13));
+    TEST_ASSERT_EQUAL(0, DFPlayerDriver::uartForPins(16, 17));
+    TEST_ASSERT_EQUAL(1, DFPlayerDriver::uartForPins(20, 21));
+    TEST_ASSERT_EQUAL(1, DFPlayerDriver::uartForPins(24, 25));
+    TEST_ASSERT_EQUAL(0, DFPlayerDriver::uartForPins(28, 29));
+    TEST_ASSERT_EQUAL(-1, DFPlayerDriver::uartForPins(9, 8));
+    TEST_ASSERT_EQUAL(-1, DFPlayerDriver::uartForPins(8, 13));
+    TEST_ASSERT_EQUAL(-1, DFPlayerDriver::uartForPins(2, 3));
+    TEST_ASSERT_EQUAL(-1, DFPlayerDriver::uartForPins(32, 33));
+
+    // Without a link the driver has no UART on the host.
+    DFPlayerDriver unopened(9, 8);
+    TEST_ASSERT_FALSE(unopened.begin());
+}
+
+/**
+ * @brief Test the sound path counters recorded by the mixer.
+ */
+void test_sound_stats() {
+    SoundStats stats;
+    stats.recordRenderTime(10);   // < 64 us
+    stats.recordRenderTime(64);   // < 128 us
+    stats.recordRenderTime(100000); // Last bucket
+    TEST_ASSERT_EQUAL(3, stats.getBlocksRendered());
+    TEST_ASSERT_EQUAL(100000, stats.getRenderUsMax());
+    TEST_ASSERT_EQUAL(1, stats.getRenderHistogram(0));
+    TEST_ASSERT_EQUAL(1, stats.getRenderHistogram(1));
+    TEST_ASSERT_EQUAL(1, stats.getRenderHistogram(SOUND_STATS_HISTOGRAM_BUCKETS - 1));
+    TEST_ASSERT_EQUAL(0, SoundStats::bucketLimitUs(SOUND_STATS_HISTOGRAM_BUCKETS - 1));
+
+    stats.recordServiceTime(3, 50);
+    stats.recordServiceTime(7, 20);
+    TEST_ASSERT_EQUAL(50, stats.getServiceUsMax());
+    TEST_ASSERT_EQUAL(3, stats.getServiceUsMaxVoice());
+
+    // The mixer records the voices it mixes per block.
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(16, 100, 100);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    for (int i = 0; i < 3; i++) {
+        WAVStream* voice = mixer.acquire();
+        TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+        mixer.play(voice, i);
+    }
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES); // All voices have finished
+    SoundStats& mixed = controller.getStats();
+    TEST_ASSERT_EQUAL(2, mixed.getBlocksRendered());
+    TEST_ASSERT_EQUAL(0, mixed.getActiveVoices());
+    TEST_ASSERT_EQUAL(3, mixed.getActiveVoicesHighWater());
+    TEST_ASSERT_EQUAL(0, controller.getUnderrunCount());
+
+    controller.dumpStats(stdout);
+    controller.resetStats();
+    TEST_ASSERT_EQUAL(0, mixed.getActiveVoicesHighWater());
+}
+
+/**
+ * @brief Builds a 16-bit stereo WAV at `rate` whose left channel ramps up by
+ * `slope` per frame and whose right channel ramps down.
+ */
+std::vector<uint8_t> make_wav_ramp(size_t frames, uint32_t rate, int slope) {
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(frames, 0, 0);
+    uint32_t byte_rate = rate * 4;
+    memcpy(&wav[24], &rate, 4);
+    memcpy(&wav[28], &byte_rate, 4);
+    for (size_t i = 0; i < frames; i++) {
+        int16_t frame[2] = { (int16_t)(i * slope), (int16_t)(-(int)i * slope) };
+        memcpy(&wav[44 + i * 4], frame, 4);
+    }
+    return wav;
+}
+
+/**
+ * @brief Test that a 22.05 kHz voice is resampled to the output rate.
+ */
+void test_mixer_resample_rate() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_ramp(1000, MIXER_OUTPUT_RATE / 2, 10);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    mixer.play(voice);
+
+    // Every source frame lasts two output frames; linear interpolation puts
+    // the midpoint in between. Blocks must join without a seam.
+    for (int block = 0; block < 3; block++) {
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+        for (size_t n = 0; n < MIXER_BLOCK_FRAMES; n++) {
+            int expected = (int)(block * MIXER_BLOCK_FRAMES + n) * 5;
+            TEST_ASSERT_EQUAL(expected, out[n * 2]);
+            TEST_ASSERT_EQUAL(-expected, out[n * 2 + 1]);
+        }
+    }
+
+    // The polyphase filter passes DC at exactly unity gain.
+    std::vector<uint8_t> dc = make_wav_16bit_stereo(1000, 12345, -30000);
+    uint32_t rate = 32000;
+    memcpy(&dc[24], &rate, 4);
+    mixer.stopAll();
+    mixer.setResampleQuality(ResampleQuality::POLYPHASE);
+    voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(dc.data(), dc.size()));
+    mixer.play(voice);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(12345, out[0]);
+    TEST_ASSERT_EQUAL(-30000, out[1]);
+    TEST_ASSERT_EQUAL(12345, out[MIXER_BLOCK_FRAMES * 2 - 2]);
+}
+
+/**
+ * @brief Test a runtime pitch change on a voice that played unresampled.
+ */
+void test_mixer_pitch() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_ramp(2000, MIXER_OUTPUT_RATE, 1);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    mixer.play(voice, 7);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES - 1, out[MIXER_BLOCK_FRAMES * 2 - 2]);
+
+    // An octave up continues right after the last frame, two frames a step.
+    mixer.setPitch(7, MIXER_PITCH_UNITY * 2);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    for (size_t n = 0; n < MIXER_BLOCK_FRAMES; n++) {
+        TEST_ASSERT_EQUAL((int)(MIXER_BLOCK_FRAMES + n * 2), out[n * 2]);
+    }
+
+    // Back to unity keeps the voice on the resampler, still without a seam.
+    mixer.setPitch(7, MIXER_PITCH_UNITY);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES * 3, out[0]);
+    TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES * 3 + 1, out[2]);
+
+    // Voices with other tags are not affected.
+    mixer.setPitch(8, MIXER_PITCH_UNITY * 3);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES * 4, out[0]);
+}
+
+/**
+ * @brief Test a voice set to the highest pitch before its first block, which
+ * reads the most source frames the resampler can ask for at once.
+ */
+void test_mixer_max_pitch() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_ramp(4000, MIXER_OUTPUT_RATE, 1);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    mixer.play(voice, 7);
+    mixer.setPitch(7, MIXER_PITCH_UNITY * (RESAMPLER_MAX_STEP / RESAMPLER_UNITY_STEP));
+
+    // Four source frames a step from the first frame on, and the mixer state
+    // next to the source buffer is left intact for the following blocks.
+    for (int block = 0; block < 3; block++) {
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+        for (size_t n = 0; n < MIXER_BLOCK_FRAMES; n++) {
+            int expected = (int)(block * MIXER_BLOCK_FRAMES + n) * 4;
+            TEST_ASSERT_EQUAL(expected, out[n * 2]);
+            TEST_ASSERT_EQUAL(-expected, out[n * 2 + 1]);
+        }
+    }
+}
+
+/**
+ * @brief Test a pitch change right after a segment shorter than the
+ * resampler history, as an event near the end of a block leaves: the
+ * polyphase kernel reaches back into the history, which must hold the
+ * frames just played.
+ */
+void test_mixer_pitch_after_short_segment() {
+    std::vector<uint8_t> wav = make_wav_tone(2000);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    int16_t expected[MIXER_BLOCK_FRAMES * 2];
+    const size_t tail = 3;
+
+    // Once as whole blocks, once with the second block split 3 frames
+    // before its end by an event.
+    for (int split = 0; split < 2; split++) {
+        SoundController controller;
+        SoftwareMixer mixer(controller);
+        mixer.begin();
+        mixer.setResampleQuality(ResampleQuality::POLYPHASE);
+        WAVStream* voice = mixer.acquire();
+        TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+        mixer.play(voice, 7);
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+        if (split) {
+            TEST_ASSERT_TRUE(mixer.setGainAt(mixer.getFrameTime() + MIXER_BLOCK_FRAMES - tail, 7, MIXER_GAIN_UNITY));
+            TEST_ASSERT_EQUAL(MIXER_BLOCK_FRAMES - tail, mixer.render(out, MIXER_BLOCK_FRAMES));
+            TEST_ASSERT_EQUAL(tail, mixer.render(out, tail));
+        } else {
+            mixer.render(out, MIXER_BLOCK_FRAMES);
+        }
+
+        // A fifth up, so most output frames fall between source frames.
+        mixer.setPitch(7, MIXER_PITCH_UNITY * 3 / 2);
+        mixer.render(split ? out : expected, MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL_INT16_ARRAY(expected, out, MIXER_BLOCK_FRAMES * 2);
+}
+
+/**
+ * @brief Test per-voice gain ramps, master gain and fade-out in the mixer.
+ */
+void test_mixer_gain() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(4000, 16384, -16384);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+
+    // A voice started at half gain plays at half level from its first frame.
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    mixer.play(voice, 1, MIXER_GAIN_UNITY / 2);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(8192, out[0]);
+    TEST_ASSERT_EQUAL(-8192, out[1]);
+
+    // A gain change ramps linearly across the next block.
+    mixer.setGain(1, MIXER_GAIN_UNITY);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_INT_WITHIN(128, 8192, out[0]);
+    TEST_ASSERT_INT_WITHIN(64, 12288, out[MIXER_BLOCK_FRAMES]);
+    TEST_ASSERT_INT_WITHIN(2, 16384, out[MIXER_BLOCK_FRAMES * 2 - 2]);
+    for (size_t n = 1; n < MIXER_BLOCK_FRAMES; n++) {
+        TEST_ASSERT_TRUE(out[n * 2] >= out[(n - 1) * 2]);
+    }
+
+    // The master gain scales every voice.
+    mixer.setMasterVolume(0);
+    TEST_ASSERT_EQUAL(0, controller.getVolume());
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(0, out[0]);
+    TEST_ASSERT_EQUAL(0, out[MIXER_BLOCK_FRAMES * 2 - 1]);
+    mixer.setMasterVolume(255);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    TEST_ASSERT_EQUAL(16384, out[0]);
+
+    // A fade of ~30 ms (10 blocks) decreases steadily, then frees the voice.
+    mixer.fadeOut(1, 30);
+    int16_t last = out[0];
+    int blocks = 0;
+    for (;;) {
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+        if (controller.getStats().getActiveVoices() == 0) break;
+        TEST_ASSERT_TRUE(out[MIXER_BLOCK_FRAMES * 2 - 2] <= last);
+        last = out[MIXER_BLOCK_FRAMES * 2 - 2];
+        TEST_ASSERT_TRUE(++blocks <= 11);
+    }
+    TEST_ASSERT_EQUAL(0, last);
+    TEST_ASSERT_TRUE(blocks >= 10);
+}
+
+/**
+ * @brief Test that refill() services the voice closest to running dry first
+ * and reads no more than its budget per call.
+ */
+void test_mixer_refill_schedule() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(4000, 1000, -1000);
+    std::vector<uint8_t> fast = make_wav_ramp(4000, MIXER_OUTPUT_RATE * 2, 1);
+    int16_t scratch[256 * 2];
+
+    // Three voices drained to different levels; the last one plays at twice
+    // the output rate, so it runs dry twice as fast as its fill suggests.
+    WAVStream* voices[3];
+    const size_t drained[3] = { 50, 200, 200 };
+    for (int i = 0; i < 3; i++) {
+        voices[i] = mixer.acquire();
+        TEST_ASSERT_TRUE(voices[i]->begin(i == 2 ? fast.data() : wav.data(), i == 2 ? fast.size() : wav.size()));
+        TEST_ASSERT_EQUAL(drained[i], voices[i]->read_frames(scratch, drained[i]));
+        mixer.play(voices[i], i);
+    }
+    size_t full = WAV_STREAM_BUFFER_SIZE / 4;
+    TEST_ASSERT_EQUAL(full - 200, voices[1]->get_buffered_frames());
+
+    // A budget of 128 frames goes to the fast voice alone.
+    mixer.setRefillBudget(128 * 4);
+    mixer.refill();
+    TEST_ASSERT_EQUAL(full - 50, voices[0]->get_buffered_frames());
+    TEST_ASSERT_EQUAL(full - 200, voices[1]->get_buffered_frames());
+    TEST_ASSERT_EQUAL(full - 200 + 128, voices[2]->get_buffered_frames());
+
+    // The next call tops up the slow voice that is now emptiest, then the rest.
+    mixer.refill();
+    TEST_ASSERT_EQUAL(full - 50, voices[0]->get_buffered_frames());
+    TEST_ASSERT_EQUAL(full - 200 + 128, voices[1]->get_buffered_frames());
+    mixer.setRefillBudget(MIXER_REFILL_BUDGET_BYTES);
+    mixer.refill();
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(full, voices[i]->get_buffered_frames());
+    }
+
+    // Voices kept full by refill() never need servicing in the mix pass.
+    controller.resetStats();
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    for (int i = 0; i < 10; i++) {
+        mixer.refill();
+        mixer.render(out, MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL(0, controller.getStats().getRefillMisses());
+    TEST_ASSERT_EQUAL(3, controller.getStats().getActiveVoices());
+}
+
+// --- IMA-ADPCM reference ---
+// A straightforward per-sample coder written from the IMA/DVI spec, kept
+// separate from the firmware kernel so the two can be compared bit for bit.
+
+static const int ref_ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const int ref_ima_index[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+struct RefImaState { int predictor; int index; };
+
+static int16_t ref_ima_decode(RefImaState& st, int code) {
+    int step = ref_ima_steps[st.index];
+    int diff = step >> 3;
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+    st.predictor += (code & 8) ? -diff : diff;
+    st.predictor = std::max(-32768, std::min(32767, st.predictor));
+    st.index = std::max(0, std::min(88, st.index + ref_ima_index[code & 7]));
+    return (int16_t)st.predictor;
+}
+
+static int ref_ima_encode(RefImaState& st, int sample) {
+    int step = ref_ima_steps[st.index];
+    int diff = sample - st.predictor;
+    int code = 0;
+    if (diff < 0) { code = 8; diff = -diff; }
+    if (diff >= step) { code |= 4; diff -= step; }
+    if (diff >= step >> 1) { code |= 2; diff -= step >> 1; }
+    if (diff >= step >> 2) { code |= 1; }
+    ref_ima_decode(st, code); // Track the decoder's state
+    return code;
+}
+
+/**
+ * @brief Encodes interleaved PCM into an IMA-ADPCM WAV image with a 20-byte
+ * "fmt " chunk and a "fact" chunk, as written by common encoders.
+ */
+std::vector<uint8_t> make_wav_ima_adpcm(const std::vector<int16_t>& pcm, uint16_t channels, uint16_t block_align) {
+    size_t frames = pcm.size() / channels;
+    size_t per_block = (block_align / (4 * channels) - 1) * 8 + 1;
+    std::vector<uint8_t> data;
+    RefImaState st[2] = { { 0, 0 }, { 0, 0 } };
+    for (size_t start = 0; start < frames; start += per_block) {
+        size_t n = std::min(per_block, frames - start);
+        for (uint16_t ch = 0; ch < channels; ch++) {
+            st[ch].predictor = pcm[start * channels + ch];
+            data.push_back(st[ch].predictor & 0xFF);
+            data.push_back((st[ch].predictor >> 8) & 0xFF);
+            data.push_back((uint8_t)st[ch].index);
+            data.push_back(0);
+        }
+        // Groups of 8 samples per channel; a short last block is padded
+        // with silence to a whole group.
+        for (size_t g = 1; g < n; g += 8) {
+            for (uint16_t ch = 0; ch < channels; ch++) {
+                for (int b = 0; b < 4; b++) {
+                    int codes[2];
+                    for (int k = 0; k < 2; k++) {
+                        size_t i = g + b * 2 + k;
+                        int sample = i < n ? pcm[(start + i) * channels + ch] : 0;
+                        codes[k] = ref_ima_encode(st[ch], sample);
+                    }
+                    data.push_back((uint8_t)(codes[0] | (codes[1] << 4)));
+                }
+            }
+        }
+    }
+
+    std::vector<uint8_t> wav;
+    auto put = [&](const void* p, size_t n) { wav.insert(wav.end(), (const uint8_t*)p, (const uint8_t*)p + n); };
+    auto put16 = [&](uint16_t v) { put(&v, 2); };
+    auto put32 = [&](uint32_t v) { put(&v, 4); };
+    put("RIFF", 4); put32(4 + 28 + 12 + 8 + data.size());
+    put("WAVE", 4);
+    put("fmt ", 4); put32(20);
+    put16(IMA_ADPCM_FORMAT_TAG); put16(channels); put32(44100);
+    put32(44100 * block_align / per_block); put16(block_align); put16(4);
+    put16(2); put16((uint16_t)per_block);
+    put("fact", 4); put32(4); put32((uint32_t)frames);
+    put("data", 4); put32(data.size());
+    put(data.data(), data.size());
+    return wav;
+}
+
+/**
+ * @brief Decodes an IMA-ADPCM WAV image built by make_wav_ima_adpcm() with
+ * the reference decoder, to interleaved 16-bit stereo.
+ */
+std::vector<int16_t> ref_ima_decode_wav(const std::vector<uint8_t>& wav, uint16_t channels, uint16_t block_align) {
+    const size_t data_start = 12 + 28 + 12 + 8;
+    std::vector<int16_t> out;
+    for (size_t block = data_start; block < wav.size(); block += block_align) {
+        size_t end = std::min(wav.size(), block + (size_t)block_align);
+        RefImaState st[2];
+        for (uint16_t ch = 0; ch < channels; ch++) {
+            st[ch].predictor = (int16_t)(wav[block + ch * 4] | (wav[block + ch * 4 + 1] << 8));
+            st[ch].index = std::min(88, (int)wav[block + ch * 4 + 2]);
+        }
+        out.push_back((int16_t)st[0].predictor);
+        out.push_back((int16_t)st[channels - 1].predictor);
+        for (size_t group = block + 4 * channels; group + 4 * channels <= end; group += 4 * channels) {
+            int16_t decoded[2][8];
+            for (uint16_t ch = 0; ch < channels; ch++) {
+                for (int i = 0; i < 8; i++) {
+                    uint8_t byte = wav[group + ch * 4 + i / 2];
+                    decoded[ch][i] = ref_ima_decode(st[ch], (i & 1) ? byte >> 4 : byte & 0x0F);
+                }
+            }
+            for (int i = 0; i < 8; i++) {
+                out.push_back(decoded[0][i]);
+                out.push_back(decoded[channels - 1][i]);
+            }
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Builds a PCM test signal with steps and sweeps, which drive the
+ * ADPCM step index over its whole range.
+ */
+std::vector<int16_t> make_adpcm_test_signal(size_t frames, uint16_t channels) {
+    std::vector<int16_t> pcm(frames * channels);
+    uint32_t noise = 98765;
+    for (size_t i = 0; i < frames; i++) {
+        for (uint16_t ch = 0; ch < channels; ch++) {
+            noise = noise * 1103515245 + 12345;
+            int v = (int)((i * (37 + ch * 11)) % 20000) - 10000;
+            if ((i / 300) % 3 == 1) v = (i & 64) ? 32767 : -32768; // Full scale square
+            v += (int)((noise >> 16) & 0x1FF) - 256;
+            pcm[i * channels + ch] = (int16_t)std::max(-32768, std::min(32767, v));
+        }
+    }
+    return pcm;
+}
+
+/**
+ * @brief Test the IMA-ADPCM kernel against a hand-decoded group.
+ */
+void test_ima_adpcm_kernel() {
+    // Header: predictor 0, step index 0. Nibble 7 adds 0 + 1 + 3 + 7 = 11 and
+    // moves the index to 8 (step 16); nibble 0 then adds 16 >> 3 = 2.
+    const uint8_t block[8] = { 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00 };
+    ImaAdpcmChannel state[1];
+    int16_t out[9 * 2];
+    ima_adpcm_decode_header(state, 1, block, out);
+    ima_adpcm_decode_groups(state, 1, block + 4, 1, out + 2);
+    TEST_ASSERT_EQUAL(0, out[0]);
+    TEST_ASSERT_EQUAL(11, out[2]);
+    TEST_ASSERT_EQUAL(11, out[3]); // Mono is duplicated to the right channel
+    TEST_ASSERT_EQUAL(13, out[4]);
+    TEST_ASSERT_EQUAL(9, ima_adpcm_frames_per_block(8, 1));
+    TEST_ASSERT_EQUAL(1017, ima_adpcm_frames_per_block(1024, 2));
+}
+
+/**
+ * @brief Test WAVStream decoding of IMA-ADPCM bit for bit against the
+ * reference decoder, for mono and stereo, with a short last block and
+ * reads that do not line up with groups or blocks.
+ */
+void test_wav_stream_ima_adpcm() {
+    const uint16_t configs[][2] = { { 1, 256 }, { 2, 512 }, { 2, 1024 } };
+    const size_t reads[] = { 1, 7, 8, 37, 128, 3 };
+    for (auto& config : configs) {
+        uint16_t channels = config[0], align = config[1];
+        std::vector<int16_t> pcm = make_adpcm_test_signal(5000, channels);
+        std::vector<uint8_t> wav = make_wav_ima_adpcm(pcm, channels, align);
+        std::vector<int16_t> expected = ref_ima_decode_wav(wav, channels, align);
+
+        WAVStream stream;
+        TEST_ASSERT_TRUE(stream.begin(wav.data(), wav.size()));
+        TEST_ASSERT_EQUAL(IMA_ADPCM_FORMAT_TAG, stream.get_audio_format());
+        TEST_ASSERT_EQUAL(expected.size() / 2, stream.get_total_samples());
+
+        std::vector<int16_t> decoded;
+        int16_t chunk[128 * 2];
+        for (size_t r = 0; !stream.is_finished(); r++) {
+            stream.service();
+            size_t got = stream.read_frames(chunk, reads[r % 6]);
+            decoded.insert(decoded.end(), chunk, chunk + got * 2);
+        }
+        TEST_ASSERT_EQUAL(expected.size(), decoded.size());
+        TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), decoded.data(), expected.size());
+    }
+}
+
+/**
+ * @brief Test that a looping IMA-ADPCM stream restarts on a block boundary.
+ */
+void test_wav_stream_ima_adpcm_loop() {
+    // 3 frames past a whole block, so the data ends in a short block.
+    std::vector<int16_t> pcm = make_adpcm_test_signal(505 + 3, 1);
+    std::vector<uint8_t> wav = make_wav_ima_adpcm(pcm, 1, 256);
+    std::vector<int16_t> expected = ref_ima_decode_wav(wav, 1, 256);
+    size_t length = expected.size() / 2;
+
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(wav.data(), wav.size()));
+    stream.setLooping(true);
+    std::vector<int16_t> decoded;
+    int16_t chunk[100 * 2];
+    while (decoded.size() < length * 2 * 3) {
+        stream.service();
+        size_t got = stream.read_frames(chunk, 100);
+        decoded.insert(decoded.end(), chunk, chunk + got * 2);
+    }
+    TEST_ASSERT_FALSE(stream.is_finished());
+    for (int pass = 0; pass < 3; pass++) {
+        TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), decoded.data() + pass * length * 2, length * 2);
+    }
+}
+
+/**
+ * @brief Appends a "smpl" chunk with one loop over frames [start, end] (end
+ * inclusive, as in the file format) to `wav`.
+ */
+void add_wav_loop_points(std::vector<uint8_t>& wav, uint32_t start, uint32_t end) {
+    uint8_t smpl[8 + 36 + 24] = {0};
+    uint32_t size = sizeof(smpl) - 8;
+    uint32_t loops = 1;
+    memcpy(smpl, "smpl", 4);
+    memcpy(smpl + 4, &size, 4);
+    memcpy(smpl + 8 + 28, &loops, 4);
+    memcpy(smpl + 8 + 36 + 8, &start, 4);
+    memcpy(smpl + 8 + 36 + 12, &end, 4);
+    wav.insert(wav.end(), smpl, smpl + sizeof(smpl));
+    uint32_t riff_size = wav.size() - 8;
+    memcpy(&wav[4], &riff_size, 4);
+}
+
+/**
+ * @brief Test that a stream with a "smpl" chunk plays its intro once and
+ * then repeats the loop region bit-exactly, serving each wrap from the RAM
+ * copy of the loop head.
+ */
+void test_wav_stream_loop_points() {
+    std::vector<uint8_t> wav = make_wav_ramp(2000, MIXER_OUTPUT_RATE, 1);
+    add_wav_loop_points(wav, 500, 1499);
+
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(wav.data(), wav.size()));
+    TEST_ASSERT_TRUE(stream.has_loop_points());
+    TEST_ASSERT_EQUAL(500, stream.get_loop_start());
+    TEST_ASSERT_EQUAL(1500, stream.get_loop_end());
+    stream.setLooping(true);
+
+    std::vector<int16_t> decoded;
+    int16_t chunk[100 * 2];
+    bool head_overwritten = false;
+    while (decoded.size() < (500 + 3 * 1000) * 2) {
+        if (!head_overwritten && decoded.size() >= 1200 * 2) {
+            // Later passes must not read the loop head from the source again.
+            memset(&wav[44 + 500 * 4], 0x7F, WAV_STREAM_LOOP_HEAD_SIZE);
+            head_overwritten = true;
+        }
+        stream.service();
+        size_t got = stream.read_frames(chunk, 100);
+        decoded.insert(decoded.end(), chunk, chunk + got * 2);
+    }
+    for (size_t i = 0; i < 500 + 3 * 1000; i++) {
+        int16_t expected = (int16_t)(i < 500 ? i : 500 + (i - 500) % 1000);
+        TEST_ASSERT_EQUAL_INT16(expected, decoded[i * 2]);
+        TEST_ASSERT_EQUAL_INT16(-expected, decoded[i * 2 + 1]);
+    }
+
+    // Without looping the stream plays on past the loop end.
+    stream.setLooping(false);
+    size_t frames = 0;
+    for (int i = 0; i < 100 && !stream.is_finished(); i++) {
+        stream.service();
+        frames += stream.read_frames(chunk, 100);
+    }
+    TEST_ASSERT_TRUE(stream.is_finished());
+    TEST_ASSERT_TRUE(frames > 500);
+}
+
+/**
+ * @brief Test that the loop crossfade blends the loop tail into the frames
+ * leading up to the loop start.
+ */
+void test_wav_stream_loop_crossfade() {
+    std::vector<uint8_t> wav = make_wav_ramp(2000, MIXER_OUTPUT_RATE, 1);
+    add_wav_loop_points(wav, 500, 1499);
+
+    WAVStream stream;
+    TEST_ASSERT_TRUE(stream.begin(wav.data(), wav.size()));
+    stream.setLooping(true);
+    stream.setLoopCrossfade(16);
+
+    std::vector<int16_t> decoded;
+    int16_t chunk[100 * 2];
+    while (decoded.size() < 2600 * 2) {
+        stream.service();
+        size_t got = stream.read_frames(chunk, 100);
+        decoded.insert(decoded.end(), chunk, chunk + got * 2);
+    }
+    // The intro and the loop body are untouched.
+    for (size_t i = 0; i < 1484; i++) {
+        TEST_ASSERT_EQUAL_INT16((int16_t)i, decoded[i * 2]);
+    }
+    // The tail moves from 1484.. towards the lead-in 484.., so it ends one
+    // step short of the loop start and the wrap continues from there.
+    int16_t previous = decoded[1483 * 2];
+    for (size_t k = 0; k < 16; k++) {
+        int16_t sample = decoded[(1484 + k) * 2];
+        int32_t w = (int32_t)(((k + 1) << 15) / 17);
+        int16_t expected = (int16_t)(((1484 + (int)k) * (32768 - w) + (484 + (int)k) * w) >> 15);
+        TEST_ASSERT_EQUAL_INT16(expected, sample);
+        TEST_ASSERT_TRUE(sample < previous || k == 0);
+        previous = sample;
+    }
+    TEST_ASSERT_INT_WITHIN(70, 500, decoded[1499 * 2]);
+    TEST_ASSERT_EQUAL_INT16(500, decoded[1500 * 2]);
+    TEST_ASSERT_EQUAL_INT16(1000, decoded[2000 * 2]);
+}
+
+/**
+ * @brief Test the function-to-sound index compiled by VSDConfigParser.
+ * Verifies sounds are interned to IDs with their type resolved to an enum.
+ */
+void test_vsd_config_function_index() {
+    char xml[] =
+        "<vsd>"
+        "<sound name=\"horn.wav\" type=\"ONE_SHOT\"><trigger function=\"2\"/></sound>"
+        "<sound name=\"engine.wav\" type=\"CONTINUOUS_LOOP\"><trigger function=\"8\"/></sound>"
+        "<sound name=\"bell.wav\"><trigger function=\"2\"/><trigger function=\"40\"/></sound>"
+        "</vsd>";
+    VSDConfigParser parser;
+    TEST_ASSERT_TRUE(parser.parse(xml, strlen(xml)));
+    TEST_ASSERT_EQUAL(3, parser.get_sound_count());
+
+    int count = 0;
+    const uint8_t* ids = parser.get_function_sounds(2, &count);
+    TEST_ASSERT_EQUAL(2, count);
+    TEST_ASSERT_EQUAL(0, ids[0]); // horn.wav, in file order
+    TEST_ASSERT_EQUAL(2, ids[1]); // bell.wav
+    TEST_ASSERT_TRUE(parser.get_sound(ids[1]).type == SoundType::ONE_SHOT);
+
+    ids = parser.get_function_sounds(8, &count);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_TRUE(parser.get_sound(ids[0]).type == SoundType::CONTINUOUS_LOOP);
+
+    parser.get_function_sounds(1, &count);
+    TEST_ASSERT_EQUAL(0, count);
+    // Function numbers outside F0-F28 are not indexed.
+    parser.get_function_sounds(40, &count);
+    TEST_ASSERT_EQUAL(0, count);
+
+    // Nothing is resolved until resolve_assets() is called.
+    TEST_ASSERT_FALSE(parser.get_sound(0).is_resolved);
+}
+
+/**
+ * @brief Notch loops for the prime mover tests: one WAV per notch whose
+ * level is 1000 times the notch number plus one.
+ */
+struct NotchSounds {
+    SoftwareMixer* mixer;
+    std::vector<uint8_t> wavs[3];
+};
+
+WAVStream* open_test_notch(void* context, uint8_t sound_id) {
+    NotchSounds* sounds = static_cast<NotchSounds*>(context);
+    WAVStream* stream = sounds->mixer->acquire(VoicePriority::PRIME_MOVER);
+    if (stream && !stream->begin(sounds->wavs[sound_id].data(), sounds->wavs[sound_id].size())) {
+        sounds->mixer->release(stream);
+        return nullptr;
+    }
+    return stream;
+}
+
+/**
+ * @brief Renders one block and runs the prime mover like the audio loop.
+ */
+int16_t prime_mover_block(PrimeMover& engine, SoftwareMixer& mixer) {
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    engine.update();
+    mixer.render(out, MIXER_BLOCK_FRAMES);
+    return out[MIXER_BLOCK_FRAMES * 2 - 2];
+}
+
+/**
+ * @brief Test that the prime mover notches with speed and load, one notch
+ * at a time, along an equal-power crossfade.
+ */
+void test_prime_mover() {
+    // The table keeps the summed power of both voices constant.
+    for (uint8_t k = 0; k < PRIME_MOVER_CROSSFADE_STEPS; k++) {
+        double in = PrimeMover::crossfadeGain(k) / 32768.0;
+        double out = PrimeMover::crossfadeGain(PRIME_MOVER_CROSSFADE_STEPS - 1 - k) / 32768.0;
+        TEST_ASSERT_TRUE(fabs(in * in + out * out - 1.0) < 0.001);
+    }
+
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    mixer.setRenderBudget(0);
+    NotchSounds sounds;
+    sounds.mixer = &mixer;
+    for (int i = 0; i < 3; i++) {
+        sounds.wavs[i] = make_wav_16bit_stereo(1000, 1000 * (i + 1), 0);
+    }
+    const uint8_t notches[3] = { 0, 1, 2 };
+
+    PrimeMover engine(mixer);
+    engine.setOpener(open_test_notch, &sounds);
+    engine.setNotches(notches, 3);
+    TEST_ASSERT_TRUE(engine.hasSound(2));
+    engine.setCrossfadeTime(100);
+    engine.start();
+    TEST_ASSERT_TRUE(engine.isRunning());
+    TEST_ASSERT_EQUAL(1000, prime_mover_block(engine, mixer));
+
+    // Opening the throttle adds acceleration load, so the engine heads for
+    // the top notch, passing through notch 1.
+    engine.setSpeed(128);
+    TEST_ASSERT_EQUAL(255, engine.getLoad());
+    TEST_ASSERT_EQUAL(2, engine.getTargetNotch());
+    prime_mover_block(engine, mixer);
+    TEST_ASSERT_TRUE(engine.isCrossfading());
+    TEST_ASSERT_EQUAL(1, engine.getNotch());
+    TEST_ASSERT_EQUAL(2, controller.getStats().getActiveVoices());
+
+    // Halfway through, both loops play at -3 dB.
+    uint32_t half = 100 * MIXER_OUTPUT_RATE / 1000 / 2;
+    int16_t level = 0;
+    while (mixer.getFrameTime() < half) {
+        level = prime_mover_block(engine, mixer);
+    }
+    TEST_ASSERT_INT_WITHIN(120, (1000 + 2000) * 23170 / 32768, level);
+
+    int blocks = 0;
+    while (engine.isCrossfading()) {
+        prime_mover_block(engine, mixer);
+        TEST_ASSERT_TRUE(++blocks < 100);
+    }
+
+    // Notch 1 is reached at full level, and as the load still calls for
+    // notch 2 the next change starts right away.
+    TEST_ASSERT_EQUAL(2000, prime_mover_block(engine, mixer));
+    TEST_ASSERT_TRUE(engine.isCrossfading());
+    TEST_ASSERT_EQUAL(2, engine.getNotch());
+    while (engine.isCrossfading()) {
+        prime_mover_block(engine, mixer);
+    }
+    TEST_ASSERT_EQUAL(3000, prime_mover_block(engine, mixer));
+    TEST_ASSERT_EQUAL(1, controller.getStats().getActiveVoices());
+
+    // Once the train has caught up, the load is gone and half speed needs
+    // notch 1 only.
+    for (int i = 0; i < 1000 && engine.getLoad() > 0; i++) {
+        prime_mover_block(engine, mixer);
+    }
+    TEST_ASSERT_EQUAL(0, engine.getLoad());
+    TEST_ASSERT_EQUAL(1, engine.getTargetNotch());
+    for (int i = 0; i < 100; i++) {
+        prime_mover_block(engine, mixer);
+    }
+    TEST_ASSERT_EQUAL(1, engine.getNotch());
+    TEST_ASSERT_EQUAL(2000, prime_mover_block(engine, mixer));
+
+    // An external load counts as well.
+    engine.setLoad(255);
+    TEST_ASSERT_EQUAL(2, engine.getTargetNotch());
+    engine.setLoad(0);
+
+    // A refill budget too small for two loops switches notches directly.
+    mixer.setRefillBudget(256);
+    engine.setSpeed(0);
+    prime_mover_block(engine, mixer);
+    TEST_ASSERT_FALSE(engine.isCrossfading());
+    TEST_ASSERT_EQUAL(0, engine.getNotch());
+    TEST_ASSERT_EQUAL(1000, prime_mover_block(engine, mixer));
+    TEST_ASSERT_EQUAL(1, controller.getStats().getActiveVoices());
+
+    engine.stop(0);
+    TEST_ASSERT_FALSE(engine.isRunning());
+    prime_mover_block(engine, mixer);
+    TEST_ASSERT_EQUAL(0, controller.getStats().getActiveVoices());
+
+    // The parser orders the PRIME_MOVER sounds by notch.
+    char xml[] =
+        "<vsd>"
+        "<sound name=\"notch2.wav\" type=\"PRIME_MOVER\" notch=\"2\"/>"
+        "<sound name=\"horn.wav\"/>"
+        "<sound name=\"idle.wav\" type=\"PRIME_MOVER\" notch=\"0\"/>"
+        "<sound name=\"notch1.wav\" type=\"PRIME_MOVER\" notch=\"1\"/>"
+        "</vsd>";
+    VSDConfigParser parser;
+    TEST_ASSERT_TRUE(parser.parse(xml, strlen(xml)));
+    uint8_t ids[PRIME_MOVER_MAX_NOTCHES];
+    TEST_ASSERT_EQUAL(3, parser.get_notch_sounds(ids, PRIME_MOVER_MAX_NOTCHES));
+    TEST_ASSERT_EQUAL(2, ids[0]);
+    TEST_ASSERT_EQUAL(3, ids[1]);
+    TEST_ASSERT_EQUAL(0, ids[2]);
+}
+
+/**
+ * @brief Test the chuff rate from the wheel geometry and that chuffs start
+ * evenly spaced on their exact frames, from samples in RAM.
+ */
+void test_chuff_generator() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    ChuffGenerator chuffs(mixer);
+    std::vector<uint8_t> chuff_a = make_wav_16bit_stereo(20, 1000, 1000);
+    std::vector<uint8_t> chuff_b = make_wav_16bit_stereo(20, 2000, 2000);
+    TEST_ASSERT_TRUE(chuffs.addSample(chuff_a.data(), chuff_a.size()));
+    TEST_ASSERT_TRUE(chuffs.addSample(chuff_b.data(), chuff_b.size()));
+
+    // 500 mm/s on 20 mm wheels, 4 chuffs per revolution: 31.83 chuffs/s.
+    chuffs.setSpeed(255);
+    TEST_ASSERT_EQUAL(31830, chuffs.getChuffRate());
+    chuffs.setSpeed(0);
+    TEST_ASSERT_EQUAL(0, chuffs.getChuffRate());
+    chuffs.setSpeed(128);
+    chuffs.setWheelDiameter(40);
+    chuffs.setChuffsPerRevolution(2);
+    TEST_ASSERT_EQUAL(3994, chuffs.getChuffRate());
+    chuffs.setWheelDiameter(1);
+    chuffs.setSpeed(255);
+    TEST_ASSERT_EQUAL(CHUFF_MAX_RATE * 1000, chuffs.getChuffRate());
+
+    chuffs.setWheelDiameter(20);
+    chuffs.setChuffsPerRevolution(4);
+    std::vector<int16_t> out(MIXER_BLOCK_FRAMES * 2);
+    std::vector<uint32_t> onsets;
+    std::vector<int16_t> levels;
+    int16_t last = 0;
+    chuffs.start();
+    for (int block = 0; block < 400; block++) {
+        chuffs.update();
+        uint32_t time = mixer.getFrameTime();
+        render_frames(mixer, out.data(), MIXER_BLOCK_FRAMES);
+        for (size_t i = 0; i < MIXER_BLOCK_FRAMES; i++) {
+            if (out[i * 2] != 0 && last == 0) {
+                onsets.push_back(time + i);
+                levels.push_back(out[i * 2]);
+            }
+            last = out[i * 2];
+        }
+    }
+    // 400 blocks are 1.16 s; the next chuff is already scheduled.
+    TEST_ASSERT_EQUAL(36, onsets.size());
+    TEST_ASSERT_EQUAL(37, chuffs.getChuffCount());
+    chuffs.stop();
+    const double interval = MIXER_OUTPUT_RATE * 1000.0 / 31830;
+    for (size_t n = 0; n < onsets.size(); n++) {
+        // Each chuff lands on the frame after its ideal time, without drift.
+        double expected = (n + 1) * interval;
+        TEST_ASSERT_TRUE(onsets[n] >= expected && onsets[n] < expected + 2);
+        // The samples take turns.
+        TEST_ASSERT_EQUAL_INT16(n % 2 ? 2000 : 1000, levels[n]);
+    }
+    TEST_ASSERT_EQUAL(0, controller.getStats().getActiveVoices());
+    TEST_ASSERT_EQUAL(0, controller.getStats().getDroppedPlays());
+
+    // Standing still, no chuffs are scheduled.
+    chuffs.setSpeed(0);
+    chuffs.start();
+    for (int block = 0; block < 100; block++) {
+        chuffs.update();
+        render_frames(mixer, out.data(), MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL(0, chuffs.getChuffCount());
+    chuffs.stop();
+
+    // With every voice held by the engine loop, chuffs are dropped rather
+    // than stealing one.
+    VoicePriority priorities[MAX_CHANNELS];
+    uint16_t gains[MAX_CHANNELS];
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        priorities[i] = VoicePriority::PRIME_MOVER;
+        gains[i] = MIXER_GAIN_UNITY / 16;
+    }
+    fill_voices(mixer, chuff_a, priorities, gains);
+    chuffs.setSpeed(255);
+    chuffs.start();
+    for (int block = 0; block < 100; block++) {
+        chuffs.update();
+        render_frames(mixer, out.data(), MIXER_BLOCK_FRAMES);
+    }
+    TEST_ASSERT_EQUAL(0, chuffs.getChuffCount());
+    TEST_ASSERT_EQUAL(0, controller.getStats().getVoicesStolen());
+    TEST_ASSERT_EQUAL(MAX_CHANNELS, controller.getStats().getActiveVoices());
+    chuffs.stop();
+    mixer.stopAll();
+}
+
+/**
+ * @brief Test SpscQueue ordering between a producer and a consumer thread.
+ * Every item must arrive exactly once and in order; throughput is reported.
+ */
+void test_spsc_queue_threads() {
+    const uint32_t items = 200000;
+    static SpscQueue<uint32_t, 32> queue;
+    uint32_t out_of_order = 0;
+    uint32_t received = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        uint32_t expected = 0, value;
+        while (expected < items) {
+            if (queue.pop(value)) {
+                if (value != expected) out_of_order++;
+                expected++;
+                received++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (uint32_t i = 0; i < items;) {
+        if (queue.push(i)) {
+            i++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_EQUAL(items, received);
+    TEST_ASSERT_EQUAL(0, out_of_order);
+    TEST_ASSERT_TRUE(queue.empty());
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "spsc queue: %.1f ns per item across threads", (double)ns / items);
+    TEST_MESSAGE(msg);
+}
+
+/**
+ * @brief Test the AudioEngine running on its host thread stand-in.
+ * Commands posted from the test thread are executed on the engine thread.
+ */
+void test_audio_engine_host_thread() {
+    SoundController controller;
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    AudioEngine engine(mixer);
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(4096, 100, 100);
+
+    // A looping voice tagged with sound 7, started from this thread before
+    // the engine runs.
+    WAVStream* voice = mixer.acquire();
+    TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+    voice->setLooping(true);
+    mixer.play(voice, 7);
+
+    engine.startThread();
+    const uint32_t commands = 1000;
+    for (uint32_t i = 0; i < commands;) {
+        if (engine.setVolume(i & 0xFF)) {
+            i++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    while (!engine.stop(7)) {
+        std::this_thread::yield();
+    }
+    while (engine.getCommandCount() < commands + 1) {
+        std::this_thread::yield();
+    }
+    engine.stopThread();
+
+    // The stop command freed the voice.
+    TEST_ASSERT_EQUAL_PTR(voice, mixer.acquire());
+}
+
+/**
+ * @brief Sound driver that records the tracks it is asked to play.
+ */
+class TrackTestDriver : public SoundDriver {
+public:
+    int plays = 0;
+    uint16_t last_track = 0;
+
+    bool begin() override { return true; }
+    void play(uint16_t track) override { plays++; last_track = track; }
+    void setVolume(uint8_t volume) override {}
+    void loop() override {}
+    size_t availableForWrite() override { return 0; }
+    size_t write(const uint8_t* data, size_t size) override { return 0; }
+};
+
+/**
+ * @brief Test that a driver track is played by the audio core, from the
+ * command queue, not by the caller.
+ */
+void test_audio_engine_play_track() {
+    TrackTestDriver* driver = new TrackTestDriver();
+    SoundController controller(driver);
+    SoftwareMixer mixer(controller);
+    mixer.begin();
+    AudioEngine engine(mixer);
+
+    TEST_ASSERT_TRUE(engine.playTrack(1));
+    TEST_ASSERT_EQUAL(0, driver->plays);
+    engine.loop();
+    TEST_ASSERT_EQUAL(1, driver->plays);
+    TEST_ASSERT_EQUAL(1, driver->last_track);
+}
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Benchmarks
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+// Host benchmarks report timings through TEST_MESSAGE. They only assert on
+// correctness, so they stay stable on loaded CI machines.
+
+const int BENCH_BLOCKS = 2000;
+
+/**
+ * @brief Reports the mixer cost in ns per output sample for 1, 4, 8 and 16 channels.
+ * The legacy per-sample mix (one get_next_sample() and one saturation per
+ * channel and sample) is measured alongside as a reference.
+ */
+void test_benchmark_mixer_render() {
+    const int channel_counts[] = { 1, 4, 8, 16 };
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(MIXER_BLOCK_FRAMES * 64, 1000, -1000);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    char msg[128];
+
+    for (int channels : channel_counts) {
+        SoundController controller;
+        SoftwareMixer mixer(controller);
+        for (int c = 0; c < channels; c++) {
+            WAVStream* stream = mixer.acquire();
+            TEST_ASSERT_TRUE(stream->begin(wav.data(), wav.size()));
+            stream->setLooping(true);
+            mixer.play(stream);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int b = 0; b < BENCH_BLOCKS; b++) {
+            mixer.render(out, MIXER_BLOCK_FRAMES);
+        }
+        auto block_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        TEST_ASSERT_EQUAL(1000 * channels, out[0]);
+
+        // Reference: per-sample pull and per-channel saturation.
+        std::vector<WAVStream> refs(channels);
+        for (WAVStream& ref : refs) {
+            ref.begin(wav.data(), wav.size());
+            ref.setLooping(true);
+        }
+        start = std::chrono::steady_clock::now();
+        for (int b = 0; b < BENCH_BLOCKS; b++) {
+            memset(out, 0, sizeof(out));
+            for (WAVStream& ref : refs) {
+                ref.service();
+                for (size_t j = 0; j < MIXER_BLOCK_FRAMES; j++) {
+                    int16_t l, r;
+                    ref.get_next_sample(&l, &r);
+                    out[j * 2] = (int16_t)max(min(out[j * 2] + l, 32767), -32768);
+                    out[j * 2 + 1] = (int16_t)max(min(out[j * 2 + 1] + r, 32767), -32768);
+                }
+            }
+        }
+        auto ref_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        double samples = (double)BENCH_BLOCKS * MIXER_BLOCK_FRAMES * 2;
+        snprintf(msg, sizeof(msg), "mixer %2d ch: block %.2f ns/sample, per-sample reference %.2f ns/sample",
+                 channels, block_ns / samples, ref_ns / samples);
+        TEST_MESSAGE(msg);
+    }
+}
+
+/**
+ * @brief Reports the per-voice CPU cost of playing a DEFLATE entry versus a
+ * STORED one, so each asset can be stored or compressed deliberately.
+ * The load figure is the share of one core needed for a 44.1 kHz stereo voice.
+ */
+void test_benchmark_inflate_source() {
+    const size_t frames = 44100; // One second of audio
+    std::vector<uint8_t> wav = make_wav_tone(frames);
+    std::vector<uint8_t> packed = deflate_raw(wav);
+    InflateSource* source = new InflateSource();
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    char msg[160];
+
+    for (int compressed = 0; compressed < 2; compressed++) {
+        WAVStream stream;
+        if (compressed) {
+            TEST_ASSERT_TRUE(source->open(packed.data(), packed.size(), wav.size()));
+            TEST_ASSERT_TRUE(stream.begin(source));
+        } else {
+            TEST_ASSERT_TRUE(stream.begin(wav.data(), wav.size()));
+        }
+
+        size_t played = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (!stream.is_finished()) {
+            stream.service();
+            played += stream.read_frames(out, MIXER_BLOCK_FRAMES);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        TEST_ASSERT_EQUAL(frames, played);
+
+        snprintf(msg, sizeof(msg), "%s: %u bytes, %.2f ns/sample, %.3f%% CPU per voice",
+                 compressed ? "deflate" : "stored ",
+                 (unsigned)(compressed ? packed.size() : wav.size()),
+                 (double)ns / (played * 2), ns / 1e9 * 100.0);
+        TEST_MESSAGE(msg);
+    }
+    delete source;
+}
+
+/**
+ * @brief Benchmark IMA-ADPCM decoding against 16-bit PCM through WAVStream.
+ * ADPCM reads a quarter of the bytes, which is the point on flash; this
+ * measures what the decode costs in exchange.
+ */
+void test_benchmark_ima_adpcm() {
+    const size_t frames = 44100; // One second of audio
+    std::vector<int16_t> pcm = make_adpcm_test_signal(frames, 2);
+    std::vector<uint8_t> adpcm = make_wav_ima_adpcm(pcm, 2, 1024);
+    std::vector<uint8_t> wav = make_wav_16bit_stereo(frames, 0, 0);
+    memcpy(&wav[44], pcm.data(), frames * 4);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    char msg[160];
+
+    for (int compressed = 0; compressed < 2; compressed++) {
+        const std::vector<uint8_t>& image = compressed ? adpcm : wav;
+        double best_ns = 0;
+        size_t played = 0;
+        for (int run = 0; run < 5; run++) {
+            WAVStream stream;
+            TEST_ASSERT_TRUE(stream.begin(image.data(), image.size()));
+            played = 0;
+            auto start = std::chrono::steady_clock::now();
+            while (!stream.is_finished()) {
+                stream.service();
+                played += stream.read_frames(out, MIXER_BLOCK_FRAMES);
+            }
+            double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || ns < best_ns) best_ns = ns;
+        }
+        TEST_ASSERT_TRUE(played >= frames);
+
+        snprintf(msg, sizeof(msg), "%s: %u bytes, %.2f ns/sample",
+                 compressed ? "ima-adpcm" : "pcm16    ",
+                 (unsigned)image.size(), best_ns / (played * 2));
+        TEST_MESSAGE(msg);
+    }
+}
+
+/**
+ * @brief Benchmark the per-voice cost of each resampling quality.
+ * One voice of 22.05 kHz audio is rendered at the output rate; the direct
+ * path (a 44.1 kHz voice) is the baseline.
+ */
+void test_benchmark_resampler() {
+    std::vector<uint8_t> native = make_wav_tone(44100);
+    std::vector<uint8_t> half = make_wav_tone(44100);
+    uint32_t rate = MIXER_OUTPUT_RATE / 2;
+    memcpy(&half[24], &rate, 4);
+    int16_t out[MIXER_BLOCK_FRAMES * 2];
+    char msg[160];
+
+    const char* names[] = { "direct   ", "linear   ", "polyphase" };
+    for (int quality = 0; quality < 3; quality++) {
+        SoundController controller;
+        SoftwareMixer* mixer = new SoftwareMixer(controller);
+        mixer->begin();
+        mixer->setResampleQuality(quality == 2 ? ResampleQuality::POLYPHASE : ResampleQuality::LINEAR);
+        const std::vector<uint8_t>& wav = quality == 0 ? native : half;
+
+        WAVStream* voice = mixer->acquire();
+        TEST_ASSERT_TRUE(voice->begin(wav.data(), wav.size()));
+        voice->setLooping(true);
+        mixer->play(voice);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_BLOCKS; i++) {
+            mixer->render(out, MIXER_BLOCK_FRAMES);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        snprintf(msg, sizeof(msg), "resampler %s: %.2f ns/sample per voice",
+                 names[quality], (double)ns / (BENCH_BLOCKS * MIXER_BLOCK_FRAMES * 2));
+        TEST_MESSAGE(msg);
+        delete mixer;
+    }
+}
+
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 // Main Test Runner
 // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
@@ -466,6 +2836,45 @@ void setup() {
     RUN_TEST(test_rcn227_per_output_v1_mapping);
     RUN_TEST(test_rcn227_per_output_v2_mapping);
     RUN_TEST(test_wav_stream_looping);
+    RUN_TEST(test_wav_stream_read_frames);
+    RUN_TEST(test_wav_stream_inflate);
+    RUN_TEST(test_asset_cache_shared_source);
+    RUN_TEST(test_asset_cache_file_source);
+    RUN_TEST(test_vsd_reader_locate_asset);
+    RUN_TEST(test_sample_cache);
+    RUN_TEST(test_mixer_block_render);
+    RUN_TEST(test_mixer_voice_pool);
+    RUN_TEST(test_mixer_voice_stealing);
+    RUN_TEST(test_mixer_steal_partial_tail);
+    RUN_TEST(test_mixer_event_timing);
+    RUN_TEST(test_mixer_pull_mode);
+    RUN_TEST(test_wav_file_driver);
+    RUN_TEST(test_sound_stats);
+    RUN_TEST(test_noise_shaper);
+    RUN_TEST(test_sigma_delta_spectrum);
+    RUN_TEST(test_dfplayer_queue);
+    RUN_TEST(test_dfplayer_driver);
+    RUN_TEST(test_mixer_resample_rate);
+    RUN_TEST(test_mixer_pitch);
+    RUN_TEST(test_mixer_max_pitch);
+    RUN_TEST(test_mixer_pitch_after_short_segment);
+    RUN_TEST(test_mixer_gain);
+    RUN_TEST(test_mixer_refill_schedule);
+    RUN_TEST(test_ima_adpcm_kernel);
+    RUN_TEST(test_wav_stream_ima_adpcm);
+    RUN_TEST(test_wav_stream_ima_adpcm_loop);
+    RUN_TEST(test_wav_stream_loop_points);
+    RUN_TEST(test_wav_stream_loop_crossfade);
+    RUN_TEST(test_vsd_config_function_index);
+    RUN_TEST(test_prime_mover);
+    RUN_TEST(test_chuff_generator);
+    RUN_TEST(test_spsc_queue_threads);
+    RUN_TEST(test_audio_engine_host_thread);
+    RUN_TEST(test_audio_engine_play_track);
+    RUN_TEST(test_benchmark_mixer_render);
+    RUN_TEST(test_benchmark_inflate_source);
+    RUN_TEST(test_benchmark_ima_adpcm);
+    RUN_TEST(test_benchmark_resampler);
     UNITY_END();
 }
 